@@ -0,0 +1,680 @@
+/**
+ * Copyright (C) 2015  Laurent Seiler
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "common.h"
+#include <getopt.h>
+#include <math.h>
+
+#define BENCH_MAX 32  // Results in a comparison file at most
+#define BENCH_PKTS 64  // Distinct messages cycled through
+#define BENCH_SCHED_NS 256  // Network segments per RX for the scheduler
+#define BENCH_TREND_NS 16  // Network segments of the synthetic trend check
+#define BENCH_TREND_SPACING 600  // Seconds between the slices of a NS
+#define BENCH_TREND_NOISE 0.3  // Standard deviation of the slices in dB
+
+// One benchmark. run() executes the operation 'iters' times.
+struct bench {
+	const char *name;
+	void (*setup)();
+	void (*run)(uint64_t iters);
+	void (*teardown)();
+	size_t bytes_per_op;  // Input consumed by one operation, 0 if none
+};
+
+// Outcome of a benchmark, as written and read by the comparison
+struct bench_result {
+	char name[64];
+	uint64_t iterations;
+	double ns_per_op;
+	double allocs_per_op;
+	double ops_per_sec;
+	double mb_per_sec;
+};
+
+static void bench_fill_sdd_struct(uint64_t iters);
+static void bench_build_uint64(uint64_t iters);
+static void setup_mc();
+static void bench_parse_buf_into_struct(uint64_t iters);
+static void setup_sdd_accu();
+static void teardown_sdd_accu();
+static void bench_handle_sdd_msg(uint64_t iters);
+static void setup_sched();
+static void teardown_sched();
+static void bench_ns_sched_weighted(uint64_t iters);
+static void setup_writer();
+static void teardown_writer();
+static void bench_db_insert_sdd(uint64_t iters);
+static void bench_db_insert_mc(uint64_t iters);
+static void drain_writer();
+static void measure(struct bench *b, int64_t min_ns, struct bench_result *r);
+static void print_result(FILE *out, struct bench_result *r);
+static size_t read_results(const char *filename, struct bench_result *res);
+static int compare(struct bench_result *old, size_t old_total,
+                   struct bench_result *new, size_t new_total,
+                   double threshold);
+static int trend_check(int days);
+static double gauss(uint64_t *state);
+
+static const struct bench benches[] = {
+	{ "fill_sdd_struct", NULL, bench_fill_sdd_struct, NULL, SDD_MIN_LEN },
+	{ "build_uint64", NULL, bench_build_uint64, NULL, 8 },
+	{ "parse_buf_into_struct", setup_mc, bench_parse_buf_into_struct, NULL,
+	  MC_MIN_LEN },
+	{ "handle_sdd_msg", setup_sdd_accu, bench_handle_sdd_msg,
+	  teardown_sdd_accu, SDD_MIN_LEN },
+	{ "ns_sched_weighted", setup_sched, bench_ns_sched_weighted,
+	  teardown_sched, 0 },
+	{ "db_insert_sdd", setup_writer, bench_db_insert_sdd, teardown_writer, 0 },
+	{ "db_insert_mc", setup_writer, bench_db_insert_mc, teardown_writer, 0 },
+};
+
+// Input and state of the benchmarks
+static unsigned char sdd_pkts[BENCH_PKTS][SDD_BUFSIZ];
+static unsigned char mc_pkts[2][MC_BUFSIZ];
+static struct mc_accu mc_accu;
+static struct ev_carry_sdd c_sdd;
+static struct rx_index rx_idx;
+static struct rx_index sched_idx;
+static struct db_writer dbw;
+static struct db_target dbt;
+static volatile uint64_t sink;  // Keeps the compiler from dropping results
+
+// Allocations of the whole process, counted by the wrappers below
+static uint64_t allocs;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size)
+{
+	++allocs;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	++allocs;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	++allocs;
+	return __libc_realloc(ptr, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	++allocs;
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	++allocs;
+	*memptr = __libc_memalign(alignment, size);
+	return *memptr ? 0 : ENOMEM;
+}
+
+/**
+ * Microbenchmarks of the hot path: Parsing the SDD and MODCOD messages,
+ * updating the slice accumulator and building the database documents.
+ * The results go to stdout as one JSON object per line. With --compare,
+ * they are checked against an earlier run instead, and the exit code
+ * tells if something got slower or allocates more. With --trend-days,
+ * the trend detectors are checked on synthetic slices instead.
+ */
+int main(int argc, char **argv)
+{
+	static const struct option opts[] = {
+		{ "time", required_argument, NULL, 't' },
+		{ "filter", required_argument, NULL, 'f' },
+		{ "compare", required_argument, NULL, 'c' },
+		{ "threshold", required_argument, NULL, 'T' },
+		{ "trend-days", required_argument, NULL, 'd' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct bench_result old[BENCH_MAX], new[BENCH_MAX];
+	size_t old_total, new_total;
+	const char *filter, *old_file;
+	double threshold;
+	int64_t min_ns;
+	int trend_days;
+	int opt;
+
+	min_ns = 500 * 1000000LL;
+	filter = NULL;
+	old_file = NULL;
+	threshold = 10;
+	trend_days = 0;
+
+	while ((opt = getopt_long(argc, argv, "t:f:c:T:d:h", opts, NULL)) != -1) {
+		switch (opt) {
+		case 't': min_ns = strtoll(optarg, NULL, 10) * 1000000LL; break;
+		case 'f': filter = optarg; break;
+		case 'c': old_file = optarg; break;
+		case 'T': threshold = strtod(optarg, NULL); break;
+		case 'd': trend_days = atoi(optarg); break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [options] [NEW_RESULTS]\n"
+				"  -t, --time MS          Minimum run time per "
+				"benchmark (500)\n"
+				"  -f, --filter TEXT      Only run benchmarks "
+				"containing TEXT\n"
+				"  -c, --compare FILE     Compare with the results "
+				"in FILE, or\n"
+				"                         compare FILE with "
+				"NEW_RESULTS without running\n"
+				"  -T, --threshold PCT    Slowdown counted as "
+				"regression (10)\n"
+				"  -d, --trend-days DAYS  Check the trend detectors "
+				"on DAYS days\n"
+				"                         of synthetic slices "
+				"instead\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (trend_days > 0)
+		return trend_check(trend_days) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	if (old_file)
+		old_total = read_results(old_file, old);
+
+	// Offline comparison of two result files
+	if (old_file && optind < argc) {
+		new_total = read_results(argv[optind], new);
+		return compare(old, old_total, new, new_total, threshold) ?
+		       EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	new_total = 0;
+	for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+		if (filter && !strstr(benches[i].name, filter))
+			continue;
+		measure((struct bench *)&benches[i], min_ns, &new[new_total]);
+		if (!old_file)
+			print_result(stdout, &new[new_total]);
+		++new_total;
+	}
+
+	if (old_file) {
+		return compare(old, old_total, new, new_total, threshold) ?
+		       EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Parse the lock bits and EsNo of an SDD message
+ */
+static void bench_fill_sdd_struct(uint64_t iters)
+{
+	struct sdd_msg msg;
+	uint64_t sum = 0;
+
+	for (uint64_t i = 0; i < iters; ++i) {
+		fill_sdd_struct(&msg, sdd_pkts[i % BENCH_PKTS]);
+		sum += msg.esno + msg.demod_locked;
+	}
+	sink = sum;
+}
+
+/**
+ * Build one of the MODCOD counters
+ */
+static void bench_build_uint64(uint64_t iters)
+{
+	uint64_t sum = 0;
+
+	for (uint64_t i = 0; i < iters; ++i)
+		sum += build_uint64(mc_pkts[0] + MC_HEADER_LEN + 8 * (i % 112));
+	sink = sum;
+}
+
+/**
+ * Prepare two MODCOD messages with different counters
+ */
+static void setup_mc()
+{
+	init_mc_accu(&mc_accu, 0);
+	for (int p = 0; p < 2; ++p) {
+		memset(mc_pkts[p], 0, MC_BUFSIZ);
+		for (int i = 0; i < MC_MODCODS * 4; ++i)
+			mc_pkts[p][MC_HEADER_LEN + 8 * i + 7] = (i * 7 + p) & 0xFF;
+	}
+}
+
+/**
+ * Parse a whole MODCOD message into the accumulator
+ */
+static void bench_parse_buf_into_struct(uint64_t iters)
+{
+	uint64_t sum = 0;
+
+	for (uint64_t i = 0; i < iters; ++i)
+		sum += parse_buf_into_struct(&mc_accu, mc_pkts[i & 1], i);
+	sink = sum + mc_accu.bit_rate;
+}
+
+/**
+ * Set up an accumulator of a single NS, without SNMP sessions
+ */
+static void setup_sdd_accu()
+{
+	memset(&rx_idx, 0, sizeof(rx_idx));
+	rx_idx.ns_idx[RX1].total = 1;
+	rx_idx.ns_idx[RX1].ns = calloc(1, sizeof(struct net_segment));
+	rx_idx.ns_rx_total = 1;
+
+	memset(&c_sdd, 0, sizeof(c_sdd));
+	c_sdd.rx_idx = &rx_idx;
+	reset_sdd_accu(&c_sdd.accu, RX1, 0, 0, 0);
+}
+
+/**
+ * Free the accumulator
+ */
+static void teardown_sdd_accu()
+{
+	free(rx_idx.ns_idx[RX1].ns);
+}
+
+/**
+ * Add SDD messages to the accumulator, within a slice so that it is
+ * never flushed. Every 16th message is unlocked.
+ */
+static void bench_handle_sdd_msg(uint64_t iters)
+{
+	time_t curr_ts;
+
+	for (uint64_t i = 0; i < iters; ++i) {
+		// Keep the EsNo sum from overflowing
+		if ((i & 0xFFFFF) == 0)
+			reset_sdd_accu(&c_sdd.accu, RX1, 0, 0, 0);
+
+		curr_ts = c_sdd.accu.since_mono + 2;
+		handle_sdd_msg(&c_sdd, sdd_pkts[i % BENCH_PKTS], curr_ts,
+		               curr_ts, curr_ts * 1000000000LL);
+	}
+	sink = c_sdd.accu.esno_sum;
+}
+
+/**
+ * Set up the weighted scheduler over BENCH_SCHED_NS network segments on
+ * each RX, without SNMP sessions
+ */
+static void setup_sched()
+{
+	memset(&sched_idx, 0, sizeof(sched_idx));
+	sched_idx.ns_rx_total = 2 * BENCH_SCHED_NS;
+	for (int rx = 0; rx < 2; ++rx) {
+		sched_idx.ns_idx[rx].total = BENCH_SCHED_NS;
+		sched_idx.ns_idx[rx].ns = calloc(BENCH_SCHED_NS,
+		                                 sizeof(struct net_segment));
+		for (int ns = 0; ns < BENCH_SCHED_NS; ++ns)
+			sched_idx.ns_idx[rx].ns[ns].alarm = 8 + ns % 5;
+	}
+
+	ns_sched_init(&sched_idx, NS_SCHED_WEIGHTED);
+}
+
+/**
+ * Free the scheduler
+ */
+static void teardown_sched()
+{
+	ns_sched_free(&sched_idx);
+	free(sched_idx.ns_idx[RX1].ns);
+	free(sched_idx.ns_idx[RX2].ns);
+}
+
+/**
+ * Report a slice and pick the next NS, as ns_take_next() does once per
+ * slice
+ */
+static void bench_ns_sched_weighted(uint64_t iters)
+{
+	size_t rx, ns;
+	time_t now;
+
+	now = 0;
+	for (uint64_t i = 0; i < iters; ++i) {
+		rx = sched_idx.current;
+		ns = sched_idx.ns_idx[rx].current;
+		ns_sched_slice_done(&sched_idx, rx, ns, 9 + (i * 7 + ns) % 9, 1);
+
+		now += SDD_TIME_SLICE;
+		ns_sched_next(&sched_idx, now, &rx, &ns);
+		sched_idx.current = rx;
+		sched_idx.ns_idx[rx].current = ns;
+	}
+	sink = sched_idx.current;
+}
+
+/**
+ * Set up a writer queue which is drained by the benchmark itself, so that
+ * no database is needed
+ */
+static void setup_writer()
+{
+	memset(&dbw, 0, sizeof(dbw));
+	spsc_ring_init(&dbw.queue, DB_WRITER_QUEUE_SIZE,
+	               sizeof(struct db_write));
+	dbt.writer = &dbw;
+	dbt.coll = 0;
+	init_mc_accu(&mc_accu, 0);
+	mc_accu.ts = time(NULL);
+}
+
+/**
+ * Free the writer queue
+ */
+static void teardown_writer()
+{
+	drain_writer();
+	spsc_ring_free(&dbw.queue);
+}
+
+/**
+ * Helper to free the queued documents, as the writer thread would
+ */
+static void drain_writer()
+{
+	struct db_write *write;
+
+	while ((write = spsc_ring_peek(&dbw.queue))) {
+		if (write->selector)
+			bson_destroy(write->selector);
+		bson_destroy(write->doc);
+		spsc_ring_release(&dbw.queue);
+	}
+}
+
+/**
+ * Build and queue SDD documents. Freeing them is part of the operation,
+ * as the writer has to do it anyway.
+ */
+static void bench_db_insert_sdd(uint64_t iters)
+{
+	time_t ts = time(NULL);
+	struct sdd_slice_stats stats = {
+		.min = 11.2, .max = 13.4, .stddev = 0.4,
+		.p05 = 11.8, .p50 = 12.5, .p95 = 13.1
+	};
+
+	for (uint64_t i = 0; i < iters; ++i) {
+		db_insert_sdd(&dbt, RX1, "Blade30", ts + i, 12.5, &stats);
+		drain_writer();
+	}
+}
+
+/**
+ * Build and queue MODCOD documents, freeing them as above
+ */
+static void bench_db_insert_mc(uint64_t iters)
+{
+	for (uint64_t i = 0; i < iters; ++i) {
+		db_insert_mc(&dbt, &mc_accu);
+		drain_writer();
+	}
+}
+
+/**
+ * Run a benchmark with growing iteration counts until it takes at least
+ * 'min_ns', and take the last run as result
+ */
+static void measure(struct bench *b, int64_t min_ns, struct bench_result *r)
+{
+	uint64_t iters, allocs_before;
+	int64_t start, elapsed;
+
+	// SDD messages with a spread of EsNo values, some unlocked
+	for (int p = 0; p < BENCH_PKTS; ++p) {
+		memset(sdd_pkts[p], 0, SDD_BUFSIZ);
+		sdd_pkts[p][SDD_LOCK_OFFSET] = (p % 16) ? 0xD0 : 0x00;
+		sdd_pkts[p][SDD_ESNO_OFFSET] = 0;
+		sdd_pkts[p][SDD_ESNO_OFFSET + 1] = 100 + p;
+	}
+
+	if (b->setup)
+		b->setup();
+
+	// Warm up
+	b->run(1000);
+
+	iters = 1000;
+	for (;;) {
+		allocs_before = allocs;
+		start = latency_now_ns();
+		b->run(iters);
+		elapsed = latency_now_ns() - start;
+
+		if (elapsed >= min_ns)
+			break;
+
+		// Aim at 1.2 times the minimum, but grow at most 100x
+		if (elapsed < min_ns / 100)
+			iters *= 100;
+		else
+			iters = iters * 1.2 * min_ns / elapsed;
+	}
+
+	if (b->teardown)
+		b->teardown();
+
+	strncpy(r->name, b->name, sizeof(r->name) - 1);
+	r->name[sizeof(r->name) - 1] = 0;
+	r->iterations = iters;
+	r->ns_per_op = (double)elapsed / iters;
+	r->allocs_per_op = (double)(allocs - allocs_before) / iters;
+	r->ops_per_sec = 1e9 / r->ns_per_op;
+	r->mb_per_sec = b->bytes_per_op * r->ops_per_sec / 1e6;
+}
+
+/**
+ * Helper to print a result as a line of JSON
+ */
+static void print_result(FILE *out, struct bench_result *r)
+{
+	fprintf(out, "{\"name\":\"%s\",\"iterations\":%"PRIu64","
+	        "\"ns_per_op\":%.3f,\"allocs_per_op\":%.3f,"
+	        "\"ops_per_sec\":%.0f,\"mb_per_sec\":%.3f}\n",
+	        r->name, r->iterations, r->ns_per_op, r->allocs_per_op,
+	        r->ops_per_sec, r->mb_per_sec);
+	fflush(out);
+}
+
+/**
+ * Helper to read results as written by print_result()
+ *
+ * @return Number of results read
+ */
+static size_t read_results(const char *filename, struct bench_result *res)
+{
+	FILE *file;
+	char line[512];
+	size_t total;
+
+	if (!(file = fopen(filename, "r"))) {
+		perror("Could not open benchmark results");
+		exit(EXIT_FAILURE);
+	}
+
+	total = 0;
+	while (total < BENCH_MAX && fgets(line, sizeof(line), file)) {
+		struct bench_result *r = &res[total];
+
+		if (sscanf(line, " {\"name\":\"%63[^\"]\",\"iterations\":%"SCNu64","
+		           "\"ns_per_op\":%lf,\"allocs_per_op\":%lf,"
+		           "\"ops_per_sec\":%lf,\"mb_per_sec\":%lf}",
+		           r->name, &r->iterations, &r->ns_per_op,
+		           &r->allocs_per_op, &r->ops_per_sec,
+		           &r->mb_per_sec) == 6)
+			++total;
+	}
+
+	fclose(file);
+
+	return total;
+}
+
+/**
+ * Helper to compare two sets of results. A benchmark regressed if it got
+ * slower by more than 'threshold' percent, or allocates more.
+ *
+ * @return Number of regressions
+ */
+static int compare(struct bench_result *old, size_t old_total,
+                   struct bench_result *new, size_t new_total,
+                   double threshold)
+{
+	int regressions = 0;
+
+	printf("%-24s %12s %12s %9s %10s %10s\n", "benchmark", "old ns/op",
+	       "new ns/op", "delta", "old allocs", "new allocs");
+
+	for (size_t i = 0; i < new_total; ++i) {
+		struct bench_result *o = NULL;
+		double delta;
+		int regressed;
+
+		for (size_t j = 0; j < old_total; ++j) {
+			if (strcmp(old[j].name, new[i].name) == 0)
+				o = &old[j];
+		}
+		if (!o) {
+			printf("%-24s %12s %12.3f %9s %10s %10.3f\n", new[i].name,
+			       "-", new[i].ns_per_op, "new", "-",
+			       new[i].allocs_per_op);
+			continue;
+		}
+
+		delta = 100 * (new[i].ns_per_op - o->ns_per_op) / o->ns_per_op;
+		regressed = delta > threshold ||
+		            new[i].allocs_per_op > o->allocs_per_op + 0.001;
+		regressions += regressed;
+
+		printf("%-24s %12.3f %12.3f %+8.1f%% %10.3f %10.3f%s\n",
+		       new[i].name, o->ns_per_op, new[i].ns_per_op, delta,
+		       o->allocs_per_op, new[i].allocs_per_op,
+		       regressed ? "  REGRESSION" : "");
+	}
+
+	return regressions;
+}
+
+/**
+ * Feed the trend detectors of BENCH_TREND_NS network segments with one
+ * slice every BENCH_TREND_SPACING seconds over 'days' days, on a simulated
+ * clock. The slices have BENCH_TREND_NOISE dB of noise around 12 dB, and
+ * from half-time on, they either stay there, decline by 0.08 dB per day or
+ * drop by 1.5 dB. One line of JSON per scenario tells what was detected.
+ *
+ * @return Number of failed scenarios: A stationary NS with more than one
+ *         change point or any drift or slope, or a declining or dropping
+ *         one where it is not detected
+ */
+static int trend_check(int days)
+{
+	static const struct {
+		const char *name;
+		double slope;  // dB per day from half-time on
+		double step;  // dB from half-time on
+		int expect;  // TREND_* bits every NS must show one of, 0 for none
+	} scenarios[] = {
+		{ "stationary", 0, 0, 0 },
+		{ "decline", -0.08, 0,
+		  TREND_SLOPE | TREND_DRIFT | TREND_SHIFT_DOWN },
+		{ "drop", 0, -1.5, TREND_SHIFT_DOWN },
+	};
+	int failed = 0;
+
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i) {
+		uint64_t counts[6] = { 0 };
+		int missed, excess;
+
+		missed = excess = 0;
+		for (int ns = 0; ns < BENCH_TREND_NS; ++ns) {
+			struct esno_trend trend;
+			uint64_t rng = 0x9E3779B97F4A7C15ULL * (ns + 1);
+			time_t ts = 1500000000;
+			int seen = 0, shifts = 0;
+
+			memset(&trend, 0, sizeof(trend));
+			for (int n = 0; n < days * 86400 / BENCH_TREND_SPACING;
+			     ++n) {
+				double day, esno;
+				int flags;
+
+				ts += BENCH_TREND_SPACING;
+				day = (double)n * BENCH_TREND_SPACING / 86400;
+				esno = 12 + BENCH_TREND_NOISE * gauss(&rng);
+				if (day > days / 2.0) {
+					esno += scenarios[i].slope *
+					        (day - days / 2.0);
+					esno += scenarios[i].step;
+				}
+
+				flags = esno_trend_push(&trend, ts, esno);
+				seen |= flags;
+				for (int bit = 2; bit < 6; ++bit)
+					counts[bit] += (flags >> bit) & 1;
+				shifts += !!(flags & (TREND_SHIFT_DOWN |
+				                      TREND_SHIFT_UP));
+			}
+
+			if (scenarios[i].expect && !(seen & scenarios[i].expect))
+				++missed;
+			if (!scenarios[i].expect &&
+			    (shifts > 1 || (seen & (TREND_DRIFT | TREND_SLOPE))))
+				++excess;
+		}
+
+		printf("{\"name\":\"trend_%s\",\"days\":%d,\"ns\":%d,"
+		       "\"drift\":%"PRIu64",\"slope\":%"PRIu64","
+		       "\"shift_down\":%"PRIu64",\"shift_up\":%"PRIu64","
+		       "\"missed\":%d,\"excess\":%d}\n",
+		       scenarios[i].name, days, BENCH_TREND_NS, counts[2],
+		       counts[3], counts[4], counts[5], missed, excess);
+		failed += missed || excess;
+	}
+
+	return failed;
+}
+
+/**
+ * Helper to draw from the standard normal distribution, with Box-Muller
+ * on a xorshift generator, so that every run sees the same slices
+ */
+static double gauss(uint64_t *state)
+{
+	double u, v;
+
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	u = ((*state >> 11) + 1.0) / 9007199254740993.0;
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	v = (*state >> 11) / 9007199254740992.0;
+
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
@@ -14,6 +14,9 @@ ns=$2
 flags=$3
 flag_invalid=$(bit_at_mask 0 $flags)
 flag_esno=$(bit_at_mask 1 $flags)
+flag_drift=$(bit_at_mask 2 $flags)
+flag_slope=$(bit_at_mask 3 $flags)
+flag_shift=$(bit_at_mask 4 $flags)
 
 # Check flags and quit if everything is okay
 test $flags -eq 0 && exit 0
@@ -34,6 +37,21 @@ then
         msg+="interface!\n"
 fi
 
+if $flag_drift
+then
+        msg+="EsNo fell below its long-term baseline.\n"
+fi
+
+if $flag_slope
+then
+        msg+="EsNo is declining steadily.\n"
+fi
+
+if $flag_shift
+then
+        msg+="EsNo dropped to a lower level.\n"
+fi
+
 # Write to system log
 logger $msg
 
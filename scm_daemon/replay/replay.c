@@ -0,0 +1,421 @@
+/**
+ * Copyright (C) 2015  Laurent Seiler
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "common.h"
+#include "device.h"
+#include "mon_pool.h"
+#include "alarm_dispatch.h"
+#include "recorder.h"
+#include <getopt.h>
+#include <math.h>
+
+#define REPLAY_DB_NAME "tc1_replay"  // Keeps the replayed slices apart
+#define REPLAY_SPOOL_FILE "replay_spool.bin"
+#define REPLAY_BATCH 64  // Records handled per callback at most
+#define REPLAY_SYNTH_RATE 2  // Synthetic SDD messages per second
+#define REPLAY_SYNTH_ESNO 150  // Synthetic EsNo in 0.1 dB, above the thresholds
+#define REPLAY_SYNTH_GAP 3600  // Seconds between two pauses of the synthetic messages
+#define REPLAY_SYNTH_TOL 1.0  // dB the EsNo windows may be off after a synthetic day
+
+// State of the replay, and carry for its LibEvent callback
+struct replay {
+	struct flight_recorder rec;
+	uint64_t pos;  // Next record
+	struct tc1_device *dev;
+	struct vclock clock;  // Simulated, follows the recorded time
+	struct event_base *evbase;
+	struct event *ev_step;
+	double speed;  // Multiple of the recorded pace, 0 for full speed
+	int filter;  // Only replay the records of 'source'
+	struct in6_addr source;
+	int64_t first_ns;  // Recorded time of the first record
+	int64_t start_ns;  // Monotonic time the replay started at
+	time_t last_sdd_ts;  // Of the last SDD message, for the timeouts
+	time_t next_mon_ts;  // Of the next check of the EsNo monitor
+	time_t next_lock_ts;  // Of the next report of the lock times
+	time_t next_trend_ts;  // Of the next save of the trend detectors
+	uint64_t sdd, mc, skipped;
+};
+
+static void cb_replay_step(evutil_socket_t fd, short events, void *carry);
+static void replay_record(struct replay *rp, struct recorder_entry *entry,
+                          unsigned char *payload);
+static void synthesize(const char *filename);
+static int synth_check(struct replay *rp);
+
+/**
+ * Feed a recording of the daemon back into the real handlers, at the
+ * recorded pace, N times faster or as fast as possible. The handlers run on
+ * an event loop like in the daemon, but on a simulated clock following the
+ * recorded time stamps, so that the slices and monitor checks come out the
+ * same at any speed. The documents go to their own database. With
+ * --synthetic, a day of generated messages is replayed instead, and the EsNo
+ * windows are checked at the end.
+ */
+int main(int argc, char **argv)
+{
+	static const struct option opts[] = {
+		{ "speed", required_argument, NULL, 's' },
+		{ "source", required_argument, NULL, 'S' },
+		{ "db", required_argument, NULL, 'd' },
+		{ "ns-config", required_argument, NULL, 'c' },
+		{ "tc1", required_argument, NULL, 't' },
+		{ "synthetic", required_argument, NULL, 'y' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *db_name, *ns_config, *tc1_addr, *recording, *synth_file;
+	struct replay rp;
+	struct recorder_entry *entry;
+	unsigned char *payload;
+	uint64_t pos;
+	int64_t elapsed_ns;
+	int opt, failed;
+
+	memset(&rp, 0, sizeof(rp));
+	rp.speed = 1;
+	db_name = REPLAY_DB_NAME;
+	ns_config = NS_CONFIG_FILE;
+	tc1_addr = NULL;
+	synth_file = NULL;
+
+	while ((opt = getopt_long(argc, argv, "s:S:d:c:t:y:h", opts,
+	                          NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			rp.speed = strcmp(optarg, "max") ?
+			           strtod(optarg, NULL) : 0;
+			break;
+		case 'S':
+			rp.filter = 1;
+			if (!inet_pton(AF_INET6, optarg, &rp.source)) {
+				struct in_addr addr4;
+
+				if (inet_pton(AF_INET, optarg, &addr4) != 1) {
+					fprintf(stderr, "Invalid address '%s'!\n",
+					        optarg);
+					exit(EXIT_FAILURE);
+				}
+				memset(&rp.source, 0, sizeof(rp.source));
+				rp.source.s6_addr[10] = 0xff;
+				rp.source.s6_addr[11] = 0xff;
+				memcpy(&rp.source.s6_addr[12], &addr4, 4);
+			}
+			break;
+		case 'd': db_name = optarg; break;
+		case 'c': ns_config = optarg; break;
+		case 't': tc1_addr = optarg; break;
+		case 'y': synth_file = optarg; break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [options] RECORDING\n"
+				"  -s, --speed N|max    Pace, as a multiple of the "
+				"recorded one (1)\n"
+				"  -S, --source ADDR    Only replay the messages of "
+				"this TC1\n"
+				"  -d, --db NAME        Database to write to (%s)\n"
+				"  -c, --ns-config FILE Network segments (%s)\n"
+				"  -t, --tc1 ADDR       Send the frequency switches "
+				"to ADDR, e.g. tc1_sim\n"
+				"  -y, --synthetic FILE Write a day of synthetic "
+				"messages to FILE,\n"
+				"                       replay it at full speed and "
+				"check the EsNo\n",
+				argv[0], REPLAY_DB_NAME, NS_CONFIG_FILE);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if ((optind >= argc && !synth_file) || rp.speed < 0) {
+		fprintf(stderr, "Usage: %s [options] RECORDING\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (synth_file) {
+		synthesize(synth_file);
+		recording = synth_file;
+		rp.speed = 0;
+	} else {
+		recording = argv[optind];
+	}
+
+	recorder_load(&rp.rec, recording);
+	rp.pos = recorder_read_begin(&rp.rec);
+
+	pos = rp.pos;
+	if (!recorder_read(&rp.rec, &pos, &entry, &payload)) {
+		fprintf(stderr, "Recording '%s' is empty.\n", recording);
+		exit(EXIT_FAILURE);
+	}
+	rp.first_ns = entry->ts_ns;
+	rp.last_sdd_ts = rp.first_ns / 1000000000;
+	rp.next_mon_ts = rp.last_sdd_ts + MON_CHECK_INTERVAL;
+	rp.next_lock_ts = rp.last_sdd_ts + LOCK_REPORT_INTERVAL;
+	rp.next_trend_ts = rp.last_sdd_ts + TREND_SAVE_INTERVAL;
+	vclock_init_sim(&rp.clock, rp.last_sdd_ts);
+
+	// Set up the device as the daemon does in single mode, without
+	// alarms. The frequency switches go to 'tc1_addr', e.g. tc1_sim, or
+	// are confirmed at once if there is none.
+	struct event_base *evbase;
+	evthread_use_pthreads();
+	evbase = event_base_new();
+	rp.evbase = evbase;
+
+	mongoc_client_t *db_client;
+	struct db_writer db_writer;
+	db_client = db_init();
+	db_writer_init(&db_writer, REPLAY_SPOOL_FILE);
+
+	struct mon_pool mon_pool;
+	struct alarm_dispatcher alarms;
+	mon_pool_init(&mon_pool, 1);
+	alarm_dispatcher_init(&alarms, evbase, 0);
+
+	struct tc1_device dev;
+	device_setup(&dev, "TC1", tc1_addr ? tc1_addr : "127.0.0.1", ns_config,
+	             db_name);
+	dev.offline = !tc1_addr;
+	device_init(&dev, evbase, &rp.clock, db_client, &db_writer, &mon_pool,
+	            &alarms);
+	rp.dev = &dev;
+
+	// The monitor checks, lock reports and trend saves follow the
+	// simulated clock instead of their timers
+	event_del(dev.ev_mon);
+	event_del(dev.ev_lock);
+	event_del(dev.ev_trend);
+
+	rp.ev_step = event_new(evbase, -1, 0, cb_replay_step, &rp);
+	event_active(rp.ev_step, EV_TIMEOUT, 0);
+
+	db_writer_start(&db_writer);
+	rp.start_ns = latency_now_ns();
+	event_base_dispatch(evbase);
+	elapsed_ns = latency_now_ns() - rp.start_ns;
+	cb_lock_report(-1, EV_TIMEOUT, &dev);
+	cb_trend_save(-1, EV_TIMEOUT, &dev);
+	mon_pool_stop(&mon_pool);
+	db_writer_stop(&db_writer);
+
+	printf("Replayed %"PRIu64" SDD and %"PRIu64" MODCOD messages "
+	       "(%"PRIu64" skipped) in %.3f s, %.0f messages/s.\n",
+	       rp.sdd, rp.mc, rp.skipped, elapsed_ns / 1e9,
+	       (rp.sdd + rp.mc) / (elapsed_ns / 1e9));
+	if (db_writer.dropped > 0)
+		printf("%zu documents dropped by the DB writer!\n",
+		       db_writer.dropped);
+	latency_print(stdout);
+	failed = synth_file ? synth_check(&rp) : 0;
+
+	event_free(rp.ev_step);
+	device_free(&dev);
+	alarm_dispatcher_free(&alarms);
+	event_base_free(evbase);
+	db_writer_free(&db_writer);
+	mon_pool_free(&mon_pool);
+	db_free(db_client);
+	recorder_close(&rp.rec);
+	latency_free();
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * Callback for LibEvent: Replay the records which are due, and wait for the
+ * next one. A batch at most is replayed each time, so that the other events
+ * of the loop still get their turn.
+ */
+static void cb_replay_step(evutil_socket_t fd, short events, void *carry)
+{
+	struct replay *rp;
+	struct recorder_entry *entry;
+	unsigned char *payload;
+	uint64_t pos;
+
+	// Unpack carry
+	rp = (struct replay *)carry;
+
+	for (int i = 0; i < REPLAY_BATCH; ++i) {
+		pos = rp->pos;
+		if (!recorder_read(&rp->rec, &pos, &entry, &payload)) {
+			event_base_loopbreak(rp->evbase);
+			return;
+		}
+
+		if (rp->speed > 0) {
+			int64_t wait_ns;
+
+			wait_ns = rp->start_ns +
+			          (entry->ts_ns - rp->first_ns) / rp->speed -
+			          latency_now_ns();
+			if (wait_ns > 0) {
+				struct timeval tv = {
+					.tv_sec = wait_ns / 1000000000,
+					.tv_usec = wait_ns % 1000000000 / 1000
+				};
+				event_add(rp->ev_step, &tv);
+				return;
+			}
+		}
+
+		rp->pos = pos;
+		replay_record(rp, entry, payload);
+	}
+
+	event_active(rp->ev_step, EV_TIMEOUT, 0);
+}
+
+/**
+ * Helper to hand one record to the handlers, as the receive callbacks of
+ * the daemon would. Gaps in the SDD messages time out like in the daemon,
+ * and the monitor is checked whenever its interval has passed.
+ */
+static void replay_record(struct replay *rp, struct recorder_entry *entry,
+                          unsigned char *payload)
+{
+	struct tc1_device *dev = rp->dev;
+	time_t curr_ts;
+
+	if (rp->filter && memcmp(&entry->addr, &rp->source,
+	                         sizeof(struct in6_addr))) {
+		++rp->skipped;
+		return;
+	}
+
+	curr_ts = entry->ts_ns / 1000000000;
+
+	if (entry->type == REC_SDD) {
+		while (curr_ts - rp->last_sdd_ts >= SDD_TIMEOUT) {
+			rp->last_sdd_ts += SDD_TIMEOUT;
+			vclock_set(&rp->clock, rp->last_sdd_ts);
+			handle_sdd_timeout(&dev->c_sdd);
+		}
+		rp->last_sdd_ts = curr_ts;
+	}
+
+	vclock_set_ns(&rp->clock, entry->ts_ns);
+	while (vclock_now(&rp->clock) >= rp->next_mon_ts) {
+		cb_esno_degradation_monitor(-1, EV_TIMEOUT, &dev->c_mon);
+		rp->next_mon_ts += MON_CHECK_INTERVAL;
+	}
+	while (vclock_now(&rp->clock) >= rp->next_lock_ts) {
+		cb_lock_report(-1, EV_TIMEOUT, dev);
+		rp->next_lock_ts += LOCK_REPORT_INTERVAL;
+	}
+	while (vclock_now(&rp->clock) >= rp->next_trend_ts) {
+		cb_trend_save(-1, EV_TIMEOUT, dev);
+		rp->next_trend_ts += TREND_SAVE_INTERVAL;
+	}
+
+	if (entry->type == REC_SDD) {
+		if (entry->len < SDD_MIN_LEN) {
+			++rp->skipped;
+			return;
+		}
+		handle_sdd_msg(&dev->c_sdd, payload, curr_ts, curr_ts,
+		               entry->ts_ns);
+		++rp->sdd;
+	} else if (entry->type == REC_MC) {
+		if (entry->len < MC_MIN_LEN) {
+			++rp->skipped;
+			return;
+		}
+		handle_mc_msg(&dev->c_mc, payload, curr_ts);
+		++rp->mc;
+	}
+}
+
+/**
+ * Write a day (MON_OBSERVATION_TIME) of synthetic SDD messages of a single
+ * TC1 to 'filename', ending now. The EsNo stays within 0.1 dB of
+ * REPLAY_SYNTH_ESNO. Every REPLAY_SYNTH_GAP seconds, the messages pause for
+ * twice SDD_TIMEOUT, so that void slices end up in the windows as well.
+ */
+static void synthesize(const char *filename)
+{
+	struct flight_recorder rec;
+	struct in6_addr addr;
+	unsigned char buf[SDD_MIN_LEN];
+	uint64_t total;
+	int64_t start_ns, ts_ns;
+	int esno;
+
+	// An existing file would keep its records, one more covers the header
+	total = (uint64_t)MON_OBSERVATION_TIME * REPLAY_SYNTH_RATE;
+	unlink(filename);
+	recorder_open(&rec, filename, (total + 1) *
+	              (sizeof(struct recorder_entry) + SDD_MIN_LEN + 8));
+
+	// From 127.0.0.1, mapped like device_addr_key() does
+	memset(&addr, 0, sizeof(addr));
+	addr.s6_addr[10] = 0xff;
+	addr.s6_addr[11] = 0xff;
+	addr.s6_addr[12] = 127;
+	addr.s6_addr[15] = 1;
+
+	memset(buf, 0, sizeof(buf));
+	buf[SDD_LOCK_OFFSET] = (1 << 4) | (1 << 6) | (1 << 7);
+
+	start_ns = ((int64_t)time(NULL) - MON_OBSERVATION_TIME) * 1000000000;
+	for (uint64_t i = 0; i < total; ++i) {
+		if (i / REPLAY_SYNTH_RATE % REPLAY_SYNTH_GAP >=
+		    REPLAY_SYNTH_GAP - 2 * SDD_TIMEOUT)
+			continue;
+
+		ts_ns = start_ns + (int64_t)i * 1000000000 / REPLAY_SYNTH_RATE;
+		esno = REPLAY_SYNTH_ESNO + (int)(i % 3) - 1;
+		buf[SDD_ESNO_OFFSET] = (esno >> 8) & 0xFF;
+		buf[SDD_ESNO_OFFSET + 1] = esno & 0xFF;
+		recorder_add(&rec, REC_SDD, ts_ns, &addr, buf, sizeof(buf));
+	}
+
+	recorder_close(&rec);
+}
+
+/**
+ * Check the EsNo windows after a synthetic day: Every NS must have slices
+ * within the observation time, averaging within REPLAY_SYNTH_TOL dB of
+ * REPLAY_SYNTH_ESNO, the void slices included.
+ *
+ * @return The number of NS failing the check
+ */
+static int synth_check(struct replay *rp)
+{
+	struct rx_index *rx_idx = &rp->dev->rx_idx;
+	struct net_segment *this_ns;
+	time_t now;
+	double avg;
+	int ok, failed = 0;
+
+	now = vclock_now(&rp->clock);
+	for (size_t rx = 0; rx < 2; ++rx) {
+		for (size_t ns = 0; ns < rx_idx->ns_idx[rx].total; ++ns) {
+			this_ns = ns_get(rx_idx, rx, ns);
+			esno_window_expire(&this_ns->window, now);
+			avg = esno_window_avg(&this_ns->window);
+			ok = this_ns->window.count > 0 &&
+			     fabs(avg - REPLAY_SYNTH_ESNO / 10.0) <=
+			     REPLAY_SYNTH_TOL;
+			failed += !ok;
+
+			printf("%s on %s: %zu slices, %.2f dB%s\n",
+			       this_ns->name, rx == RX1 ? "RX1" : "RX2",
+			       this_ns->window.count, avg,
+			       ok ? "" : " - FAILED");
+		}
+	}
+
+	return failed;
+}
@@ -0,0 +1,90 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <event2/event.h>
+#include "tc1_proto.h"
+
+#define SIM_SDD_LEN 160  // Bytes per SDD message, a bit more than parsed
+#define SIM_MAX_SUBIDS 32  // Longest OID the SNMP stand-in understands
+#define SIM_SNMP_BUFSIZ 1500
+
+enum { SIM_FADE_NONE = 0, SIM_FADE_SINE, SIM_FADE_RAIN, SIM_FADE_RAMP };
+
+// Settings, shared by all simulated units
+struct sim_config {
+	unsigned int units;
+	struct in_addr base_addr;  // Of the first unit, the others follow
+	struct sockaddr_in daemon_sdd;
+	struct sockaddr_in daemon_mc;
+	unsigned short snmp_port;
+	double sdd_rate;  // SDD messages per second and unit
+	unsigned int mc_interval;  // Seconds between MODCOD messages, 0: none
+	double frame_rate;  // BBFRAMEs per second counted in the MODCOD stats
+	unsigned int lock_ms;  // Time to lock after a retune
+	unsigned int lock_jitter_ms;
+	double loss_prob;  // Per SDD message, of losing the lock
+	unsigned int loss_ms;  // Duration of such an outage
+	double no_lock_share;  // Of the frequencies which never lock
+	double esno_base;  // dB, the segments spread around it
+	double esno_noise;  // Standard deviation in dB
+	int fade;  // SIM_FADE_*
+	double fade_a, fade_b, fade_c;  // Parameters of the fade profile
+	uint64_t seed;
+	const char *fleet_file;  // Fleet config to write, or NULL
+	const char *ns_config;  // NS config referenced in the fleet config
+};
+
+// One simulated TC1
+struct sim_unit {
+	unsigned int idx;
+	struct sim_config *cfg;
+	struct in_addr addr;
+	int sock_tx;  // Sends SDD and MODCOD messages from the unit's address
+	int sock_snmp;
+	struct event *ev_sdd;
+	struct event *ev_mc;
+	struct event *ev_snmp;
+	unsigned long freq[2][2];  // [rx][profile]
+	unsigned char profile[2];  // Active profile of each RX
+	unsigned char rx;  // Active RX, 0 or 1
+	int64_t lock_at_ms;  // Unlocked until then, after a retune
+	int64_t outage_until_ms;
+	int64_t start_ms;
+	double rain_db;  // Current depth of a rain fade
+	int64_t rain_until_ms;
+	uint64_t rng;
+	uint64_t modcods[MC_MODCODS][4];
+	uint64_t sdd_sent;
+	uint64_t mc_sent;
+	uint64_t snmp_requests;
+	uint64_t retunes;
+};
+
+// OIDs of the TC1, parsed at startup
+struct sim_oid {
+	size_t len;
+	unsigned long subids[SIM_MAX_SUBIDS];
+};
+
+void sim_snmp_init();
+void cb_sim_snmp(evutil_socket_t fd, short events, void *carry);
+unsigned long sim_tuned_freq(struct sim_unit *u);
+void sim_retune(struct sim_unit *u);
+int sim_is_locked(struct sim_unit *u, int64_t now_ms);
+int64_t sim_now_ms();
+
+#endif // SIM_H
@@ -0,0 +1,476 @@
+#include "sim.h"
+
+// BER tags, as far as SNMPv2c needs them
+#define BER_INTEGER 0x02
+#define BER_OCTET_STRING 0x04
+#define BER_NULL 0x05
+#define BER_OID 0x06
+#define BER_SEQUENCE 0x30
+#define BER_UNSIGNED 0x42
+#define BER_NO_SUCH_OBJECT 0x80
+#define PDU_GET 0xA0
+#define PDU_RESPONSE 0xA2
+#define PDU_SET 0xA3
+#define BER_HDR_MAX 4  // Tag and long form length, as ber_wrap() writes them
+
+#define SNMP_ERR_GEN 5
+#define SNMP_ERR_WRONG_VALUE 10
+#define SNMP_ERR_NOT_WRITABLE 17
+
+enum {
+	OID_TUNER = 0,  // [rx][profile]
+	OID_MODE = 4,  // [rx][profile]
+	OID_RX_MGMT = 8,
+	OID_STATUS = 9,  // [rx]
+	OID_TOTAL = 11
+};
+
+// One variable binding of a request, pointing into the request
+struct varbind {
+	const unsigned char *tlv;  // Whole OID TLV, copied into the response
+	size_t tlv_len;
+	struct sim_oid oid;
+	unsigned char type;
+	unsigned long val;
+	const unsigned char *val_tlv;
+	size_t val_tlv_len;
+};
+
+static int ber_read(const unsigned char *buf, size_t len, size_t *pos,
+                    unsigned char *tag, size_t *vlen);
+static size_t ber_wrap(unsigned char *out, unsigned char tag,
+                       const unsigned char *content, size_t clen);
+static size_t ber_uint(unsigned char *out, unsigned char tag, unsigned long v);
+static int ber_fits(size_t used, size_t clen, size_t size);
+static int decode_oid(const unsigned char *buf, size_t len, struct sim_oid *o);
+static int parse_oid_str(const char *str, struct sim_oid *o);
+static int match_oid(struct sim_oid *o);
+static int apply_set(struct sim_unit *u, struct varbind *vbs, size_t count,
+                     long *errindex);
+static size_t get_value(struct sim_unit *u, struct varbind *vb,
+                        unsigned char *out);
+
+// The OIDs the stand-in knows, parsed once from tc1_proto.h
+static struct sim_oid oids[OID_TOTAL];
+
+/**
+ * Parse the OIDs of the TC1. Has to be called before the first request.
+ */
+void sim_snmp_init()
+{
+	const char *strs[OID_TOTAL] = {
+		SNMP_RX1_CFG1_TUNER, SNMP_RX1_CFG2_TUNER,
+		SNMP_RX2_CFG1_TUNER, SNMP_RX2_CFG2_TUNER,
+		SNMP_RX1_CFG1_MODE, SNMP_RX1_CFG2_MODE,
+		SNMP_RX2_CFG1_MODE, SNMP_RX2_CFG2_MODE,
+		SNMP_RX_MGMT,
+		SNMP_RX1_STATUS, SNMP_RX2_STATUS,
+	};
+
+	for (int i = 0; i < OID_TOTAL; ++i) {
+		if (!parse_oid_str(strs[i], &oids[i])) {
+			fprintf(stderr, "Simulator: Invalid OID '%s'!\n", strs[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/**
+ * Callback for LibEvent when an SNMP request arrived at a unit: Parse the
+ * SNMPv2c GET or SET, apply it to the unit and send the response. The
+ * community is not checked. A request whose response would not fit into
+ * SIM_SNMP_BUFSIZ is dropped, as a real agent would answer tooBig.
+ */
+void cb_sim_snmp(evutil_socket_t fd, short events, void *carry)
+{
+	struct sim_unit *u;
+	unsigned char req[SIM_SNMP_BUFSIZ];
+	unsigned char vbl[SIM_SNMP_BUFSIZ], pdu[SIM_SNMP_BUFSIZ];
+	unsigned char msg[SIM_SNMP_BUFSIZ], resp[SIM_SNMP_BUFSIZ];
+	unsigned char vb[256], val[32];
+	struct varbind vbs[16];
+	struct sockaddr_storage from;
+	socklen_t from_len;
+	ssize_t len;
+	size_t pos, end, vlen, hdr_start, vbl_len, pdu_len, msg_len;
+	size_t reqid_start, reqid_len, count;
+	unsigned char tag, pdu_type;
+	long errstat, errindex;
+	int fits;
+
+	u = (struct sim_unit *)carry;
+
+	for (;;) {
+		from_len = sizeof(from);
+		len = recvfrom(fd, req, sizeof(req), 0, (struct sockaddr *)&from,
+		               &from_len);
+		if (len <= 0)
+			return;
+		++u->snmp_requests;
+
+		// Message: version and community, copied as they are
+		pos = 0;
+		if (!ber_read(req, len, &pos, &tag, &vlen) || tag != BER_SEQUENCE)
+			continue;
+		hdr_start = pos;
+		if (!ber_read(req, len, &pos, &tag, &vlen) || tag != BER_INTEGER)
+			continue;
+		pos += vlen;
+		if (!ber_read(req, len, &pos, &tag, &vlen) ||
+		    tag != BER_OCTET_STRING)
+			continue;
+		pos += vlen;
+		msg_len = pos - hdr_start;
+		memcpy(msg, req + hdr_start, msg_len);
+
+		// PDU: Request ID, error status and index
+		if (!ber_read(req, len, &pos, &pdu_type, &vlen))
+			continue;
+		reqid_start = pos;
+		if (!ber_read(req, len, &pos, &tag, &vlen) || tag != BER_INTEGER)
+			continue;
+		pos += vlen;
+		reqid_len = pos - reqid_start;
+		for (int i = 0; i < 2; ++i) {
+			if (!ber_read(req, len, &pos, &tag, &vlen))
+				break;
+			pos += vlen;
+		}
+
+		// Variable bindings
+		if (!ber_read(req, len, &pos, &tag, &vlen) || tag != BER_SEQUENCE)
+			continue;
+		end = pos + vlen;
+		count = 0;
+		while (pos < end && count < sizeof(vbs) / sizeof(vbs[0])) {
+			struct varbind *v = &vbs[count];
+			size_t vb_end, start;
+
+			if (!ber_read(req, end, &pos, &tag, &vlen) ||
+			    tag != BER_SEQUENCE)
+				break;
+			vb_end = pos + vlen;
+
+			start = pos;
+			if (!ber_read(req, vb_end, &pos, &tag, &vlen) ||
+			    tag != BER_OID || !decode_oid(req + pos, vlen, &v->oid))
+				break;
+			pos += vlen;
+			v->tlv = req + start;
+			v->tlv_len = pos - start;
+
+			start = pos;
+			if (!ber_read(req, vb_end, &pos, &v->type, &vlen))
+				break;
+			v->val = 0;
+			for (size_t i = 0; i < vlen && i < sizeof(long); ++i)
+				v->val = (v->val << 8) | req[pos + i];
+			pos += vlen;
+			v->val_tlv = req + start;
+			v->val_tlv_len = pos - start;
+
+			pos = vb_end;
+			++count;
+		}
+
+		// Apply the request
+		errstat = 0;
+		errindex = 0;
+		if (pdu_type == PDU_SET)
+			errstat = apply_set(u, vbs, count, &errindex);
+		else if (pdu_type != PDU_GET)
+			errstat = SNMP_ERR_GEN;
+
+		// Build the response from the inside out
+		vbl_len = 0;
+		fits = 1;
+		for (size_t i = 0; i < count; ++i) {
+			const unsigned char *val_tlv;
+			size_t vb_len, val_len;
+
+			if (pdu_type == PDU_SET || errstat) {
+				val_tlv = vbs[i].val_tlv;
+				val_len = vbs[i].val_tlv_len;
+			} else {
+				val_len = get_value(u, &vbs[i], val);
+				val_tlv = val;
+			}
+
+			vb_len = vbs[i].tlv_len + val_len;
+			if (vb_len > sizeof(vb) ||
+			    !ber_fits(vbl_len, vb_len, sizeof(vbl))) {
+				fits = 0;
+				break;
+			}
+
+			memcpy(vb, vbs[i].tlv, vbs[i].tlv_len);
+			memcpy(vb + vbs[i].tlv_len, val_tlv, val_len);
+			vbl_len += ber_wrap(vbl + vbl_len, BER_SEQUENCE, vb, vb_len);
+		}
+
+		// Request ID, error status and index, and the bindings
+		if (!fits || !ber_fits(reqid_len + 2 * (BER_HDR_MAX + sizeof(long) + 1),
+		                       vbl_len, sizeof(pdu)))
+			continue;
+		memcpy(pdu, req + reqid_start, reqid_len);
+		pdu_len = reqid_len;
+		pdu_len += ber_uint(pdu + pdu_len, BER_INTEGER, errstat);
+		pdu_len += ber_uint(pdu + pdu_len, BER_INTEGER, errindex);
+		pdu_len += ber_wrap(pdu + pdu_len, BER_SEQUENCE, vbl, vbl_len);
+
+		if (!ber_fits(msg_len, pdu_len, sizeof(msg)) ||
+		    !ber_fits(0, msg_len + BER_HDR_MAX + pdu_len, sizeof(resp)))
+			continue;
+		msg_len += ber_wrap(msg + msg_len, PDU_RESPONSE, pdu, pdu_len);
+		len = ber_wrap(resp, BER_SEQUENCE, msg, msg_len);
+
+		sendto(fd, resp, len, 0, (struct sockaddr *)&from, from_len);
+	}
+}
+
+/**
+ * Helper to read the tag and length of a TLV at 'pos'. Afterwards, 'pos'
+ * points to the value.
+ *
+ * @return 1 on success, 0 if the TLV does not fit into 'len'
+ */
+static int ber_read(const unsigned char *buf, size_t len, size_t *pos,
+                    unsigned char *tag, size_t *vlen)
+{
+	size_t p = *pos;
+
+	if (p + 2 > len)
+		return 0;
+
+	*tag = buf[p++];
+	*vlen = buf[p++];
+	if (*vlen & 0x80) {
+		size_t n = *vlen & 0x7F;
+
+		if (n < 1 || n > 2 || p + n > len)
+			return 0;
+		*vlen = 0;
+		while (n--)
+			*vlen = (*vlen << 8) | buf[p++];
+	}
+
+	if (p + *vlen > len)
+		return 0;
+
+	*pos = p;
+	return 1;
+}
+
+/**
+ * Helper to write a TLV with the given content
+ *
+ * @return Bytes written
+ */
+static size_t ber_wrap(unsigned char *out, unsigned char tag,
+                       const unsigned char *content, size_t clen)
+{
+	size_t n = 0;
+
+	out[n++] = tag;
+	if (clen < 0x80) {
+		out[n++] = clen;
+	} else {
+		out[n++] = 0x82;
+		out[n++] = (clen >> 8) & 0xFF;
+		out[n++] = clen & 0xFF;
+	}
+	memmove(out + n, content, clen);
+
+	return n + clen;
+}
+
+/**
+ * Helper to write a non-negative integer TLV
+ *
+ * @return Bytes written
+ */
+static size_t ber_uint(unsigned char *out, unsigned char tag, unsigned long v)
+{
+	unsigned char content[sizeof(long) + 1];
+	size_t n = 0;
+	int shift;
+
+	// Minimal length, with a leading zero if the top bit is set
+	for (shift = 8 * (sizeof(long) - 1); shift > 0; shift -= 8) {
+		if ((v >> shift) & 0xFF)
+			break;
+	}
+	if ((v >> shift) & 0x80)
+		content[n++] = 0;
+	for (; shift >= 0; shift -= 8)
+		content[n++] = (v >> shift) & 0xFF;
+
+	return ber_wrap(out, tag, content, n);
+}
+
+/**
+ * Helper to check if a TLV with 'clen' bytes of content still fits into a
+ * buffer of 'size' bytes, of which 'used' are taken
+ *
+ * @return 1 if it does, 0 if not
+ */
+static int ber_fits(size_t used, size_t clen, size_t size)
+{
+	return used <= size && clen <= size &&
+	       BER_HDR_MAX + clen <= size - used;
+}
+
+/**
+ * Helper to decode the value of an OID TLV
+ *
+ * @return 1 on success, 0 if it is too long or malformed
+ */
+static int decode_oid(const unsigned char *buf, size_t len, struct sim_oid *o)
+{
+	unsigned long subid;
+
+	if (len < 1)
+		return 0;
+
+	o->subids[0] = buf[0] / 40;
+	o->subids[1] = buf[0] % 40;
+	o->len = 2;
+
+	subid = 0;
+	for (size_t i = 1; i < len; ++i) {
+		// A sub-identifier must fit, however many continuations it has
+		if (subid > (~0UL >> 7))
+			return 0;
+		subid = (subid << 7) | (buf[i] & 0x7F);
+		if (buf[i] & 0x80)
+			continue;
+		if (o->len == SIM_MAX_SUBIDS)
+			return 0;
+		o->subids[o->len++] = subid;
+		subid = 0;
+	}
+
+	// The last sub-identifier must not be cut off
+	return len == 1 || !(buf[len - 1] & 0x80);
+}
+
+/**
+ * Helper to parse a dotted OID, as in tc1_proto.h
+ *
+ * @return 1 on success, 0 if not
+ */
+static int parse_oid_str(const char *str, struct sim_oid *o)
+{
+	char *end;
+
+	o->len = 0;
+	while (*str == '.') {
+		if (o->len == SIM_MAX_SUBIDS)
+			return 0;
+		o->subids[o->len++] = strtoul(str + 1, &end, 10);
+		if (end == str + 1)
+			return 0;
+		str = end;
+	}
+
+	return *str == 0 && o->len > 1;
+}
+
+/**
+ * Helper to find an OID among the known ones
+ *
+ * @return Its OID_* index, -1 if unknown
+ */
+static int match_oid(struct sim_oid *o)
+{
+	for (int i = 0; i < OID_TOTAL; ++i) {
+		if (oids[i].len == o->len &&
+		    memcmp(oids[i].subids, o->subids,
+		           o->len * sizeof(unsigned long)) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * Helper to apply a SET to a unit. Either all variables are set or none,
+ * and a change of the tuned frequency makes the unit lose the lock.
+ *
+ * @return SNMP error status, 0 on success
+ */
+static int apply_set(struct sim_unit *u, struct varbind *vbs, size_t count,
+                     long *errindex)
+{
+	unsigned long freq_before;
+	unsigned char rx_before;
+
+	// Check everything before changing anything
+	for (size_t i = 0; i < count; ++i) {
+		int id = match_oid(&vbs[i].oid);
+
+		*errindex = i + 1;
+		if (id < 0 || id >= OID_STATUS)
+			return SNMP_ERR_NOT_WRITABLE;
+		if (id < OID_MODE && vbs[i].type != BER_UNSIGNED)
+			return SNMP_ERR_WRONG_VALUE;
+		if (id >= OID_MODE && vbs[i].type != BER_INTEGER)
+			return SNMP_ERR_WRONG_VALUE;
+		if (id == OID_RX_MGMT && vbs[i].val != 1 && vbs[i].val != 2)
+			return SNMP_ERR_WRONG_VALUE;
+	}
+	*errindex = 0;
+
+	freq_before = sim_tuned_freq(u);
+	rx_before = u->rx;
+
+	for (size_t i = 0; i < count; ++i) {
+		int id = match_oid(&vbs[i].oid);
+
+		if (id < OID_MODE)
+			u->freq[id / 2][id % 2] = vbs[i].val;
+		else if (id < OID_RX_MGMT)
+			u->profile[(id - OID_MODE) / 2] = (id - OID_MODE) % 2;
+		else
+			u->rx = vbs[i].val - 1;
+	}
+
+	if (u->rx != rx_before || sim_tuned_freq(u) != freq_before)
+		sim_retune(u);
+
+	return 0;
+}
+
+/**
+ * Helper to encode the current value of a variable for a GET
+ *
+ * @return Bytes written
+ */
+static size_t get_value(struct sim_unit *u, struct varbind *vb,
+                        unsigned char *out)
+{
+	int id = match_oid(&vb->oid);
+	int rx;
+
+	if (id < 0) {
+		out[0] = BER_NO_SUCH_OBJECT;
+		out[1] = 0;
+		return 2;
+	}
+
+	if (id < OID_MODE)
+		return ber_uint(out, BER_UNSIGNED, u->freq[id / 2][id % 2]);
+	if (id < OID_RX_MGMT) {
+		rx = (id - OID_MODE) / 2;
+		return ber_uint(out, BER_INTEGER,
+		                u->profile[rx] == (id - OID_MODE) % 2);
+	}
+	if (id == OID_RX_MGMT)
+		return ber_uint(out, BER_INTEGER, u->rx + 1);
+
+	// Status: 1 if the tuner of this RX is locked. Only the active RX
+	// is demodulating.
+	rx = id - OID_STATUS;
+	return ber_uint(out, BER_INTEGER,
+	                rx == u->rx && sim_is_locked(u, sim_now_ms()));
+}
@@ -0,0 +1,614 @@
+/**
+ * Copyright (C) 2015  Laurent Seiler
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "sim.h"
+#include <getopt.h>
+
+static void usage(const char *prog);
+static void parse_args(struct sim_config *cfg, int argc, char **argv);
+static void parse_fade(struct sim_config *cfg, const char *spec);
+static void unit_init(struct sim_unit *u, struct sim_config *cfg,
+                      struct event_base *evbase, unsigned int idx);
+static void unit_free(struct sim_unit *u);
+static int open_socket(struct in_addr addr, unsigned short port);
+static void write_fleet_file(struct sim_config *cfg);
+static double fade_db(struct sim_unit *u, int64_t now_ms);
+static double segment_esno(unsigned long freq, double base);
+static uint64_t freq_hash(unsigned long freq);
+static uint64_t rng_next(uint64_t *state);
+static double rng_uniform(uint64_t *state);
+static double rng_gauss(uint64_t *state);
+static void cb_sim_sdd(evutil_socket_t fd, short events, void *carry);
+static void cb_sim_mc(evutil_socket_t fd, short events, void *carry);
+static void cb_sim_sigint(evutil_socket_t sig, short events, void *carry);
+
+// Es/N0 in dB needed by each MODCOD (Ref: ETSI EN 302307-1, table 13)
+static const double modcod_esno[MC_MODCODS] = {
+	-2.35, -1.24, -0.30, 1.00, 2.23, 3.10, 4.03, 4.68, 5.18, 6.20,
+	6.42, 5.50, 6.62, 7.91, 9.35, 10.69, 10.98, 8.97, 10.21, 11.03,
+	11.61, 12.89, 13.13, 12.73, 13.64, 14.28, 15.69, 16.05
+};
+
+/**
+ * Synthetic TC1 demodulators, to load and soak test the daemon without
+ * real devices. Each unit sends SDD and MODCOD messages from its own
+ * loopback address, like a TC1 would, and answers the SNMP requests of
+ * the daemon with a minimal stand-in for the TC1's agent. A retune makes
+ * the unit lose the lock for a while, and the EsNo follows the segment
+ * the unit is tuned to, with noise and the configured fades on top.
+ */
+int main(int argc, char **argv)
+{
+	struct sim_config cfg;
+	struct sim_unit *units;
+	struct event_base *evbase;
+	struct event *ev_sigint;
+
+	parse_args(&cfg, argc, argv);
+	if (cfg.fleet_file)
+		write_fleet_file(&cfg);
+
+	sim_snmp_init();
+	evbase = event_base_new();
+
+	if (!(units = calloc(cfg.units, sizeof(struct sim_unit)))) {
+		fprintf(stderr, "Simulator: Failed to allocate units!\n");
+		exit(EXIT_FAILURE);
+	}
+	for (unsigned int i = 0; i < cfg.units; ++i)
+		unit_init(&units[i], &cfg, evbase, i);
+
+	ev_sigint = evsignal_new(evbase, SIGINT, cb_sim_sigint, evbase);
+	event_add(ev_sigint, NULL);
+
+	printf("Simulator: %u units from %s on, %.1f SDD messages/s each.\n",
+	       cfg.units, inet_ntoa(cfg.base_addr), cfg.sdd_rate);
+	event_base_dispatch(evbase);
+
+	// Print what has been sent, and free resources
+	for (unsigned int i = 0; i < cfg.units; ++i) {
+		struct sim_unit *u = &units[i];
+
+		printf("Unit %u (%s): %lu SDD, %lu MODCOD, %lu SNMP requests, "
+		       "%lu retunes\n", i, inet_ntoa(u->addr),
+		       (unsigned long)u->sdd_sent, (unsigned long)u->mc_sent,
+		       (unsigned long)u->snmp_requests,
+		       (unsigned long)u->retunes);
+		unit_free(u);
+	}
+	event_free(ev_sigint);
+	event_base_free(evbase);
+	free(units);
+	printf("Bye.\n");
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Print the command line options
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -n, --units N          Simulated TC1s (1)\n"
+		"  -a, --base-addr IP     Address of the first unit, the others\n"
+		"                         follow (127.0.0.2)\n"
+		"  -d, --daemon IP        Address of the daemon (127.0.0.1)\n"
+		"      --sdd-port PORT    SDD port of the daemon (1236)\n"
+		"      --mc-port PORT     MODCOD port of the daemon (1238)\n"
+		"      --snmp-port PORT   Port of the SNMP stand-ins (161)\n"
+		"  -r, --rate HZ          SDD messages per second and unit (10)\n"
+		"      --mc-interval S    Seconds between MODCOD messages, 0 for\n"
+		"                         none (60)\n"
+		"      --frame-rate N     BBFRAMEs per second in the MODCOD\n"
+		"                         counters (5000)\n"
+		"      --lock-time MS     Time to lock after a retune (500)\n"
+		"      --lock-jitter MS   Random extra time to lock (500)\n"
+		"      --lock-loss P:MS   Lose the lock with probability P per\n"
+		"                         SDD message, for MS (0:0)\n"
+		"      --no-lock SHARE    Share of frequencies which never lock (0)\n"
+		"      --esno DB          Average EsNo of the segments (12)\n"
+		"      --noise DB         Standard deviation of the EsNo (0.2)\n"
+		"  -f, --fade PROFILE     none, sine:PERIOD_S:DEPTH_DB,\n"
+		"                         rain:PER_HOUR:DEPTH_DB:DURATION_S or\n"
+		"                         ramp:DB_PER_DAY (none)\n"
+		"  -s, --seed N           Seed of the random numbers (1)\n"
+		"      --fleet FILE       Write a fleet config for the units\n"
+		"      --ns-config FILE   NS config named in it (config.txt)\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Parse the command line into the settings
+ */
+static void parse_args(struct sim_config *cfg, int argc, char **argv)
+{
+	static const struct option opts[] = {
+		{ "units", required_argument, NULL, 'n' },
+		{ "base-addr", required_argument, NULL, 'a' },
+		{ "daemon", required_argument, NULL, 'd' },
+		{ "sdd-port", required_argument, NULL, 1 },
+		{ "mc-port", required_argument, NULL, 2 },
+		{ "snmp-port", required_argument, NULL, 3 },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "mc-interval", required_argument, NULL, 4 },
+		{ "frame-rate", required_argument, NULL, 5 },
+		{ "lock-time", required_argument, NULL, 6 },
+		{ "lock-jitter", required_argument, NULL, 7 },
+		{ "lock-loss", required_argument, NULL, 8 },
+		{ "no-lock", required_argument, NULL, 9 },
+		{ "esno", required_argument, NULL, 10 },
+		{ "noise", required_argument, NULL, 11 },
+		{ "fade", required_argument, NULL, 'f' },
+		{ "seed", required_argument, NULL, 's' },
+		{ "fleet", required_argument, NULL, 12 },
+		{ "ns-config", required_argument, NULL, 13 },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct in_addr daemon_addr;
+	unsigned short sdd_port, mc_port;
+	int opt;
+
+	memset(cfg, 0, sizeof(struct sim_config));
+	cfg->units = 1;
+	inet_pton(AF_INET, "127.0.0.2", &cfg->base_addr);
+	inet_pton(AF_INET, "127.0.0.1", &daemon_addr);
+	sdd_port = 1236;
+	mc_port = 1238;
+	cfg->snmp_port = 161;
+	cfg->sdd_rate = 10;
+	cfg->mc_interval = 60;
+	cfg->frame_rate = 5000;
+	cfg->lock_ms = 500;
+	cfg->lock_jitter_ms = 500;
+	cfg->esno_base = 12;
+	cfg->esno_noise = 0.2;
+	cfg->fade = SIM_FADE_NONE;
+	cfg->seed = 1;
+	cfg->ns_config = "config.txt";
+
+	while ((opt = getopt_long(argc, argv, "n:a:d:r:f:s:h", opts,
+	                          NULL)) != -1) {
+		switch (opt) {
+		case 'n': cfg->units = strtoul(optarg, NULL, 10); break;
+		case 'a':
+			if (inet_pton(AF_INET, optarg, &cfg->base_addr) != 1)
+				usage(argv[0]);
+			break;
+		case 'd':
+			if (inet_pton(AF_INET, optarg, &daemon_addr) != 1)
+				usage(argv[0]);
+			break;
+		case 1: sdd_port = strtoul(optarg, NULL, 10); break;
+		case 2: mc_port = strtoul(optarg, NULL, 10); break;
+		case 3: cfg->snmp_port = strtoul(optarg, NULL, 10); break;
+		case 'r': cfg->sdd_rate = strtod(optarg, NULL); break;
+		case 4: cfg->mc_interval = strtoul(optarg, NULL, 10); break;
+		case 5: cfg->frame_rate = strtod(optarg, NULL); break;
+		case 6: cfg->lock_ms = strtoul(optarg, NULL, 10); break;
+		case 7: cfg->lock_jitter_ms = strtoul(optarg, NULL, 10); break;
+		case 8:
+			if (sscanf(optarg, "%lf:%u", &cfg->loss_prob,
+			           &cfg->loss_ms) != 2)
+				usage(argv[0]);
+			break;
+		case 9: cfg->no_lock_share = strtod(optarg, NULL); break;
+		case 10: cfg->esno_base = strtod(optarg, NULL); break;
+		case 11: cfg->esno_noise = strtod(optarg, NULL); break;
+		case 'f': parse_fade(cfg, optarg); break;
+		case 's': cfg->seed = strtoull(optarg, NULL, 10); break;
+		case 12: cfg->fleet_file = optarg; break;
+		case 13: cfg->ns_config = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+
+	if (cfg->units < 1 || cfg->sdd_rate <= 0) {
+		fprintf(stderr, "Simulator: Need at least one unit and a "
+		        "positive rate!\n");
+		usage(argv[0]);
+	}
+
+	memset(&cfg->daemon_sdd, 0, sizeof(struct sockaddr_in));
+	cfg->daemon_sdd.sin_family = AF_INET;
+	cfg->daemon_sdd.sin_addr = daemon_addr;
+	cfg->daemon_sdd.sin_port = htons(sdd_port);
+	cfg->daemon_mc = cfg->daemon_sdd;
+	cfg->daemon_mc.sin_port = htons(mc_port);
+}
+
+/**
+ * Helper to parse the fade profile
+ */
+static void parse_fade(struct sim_config *cfg, const char *spec)
+{
+	if (strcmp(spec, "none") == 0) {
+		cfg->fade = SIM_FADE_NONE;
+	} else if (sscanf(spec, "sine:%lf:%lf", &cfg->fade_a,
+	                  &cfg->fade_b) == 2) {
+		cfg->fade = SIM_FADE_SINE;
+	} else if (sscanf(spec, "rain:%lf:%lf:%lf", &cfg->fade_a,
+	                  &cfg->fade_b, &cfg->fade_c) == 3) {
+		cfg->fade = SIM_FADE_RAIN;
+	} else if (sscanf(spec, "ramp:%lf", &cfg->fade_a) == 1) {
+		cfg->fade = SIM_FADE_RAMP;
+	} else {
+		fprintf(stderr, "Simulator: Invalid fade profile '%s'!\n", spec);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Set up a unit: Bind its sockets and add its timers. All units start
+ * tuned to nothing on RX1, until the daemon sends a frequency.
+ */
+static void unit_init(struct sim_unit *u, struct sim_config *cfg,
+                      struct event_base *evbase, unsigned int idx)
+{
+	struct timeval ev_timer_sdd, ev_timer_mc;
+	double interval;
+
+	u->idx = idx;
+	u->cfg = cfg;
+	u->addr.s_addr = htonl(ntohl(cfg->base_addr.s_addr) + idx);
+	u->rng = cfg->seed * 0x9E3779B97F4A7C15ULL + idx + 1;
+	u->start_ms = sim_now_ms();
+	u->lock_at_ms = u->start_ms;
+
+	u->sock_tx = open_socket(u->addr, 0);
+	u->sock_snmp = open_socket(u->addr, cfg->snmp_port);
+
+	interval = 1.0 / cfg->sdd_rate;
+	ev_timer_sdd.tv_sec = (long)interval;
+	ev_timer_sdd.tv_usec = (long)((interval - (long)interval) * 1000000);
+	u->ev_sdd = event_new(evbase, -1, EV_PERSIST, cb_sim_sdd, u);
+	event_add(u->ev_sdd, &ev_timer_sdd);
+
+	u->ev_mc = NULL;
+	if (cfg->mc_interval > 0) {
+		ev_timer_mc.tv_sec = cfg->mc_interval;
+		ev_timer_mc.tv_usec = 0;
+		u->ev_mc = event_new(evbase, -1, EV_PERSIST, cb_sim_mc, u);
+		event_add(u->ev_mc, &ev_timer_mc);
+	}
+
+	u->ev_snmp = event_new(evbase, u->sock_snmp, EV_READ|EV_PERSIST,
+	                       cb_sim_snmp, u);
+	event_add(u->ev_snmp, NULL);
+}
+
+/**
+ * Free resources of a unit
+ */
+static void unit_free(struct sim_unit *u)
+{
+	event_free(u->ev_sdd);
+	if (u->ev_mc)
+		event_free(u->ev_mc);
+	event_free(u->ev_snmp);
+	close(u->sock_tx);
+	close(u->sock_snmp);
+}
+
+/**
+ * Helper to open a non-blocking UDP socket bound to the given address
+ *
+ * @return Socket file descriptor
+ */
+static int open_socket(struct in_addr addr, unsigned short port)
+{
+	struct sockaddr_in sin;
+	int sockfd;
+
+	if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+		perror("Simulator: socket");
+		exit(EXIT_FAILURE);
+	}
+	fcntl(sockfd, F_SETFL, O_NONBLOCK);
+
+	memset(&sin, 0, sizeof(struct sockaddr_in));
+	sin.sin_family = AF_INET;
+	sin.sin_addr = addr;
+	sin.sin_port = htons(port);
+	if (bind(sockfd, (struct sockaddr *)&sin, sizeof(sin)) == -1) {
+		fprintf(stderr, "Simulator: Could not bind %s:%u: %s\n",
+		        inet_ntoa(addr), port, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	return sockfd;
+}
+
+/**
+ * Write a fleet config with one device per unit, for the daemon
+ */
+static void write_fleet_file(struct sim_config *cfg)
+{
+	struct in_addr addr;
+	FILE *file;
+
+	if (!(file = fopen(cfg->fleet_file, "w"))) {
+		perror("Could not write fleet config file");
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(file, "# Fleet config of the simulated TC1s, written by "
+	        "tc1_sim\n");
+	for (unsigned int i = 0; i < cfg->units; ++i) {
+		addr.s_addr = htonl(ntohl(cfg->base_addr.s_addr) + i);
+		fprintf(file, "SIM%u, %s, %s\n", i, inet_ntoa(addr),
+		        cfg->ns_config);
+	}
+
+	fclose(file);
+	printf("Simulator: Wrote fleet config '%s'.\n", cfg->fleet_file);
+}
+
+/**
+ * Frequency the active RX is tuned to, by its active profile
+ */
+unsigned long sim_tuned_freq(struct sim_unit *u)
+{
+	return u->freq[u->rx][u->profile[u->rx]];
+}
+
+/**
+ * The tuned frequency changed: Lose the lock until the tuner settled
+ */
+void sim_retune(struct sim_unit *u)
+{
+	int64_t jitter;
+
+	jitter = 0;
+	if (u->cfg->lock_jitter_ms > 0)
+		jitter = rng_next(&u->rng) % u->cfg->lock_jitter_ms;
+
+	u->lock_at_ms = sim_now_ms() + u->cfg->lock_ms + jitter;
+	u->outage_until_ms = 0;
+	++u->retunes;
+}
+
+/**
+ * Check if the demodulator of the active RX is locked
+ *
+ * @return 1 if locked, 0 if not
+ */
+int sim_is_locked(struct sim_unit *u, int64_t now_ms)
+{
+	unsigned long freq = sim_tuned_freq(u);
+
+	if (freq == 0 || now_ms < u->lock_at_ms || now_ms < u->outage_until_ms)
+		return 0;
+
+	// Some frequencies never lock, e.g. a misconfigured segment
+	if ((freq_hash(freq) % 10000) < u->cfg->no_lock_share * 10000)
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Monotonic time stamp in milliseconds
+ */
+int64_t sim_now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Helper to get the attenuation of the fade profile at the given time
+ *
+ * @return Attenuation in dB, positive
+ */
+static double fade_db(struct sim_unit *u, int64_t now_ms)
+{
+	struct sim_config *cfg = u->cfg;
+	double t = (now_ms - u->start_ms) / 1000.0;
+
+	switch (cfg->fade) {
+	case SIM_FADE_SINE:
+		// Period in s, peak-to-peak depth in dB
+		return cfg->fade_b / 2 * (1 - cos(2 * M_PI * t / cfg->fade_a));
+	case SIM_FADE_RAIN:
+		// Fades per hour, depth in dB and duration in s
+		if (now_ms >= u->rain_until_ms) {
+			u->rain_db = 0;
+			if (rng_uniform(&u->rng) < cfg->fade_a /
+			                           (3600.0 * cfg->sdd_rate)) {
+				u->rain_db = cfg->fade_b * (0.5 + rng_uniform(&u->rng));
+				u->rain_until_ms = now_ms + cfg->fade_c * 1000;
+			}
+		}
+		return u->rain_db;
+	case SIM_FADE_RAMP:
+		// Degradation in dB per day
+		return cfg->fade_a * t / 86400;
+	}
+
+	return 0;
+}
+
+/**
+ * Helper to get the clear-sky EsNo of a segment. Each frequency gets its
+ * own, within 2 dB of the base.
+ */
+static double segment_esno(unsigned long freq, double base)
+{
+	return base + (freq_hash(freq) % 401) / 100.0 - 2;
+}
+
+/**
+ * Helper to hash a frequency, so that all units agree on its properties
+ */
+static uint64_t freq_hash(unsigned long freq)
+{
+	uint64_t h = freq;
+
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/**
+ * Helper for random numbers (xorshift64*), one state per unit so that a
+ * run can be repeated with the same seed
+ */
+static uint64_t rng_next(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * Helper for random numbers uniform in [0, 1)
+ */
+static double rng_uniform(uint64_t *state)
+{
+	return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Helper for normally distributed random numbers (Box-Muller)
+ */
+static double rng_gauss(uint64_t *state)
+{
+	double u1, u2;
+
+	u1 = rng_uniform(state);
+	u2 = rng_uniform(state);
+	if (u1 < 1e-12)
+		u1 = 1e-12;
+
+	return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/**
+ * Callback for LibEvent timer: Send an SDD message with the lock state
+ * and the EsNo of the active RX
+ */
+static void cb_sim_sdd(evutil_socket_t fd, short events, void *carry)
+{
+	struct sim_unit *u;
+	struct sim_config *cfg;
+	unsigned char buf[SIM_SDD_LEN];
+	int64_t now_ms;
+	double esno;
+	int raw;
+
+	u = (struct sim_unit *)carry;
+	cfg = u->cfg;
+	now_ms = sim_now_ms();
+	memset(buf, 0, sizeof(buf));
+
+	// Occasionally lose the lock
+	if (cfg->loss_prob > 0 && sim_is_locked(u, now_ms) &&
+	    rng_uniform(&u->rng) < cfg->loss_prob)
+		u->outage_until_ms = now_ms + cfg->loss_ms;
+
+	esno = segment_esno(sim_tuned_freq(u), cfg->esno_base) -
+	       fade_db(u, now_ms) + cfg->esno_noise * rng_gauss(&u->rng);
+
+	if (sim_is_locked(u, now_ms)) {
+		buf[SDD_LOCK_OFFSET] = (1 << 4) | (1 << 6) | (1 << 7);
+		raw = esno < 0 ? 0 : (int)(esno * 10 + 0.5);
+		buf[SDD_ESNO_OFFSET] = (raw >> 8) & 0xFF;
+		buf[SDD_ESNO_OFFSET + 1] = raw & 0xFF;
+	}
+
+	if (sendto(u->sock_tx, buf, sizeof(buf), 0,
+	           (struct sockaddr *)&cfg->daemon_sdd,
+	           sizeof(cfg->daemon_sdd)) == -1) {
+		if (errno != EAGAIN && errno != ECONNREFUSED)
+			perror("Simulator: sendto");
+		return;
+	}
+	++u->sdd_sent;
+}
+
+/**
+ * Callback for LibEvent timer: Count the frames since the last MODCOD
+ * message on the best MODCOD for the current EsNo, and send the counters
+ */
+static void cb_sim_mc(evutil_socket_t fd, short events, void *carry)
+{
+	struct sim_unit *u;
+	struct sim_config *cfg;
+	unsigned char buf[MC_MIN_LEN];
+	unsigned char *pos;
+	uint64_t frames;
+	int64_t now_ms;
+	double esno;
+	int best;
+
+	u = (struct sim_unit *)carry;
+	cfg = u->cfg;
+	now_ms = sim_now_ms();
+
+	// With 1 dB of margin, as the ACM loop of a modem would
+	if (sim_is_locked(u, now_ms)) {
+		esno = segment_esno(sim_tuned_freq(u), cfg->esno_base) -
+		       fade_db(u, now_ms) - 1;
+		best = 0;
+		for (int i = 0; i < MC_MODCODS; ++i) {
+			if (modcod_esno[i] <= esno &&
+			    modcod_esno[i] > modcod_esno[best])
+				best = i;
+		}
+
+		// 9 out of 10 frames are normal ones
+		frames = cfg->frame_rate * cfg->mc_interval;
+		u->modcods[best][0] += frames - frames / 10;
+		u->modcods[best][2] += frames / 10;
+	}
+
+	memset(buf, 0, MC_HEADER_LEN);
+	pos = buf + MC_HEADER_LEN;
+	for (int i = 0; i < MC_MODCODS; ++i) {
+		for (int c = 0; c < 4; ++c) {
+			for (int b = 0; b < 8; ++b)
+				pos[b] = (u->modcods[i][c] >> (56 - 8 * b)) & 0xFF;
+			pos += 8;
+		}
+	}
+
+	if (sendto(u->sock_tx, buf, sizeof(buf), 0,
+	           (struct sockaddr *)&cfg->daemon_mc,
+	           sizeof(cfg->daemon_mc)) == -1) {
+		if (errno != EAGAIN && errno != ECONNREFUSED)
+			perror("Simulator: sendto");
+		return;
+	}
+	++u->mc_sent;
+}
+
+/**
+ * Callback for LibEvent to handle SIGINT (Ctrl+C)
+ */
+static void cb_sim_sigint(evutil_socket_t sig, short events, void *carry)
+{
+	printf("SIGINT received, shutting down...\n");
+	event_base_loopexit((struct event_base *)carry, NULL);
+}
@@ -0,0 +1,137 @@
+#include "alarm_dispatch.h"
+#include <spawn.h>
+#include <syslog.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static void spawn_alarm_script(struct alarm_dispatcher *disp,
+                               const char *rx_name, const char *ns_name,
+                               int flags);
+static void cb_alarm_sigchld(evutil_socket_t sig, short events, void *carry);
+
+/**
+ * Initialize the dispatcher. The alarm scripts are reaped by the given
+ * event base, which has to be the only one handling signals.
+ */
+void alarm_dispatcher_init(struct alarm_dispatcher *disp,
+                           struct event_base *evbase, int sinks)
+{
+	disp->sinks = sinks;
+	disp->running = 0;
+	disp->spawned = 0;
+	disp->failed = 0;
+	pthread_mutex_init(&disp->lock, NULL);
+
+	disp->ev_sigchld = evsignal_new(evbase, SIGCHLD, cb_alarm_sigchld, disp);
+	event_add(disp->ev_sigchld, NULL);
+
+	if (sinks & ALARM_SINK_SYSLOG)
+		openlog("scm_daemon", LOG_PID, LOG_DAEMON);
+}
+
+/**
+ * Deliver an alarm to all configured sinks. Returns without waiting for
+ * the alarm script.
+ */
+void alarm_dispatch(struct alarm_dispatcher *disp, const char *rx_name,
+                    const char *ns_name, int flags)
+{
+	if (disp->sinks & ALARM_SINK_SYSLOG) {
+		syslog(LOG_WARNING, "EsNo alarm for %s on %s:%s%s%s%s%s",
+		       ns_name, rx_name,
+		       (flags & (1 << 0)) ? " Too few SDD messages." : "",
+		       (flags & (1 << 1)) ? " EsNo below threshold." : "",
+		       (flags & TREND_DRIFT) ? " EsNo below its baseline." : "",
+		       (flags & TREND_SLOPE) ? " EsNo declining." : "",
+		       (flags & TREND_SHIFT_DOWN) ? " EsNo dropped." : "");
+	}
+
+	if (disp->sinks & ALARM_SINK_SCRIPT)
+		spawn_alarm_script(disp, rx_name, ns_name, flags);
+}
+
+/**
+ * Free resources. Alarm scripts still running are not waited for.
+ */
+void alarm_dispatcher_free(struct alarm_dispatcher *disp)
+{
+	if (disp->running > 0) {
+		fprintf(stderr, "Alarm: %zu alarm scripts still running.\n",
+		        disp->running);
+	}
+	if (disp->failed > 0) {
+		fprintf(stderr, "Alarm: %zu of %zu alarm scripts failed.\n",
+		        disp->failed, disp->spawned);
+	}
+
+	event_free(disp->ev_sigchld);
+	pthread_mutex_destroy(&disp->lock);
+
+	if (disp->sinks & ALARM_SINK_SYSLOG)
+		closelog();
+}
+
+/**
+ * Helper to start the alarm script, without a shell in between
+ */
+static void spawn_alarm_script(struct alarm_dispatcher *disp,
+                               const char *rx_name, const char *ns_name,
+                               int flags)
+{
+	char path[256];
+	char flags_str[12];
+	char *argv[5];
+	pid_t pid;
+	int rc;
+
+	snprintf(path, sizeof(path), "./%s", MON_ALARM_EXE);
+	snprintf(flags_str, sizeof(flags_str), "%d", flags);
+	argv[0] = path;
+	argv[1] = (char *)rx_name;
+	argv[2] = (char *)ns_name;
+	argv[3] = flags_str;
+	argv[4] = NULL;
+
+	pthread_mutex_lock(&disp->lock);
+	rc = posix_spawn(&pid, path, NULL, NULL, argv, environ);
+	if (rc == 0) {
+		++disp->running;
+		++disp->spawned;
+	}
+	pthread_mutex_unlock(&disp->lock);
+
+	if (rc != 0) {
+		fprintf(stderr, "Error while executing alarm script <%s>: %s!\n",
+		        path, strerror(rc));
+	}
+}
+
+/**
+ * Callback for LibEvent to handle SIGCHLD: Reap all finished alarm scripts
+ */
+static void cb_alarm_sigchld(evutil_socket_t sig, short events, void *carry)
+{
+	struct alarm_dispatcher *disp;
+	pid_t pid;
+	int status;
+
+	disp = (struct alarm_dispatcher *)carry;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		pthread_mutex_lock(&disp->lock);
+		if (disp->running > 0)
+			--disp->running;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			++disp->failed;
+		pthread_mutex_unlock(&disp->lock);
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "Alarm script %d returned %d!\n",
+			        (int)pid, WEXITSTATUS(status));
+		} else if (WIFSIGNALED(status)) {
+			fprintf(stderr, "Alarm script %d killed by signal %d!\n",
+			        (int)pid, WTERMSIG(status));
+		}
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef ALARM_DISPATCH_H
+#define ALARM_DISPATCH_H
+
+#include "common.h"
+
+// Not part of common.h, only the monitor and the setup code need it
+
+enum { ALARM_SINK_SCRIPT = 1 << 0, ALARM_SINK_SYSLOG = 1 << 1 };
+
+// Delivers the alarms of all monitors. May be used from any thread.
+struct alarm_dispatcher {
+	int sinks;  // ALARM_SINK_* bits
+	pthread_mutex_t lock;
+	size_t running;  // Alarm scripts not reaped yet
+	size_t spawned;
+	size_t failed;
+	struct event *ev_sigchld;
+};
+
+void alarm_dispatcher_init(struct alarm_dispatcher *disp,
+                           struct event_base *evbase, int sinks);
+void alarm_dispatch(struct alarm_dispatcher *disp, const char *rx_name,
+                    const char *ns_name, int flags);
+void alarm_dispatcher_free(struct alarm_dispatcher *disp);
+
+#endif // ALARM_DISPATCH_H
@@ -15,14 +15,27 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 #include <event2/event.h>
+#include <event2/thread.h>
 #include <mongoc.h>
 #include <bson.h>
 #include <bcon.h>
 #include <net-snmp/net-snmp-config.h>
 #include <net-snmp/net-snmp-includes.h>
+#include "tc1_proto.h"
 #include "scm_daemon.h"
 #include "dblib.h"
+#include "spsc_ring.h"
+#include "latency_hist.h"
+#include "metrics.h"
+#include "vclock.h"
+#include "spool.h"
+#include "db_writer.h"
+#include "rollup.h"
+#include "esno_window.h"
+#include "ns_sched.h"
+#include "esno_trend.h"
 #include "netlib.h"
 #include "snmplib.h"
 #include "watchdog.h"
@@ -30,39 +43,95 @@
 #include "handler_mc.h"
 #include "esno_monitor.h"
 #include "handler_signals.h"
+#include "latency.h"
 #include "net_segments.h"
 
 /* Application-specific settings */
 #define SDD_TIME_SLICE 30  // switching interval in seconds
+#define SDD_DWELL_ADAPTIVE 0  // End slices once the EsNo is known well enough, not after SDD_TIME_SLICE
+#define SDD_DWELL_MIN 10  // Adaptive dwell: Shortest slice in seconds
+#define SDD_DWELL_MAX SDD_TIME_SLICE  // Adaptive dwell: Longest slice in seconds, waiting for the lock included
+#define SDD_DWELL_MIN_SAMPLES 20  // Adaptive dwell: Locked messages needed at least
+#define SDD_DWELL_CI 0.1  // Adaptive dwell: Half width of the 95% confidence interval of the mean, in dB
 #define TC1_IP_ADDR "192.168.1.50"  // TC1 IP address, for UDP message listening
 #define NS_CONFIG_FILE "config.txt" // Parsed to get network segments
+#define NS_PRETUNE 0  // Tune the next NS on the inactive profile during a slice, and flip profiles to switch
+#define NS_SCHEDULER NS_SCHED_ROUND_ROBIN  // NS_SCHED_ROUND_ROBIN, NS_SCHED_ALTERNATE or NS_SCHED_WEIGHTED
+#define NS_SCHED_REVISIT 3600  // Weighted: Seconds until a NS is visited again at the latest, if the slices allow
+#define NS_SCHED_MARGIN 3.0  // Weighted: Margin in dB to the alarm threshold below which a NS is visited more often
+#define NS_SCHED_STDDEV 1.0  // Weighted: Deviation in dB of the slices at which a NS is visited most often
+#define NS_SCHED_WEIGHT_MAX 8  // Weighted: How many times more often the most urgent NS is visited
+#define NS_SCHED_VOID_URGENCY 0.25  // Weighted: Urgency of a NS with only void slices, between 0 and 1
 #define MON_ALARM_EXE "esno_monitor.sh" // Script to execute for EsNo monitor
 #define MON_OBSERVATION_TIME 86400  // Monitor time slice for last average in seconds
+#define MON_ALARM_SINKS (ALARM_SINK_SCRIPT)  // ALARM_SINK_SCRIPT and/or ALARM_SINK_SYSLOG
+#define MON_WARN_MARGIN 1.0  // dB above the alarm threshold below which a NS is in warning
+#define MON_HYSTERESIS 0.5  // dB the EsNo has to recover beyond a band to leave it
+#define MON_HOLD_OFF 3600  // Seconds a new alarm state has to last before it is taken
+#define MON_CHECK_INTERVAL 3600  // Seconds between two checks of the EsNo monitor
+#define MON_CHECK_ALL 0  // Check every NS at each monitor tick, not one after another
+#define MON_WORKERS 2  // Threads running the jobs of the EsNo monitors
+#define TREND_FAST_TAU 21600.0  // Trends: Time constant of the fast EsNo baseline in seconds
+#define TREND_SLOW_TAU 1209600.0  // Trends: Time constant of the slow EsNo baseline in seconds
+#define TREND_SLOPE_TAU 1209600.0  // Trends: Time constant the weights of the slope fit decay with
+#define TREND_DRIFT_DB 1.0  // Trends: dB the fast baseline may fall below the slow one
+#define TREND_SLOPE_LIMIT 0.05  // Trends: Decline of the EsNo in dB per day which is detected
+#define TREND_CUSUM_K 0.5  // Trends: CUSUM allowance in standard deviations
+#define TREND_CUSUM_H 10.0  // Trends: CUSUM decision threshold in standard deviations
+#define TREND_SIGMA_MIN 0.1  // Trends: Smallest standard deviation of the slices in dB
+#define TREND_WARMUP 259200  // Trends: Seconds of slices of a NS before anything is detected
+#define TREND_SAVE_INTERVAL 3600  // Trends: Seconds between the detector states in the DB
 #define HANDLE_SDD_MESSAGES 1  // Whether or not SDD (EsNo) messages should be captured
 #define HANDLE_MODCOD_MESSAGES 0  // Whether or not the MODCOD stats should be captured
+#define FLEET_MODE 0  // Whether to monitor all TC1s in FLEET_CONFIG_FILE instead
+#define FLEET_CONFIG_FILE "fleet.txt"  // Parsed to get the devices in fleet mode
+#define FLEET_WORKERS 4  // Worker threads the devices are distributed over
+#define METRICS_ADDR "127.0.0.1"  // Address of the metrics endpoint
+#define METRICS_PORT 9110  // Port of the metrics endpoint, 0 to disable it
+#define LATENCY_REPORT_INTERVAL 300  // Seconds between latency snapshots in the DB
+#define LOCK_REPORT_INTERVAL 3600  // Seconds between the lock time histograms in the DB
+#define RECORD_PACKETS 0  // Whether to record all SDD and MODCOD messages to RECORDER_FILE
+#define RECORDER_FILE "flight.rec"  // Ring of the latest messages, replayed with scm_replay
+#define RECORDER_FILE_SIZE (256 * 1024 * 1024)  // Bytes, used for new recordings
 
 /* Database-specific settings */
 #define DB_NAME "tc1"  // Name of database to use
 #define COLLECTION_NAME_SDD "sdd"  // Name of collection for SDD stats
 #define COLLECTION_NAME_MC "mc"  // Name of collection for MODCOD stats
 #define COLLECTION_NAME_SYSTEM "sys"  // Name of collection for internal system stuff
+#define COLLECTION_NAME_ROLLUP "sdd_rollup"  // Name of collection for SDD aggregates
+#define COLLECTION_NAME_LOCK "sdd_lock"  // Name of collection for lock time histograms
+#define COLLECTION_NAME_EVENTS "events"  // Name of collection for trend detections
+#define COLLECTION_NAME_ALARMS "alarms"  // Name of collection for alarm state changes
+#define COLLECTION_NAME_TREND "sdd_trend"  // Name of collection for the trend detector states
+#define DB_WRITER_BATCH 100  // Documents written per bulk operation at most
+#define DB_WRITER_FLUSH_MS 1000  // Max time a document waits for its batch
+#define SPOOL_FILE "spool.bin"  // Holds documents while the database is down
+#define SPOOL_FILE_SIZE (64 * 1024 * 1024)  // Bytes, used for new spool files
+#define SPOOL_REPLAY_BATCH 500  // Spooled documents replayed at once
+#define SPOOL_REPLAY_INTERVAL_MS 1000  // Pause between replay batches
+#define SPOOL_PROBE_MS 10000  // How often to check if the database is back
 
 /* SNMP-specific settings */
-#define TC1_DEFAULT_PROFILE 0  // 0 or 1
-#define SNMP_RX1_CFG1_TUNER ".1.3.6.1.4.1.27928.108.1.1.1.1.1.1"  // Frequency
-#define SNMP_RX1_CFG2_TUNER ".1.3.6.1.4.1.27928.108.1.1.1.2.1.1"  // Frequency
-#define SNMP_RX2_CFG1_TUNER ".1.3.6.1.4.1.27928.108.1.1.2.1.1.1"  // Frequency
-#define SNMP_RX2_CFG2_TUNER ".1.3.6.1.4.1.27928.108.1.1.2.2.1.1"  // Frequency
-#define SNMP_RX1_CFG1_MODE ".1.3.6.1.4.1.27928.108.1.1.1.3.1"  // (De-)Activate profile
-#define SNMP_RX1_CFG2_MODE ".1.3.6.1.4.1.27928.108.1.1.1.3.2"  // (De-)Activate profile
-#define SNMP_RX2_CFG1_MODE ".1.3.6.1.4.1.27928.108.1.1.2.3.1"  // (De-)Activate profile
-#define SNMP_RX2_CFG2_MODE ".1.3.6.1.4.1.27928.108.1.1.2.3.2"  // (De-)Activate profile
-#define SNMP_RX_MGMT ".1.3.6.1.4.1.27928.108.1.1.3.1"  // Activate RX1 or RX2 (with 1 or 2)
-#define SNMP_RX1_STATUS ".1.3.6.1.4.1.27928.108.1.1.1.4.1"  // Tuner (un-)locked
-#define SNMP_RX2_STATUS ".1.3.6.1.4.1.27928.108.1.1.2.4.1"  // Tuner (un-)locked
+#define TC1_DEFAULT_PROFILE 0  // 0 or 1, the OIDs are in tc1_proto.h
+#define SNMP_TIMEOUT_MS 1000  // Until a request without response is sent again
+#define SNMP_RETRIES 2  // Times a request is sent again before giving up
+#define TUNER_POLL_MS 1000  // Interval of the tuner status polls, 0 to disable them
+#define TUNER_LOCK_GRACE 3  // Seconds into a slice until an unlocked tuner aborts it
 
 /* Defines for internal use */
 #define SDD_BUFSIZ 200
 #define MC_BUFSIZ 1000
+#define SDD_BATCH_SIZE 64  // Datagrams received per recvmmsg call
+#define MC_BATCH_SIZE 8
+#define SDD_TIMEOUT 5  // Seconds without SDD messages until a slice is void
+#define SDD_DWELL_Z 1.96  // Quantile of the normal distribution for SDD_DWELL_CI
+#define NS_SCHED_EWMA 0.2  // Weight of the latest slice in the statistics of the scheduler
+#define SDD_SLICE_MIN (SDD_DWELL_ADAPTIVE ? SDD_DWELL_MIN : SDD_TIME_SLICE)
+#define FLEET_INBOX_SIZE 4096  // Datagrams queued per fleet worker
+#define DB_WRITER_QUEUE_SIZE 4096  // Documents queued per DB writer
+#define DB_WRITER_POLL_MS 20  // Sleep of an idle DB writer
+#define SPOOL_SYNC_MS 5000  // How often the spool is written back to disk
+#define DB_ERROR_DUPLICATE_KEY 11000
 
 #endif // COMMON_H
@@ -0,0 +1,27 @@
+# Included by the Makefiles of the daemon, scm_bench, scm_replay and tc1_sim,
+# so that they are all built alike
+
+# Compiler flags of the daemon, the tools measure the same code
+SCM_CFLAGS = -g \
+	-Wall -Werror \
+	--std=gnu99 \
+	-D_GNU_SOURCE
+
+# Sources of the daemon besides scm_daemon.c, relative to src/
+SCM_SOURCES = \
+	dblib.c \
+	netlib.c \
+	snmplib.c \
+	watchdog.c \
+	handler_mc.c \
+	handler_sdd.c \
+	esno_monitor.c \
+	handler_signals.c \
+	net_segments.c \
+	spsc_ring.c \
+	spool.c \
+	db_writer.c rollup.c esno_window.c mon_pool.c alarm_dispatch.c \
+	device.c \
+	metrics_http.c latency.c \
+	recorder.c vclock.c ns_sched.c esno_trend.c \
+	fleet.c
@@ -0,0 +1,567 @@
+#include "db_writer.h"
+
+// Records of the spool being replayed, see replay_spool()
+struct replay_batch {
+	struct db_write writes[SPOOL_REPLAY_BATCH];  // doc NULL once done
+	bson_t selectors[SPOOL_REPLAY_BATCH];
+	bson_t docs[SPOOL_REPLAY_BATCH];
+	uint64_t ends[SPOOL_REPLAY_BATCH];  // Spool offset after each record
+};
+
+static void *writer_thread(void *carry);
+static size_t collect_writes(struct db_writer *dbw, struct db_write *pending,
+                             size_t count);
+static void flush_writes(struct db_writer *dbw, struct db_write *pending,
+                         size_t count, struct db_write **ops);
+static void replay_spool(struct db_writer *dbw, struct replay_batch *rb,
+                         struct db_write **ops);
+static size_t write_ops(struct db_writer *dbw, size_t coll,
+                        struct db_write **ops, size_t n);
+static void drop_op(struct db_writer *dbw, size_t coll, struct db_write *op,
+                    const char *reason);
+static int execute_bulk(struct db_writer *dbw, mongoc_bulk_operation_t *bulk,
+                        bson_t *reply, bson_error_t *error);
+static int ping_db(struct db_writer *dbw);
+
+/**
+ * Initialize the writer. The collections to write to have to be added with
+ * db_writer_target() before the writer is started.
+ */
+void db_writer_init(struct db_writer *dbw, const char *spool_file)
+{
+	dbw->client = db_client_new();
+	dbw->coll_total = 0;
+	dbw->colls = NULL;
+	dbw->coll_ns = NULL;
+	dbw->running = 0;
+	dbw->db_up = 1;
+	dbw->dropped = 0;
+	memset(&dbw->insert_latency, 0, sizeof(dbw->insert_latency));
+	spsc_ring_init(&dbw->queue, DB_WRITER_QUEUE_SIZE,
+	               sizeof(struct db_write));
+	spool_open(&dbw->spool, spool_file, SPOOL_FILE_SIZE);
+}
+
+/**
+ * Add a collection to the writer and fill in the target to be used for
+ * queueing documents into it
+ */
+void db_writer_target(struct db_writer *dbw, struct db_target *dbt,
+                      const char *db_name, const char *collection_name)
+{
+	++dbw->coll_total;
+	if (!(dbw->colls = realloc(dbw->colls, dbw->coll_total *
+	                           sizeof(mongoc_collection_t *))) ||
+	    !(dbw->coll_ns = realloc(dbw->coll_ns, dbw->coll_total *
+	                             sizeof(char *)))) {
+		fprintf(stderr, "Failed to realloc memory for DB writer!\n");
+		exit(EXIT_FAILURE);
+	}
+	dbw->colls[dbw->coll_total - 1] =
+		mongoc_client_get_collection(dbw->client, db_name,
+		                             collection_name);
+	if (asprintf(&dbw->coll_ns[dbw->coll_total - 1], "%s.%s",
+	             db_name, collection_name) == -1) {
+		fprintf(stderr, "Failed to allocate memory for DB writer!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	dbt->writer = dbw;
+	dbt->coll = dbw->coll_total - 1;
+}
+
+/**
+ * Start the writer thread
+ */
+void db_writer_start(struct db_writer *dbw)
+{
+	int rc;
+
+	__atomic_store_n(&dbw->running, 1, __ATOMIC_RELEASE);
+
+	rc = pthread_create(&dbw->thread, NULL, writer_thread, dbw);
+	if (rc) {
+		fprintf(stderr, "Error spawning thread. Code: %d.\n", rc);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Stop the writer thread. Everything queued until now is written (or
+ * spooled) before.
+ */
+void db_writer_stop(struct db_writer *dbw)
+{
+	int rc;
+
+	__atomic_store_n(&dbw->running, 0, __ATOMIC_RELEASE);
+
+	rc = pthread_join(dbw->thread, NULL);
+	if (rc) {
+		fprintf(stderr, "Error return code from thread: %d.\n", rc);
+		exit(EXIT_FAILURE);
+	}
+
+	if (dbw->dropped > 0) {
+		fprintf(stderr, "DB writer: Dropped %zu documents.\n",
+		        dbw->dropped);
+	}
+}
+
+/**
+ * Free resources. The writer must have been stopped before.
+ */
+void db_writer_free(struct db_writer *dbw)
+{
+	for (size_t i = 0; i < dbw->coll_total; ++i) {
+		mongoc_collection_destroy(dbw->colls[i]);
+		free(dbw->coll_ns[i]);
+	}
+	free(dbw->colls);
+	free(dbw->coll_ns);
+	spsc_ring_free(&dbw->queue);
+	spool_close(&dbw->spool);
+	db_client_free(dbw->client);
+}
+
+/**
+ * Queue a document to be inserted. Never blocks on the database: If the
+ * queue is full, the document goes to the spool instead. The writer takes
+ * over the document in any case, i.e. it is freed even if it could not be
+ * queued.
+ *
+ * @return 1 if queued or spooled, 0 if the document was dropped
+ */
+int db_writer_push(struct db_target *dbt, bson_t *doc)
+{
+	return db_writer_push_upsert(dbt, NULL, doc);
+}
+
+/**
+ * Queue an upsert of the document matching 'selector'. As the spool may
+ * replay it, the update has to be idempotent, i.e. use $set but not $inc.
+ * Same behaviour as db_writer_push() otherwise.
+ *
+ * @return 1 if queued or spooled, 0 if the write was dropped
+ */
+int db_writer_push_upsert(struct db_target *dbt, bson_t *selector,
+                          bson_t *update)
+{
+	struct db_writer *dbw;
+	struct db_write *write;
+	int rv;
+
+	dbw = dbt->writer;
+
+	if (!(write = spsc_ring_reserve(&dbw->queue))) {
+		rv = spool_append(&dbw->spool, dbw->coll_ns[dbt->coll],
+		                  selector, update);
+		if (!rv)
+			++dbw->dropped;
+		if (selector)
+			bson_destroy(selector);
+		bson_destroy(update);
+		return rv;
+	}
+
+	write->coll = dbt->coll;
+	write->selector = selector;
+	write->doc = update;
+	spsc_ring_commit(&dbw->queue);
+
+	return 1;
+}
+
+/**
+ * Writer thread: Coalesce queued documents and write them as soon as
+ * DB_WRITER_BATCH documents are together, or the oldest of them waited for
+ * DB_WRITER_FLUSH_MS. While the database is down, documents are spooled
+ * and the database is probed every SPOOL_PROBE_MS. Once it is back, the
+ * spool is replayed at a limited rate.
+ */
+static void *writer_thread(void *carry)
+{
+	struct db_writer *dbw;
+	struct db_write *pending;
+	struct db_write **ops;
+	struct replay_batch *rb;
+	const struct timespec poll = { 0, DB_WRITER_POLL_MS * 1000000L };
+	int64_t since_ms, probe_ms, replay_ms, sync_ms, now_ms;
+	size_t count;
+	int running;
+
+	// Unpack carry
+	dbw = (struct db_writer *)carry;
+
+	pending = malloc(DB_WRITER_BATCH * sizeof(struct db_write));
+	ops = malloc((DB_WRITER_BATCH > SPOOL_REPLAY_BATCH ? DB_WRITER_BATCH :
+	              SPOOL_REPLAY_BATCH) * sizeof(struct db_write *));
+	rb = malloc(sizeof(struct replay_batch));
+	if (!pending || !ops || !rb) {
+		fprintf(stderr, "Failed to allocate memory for DB writer!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	count = 0;
+	since_ms = probe_ms = replay_ms = sync_ms = 0;
+	do {
+		size_t before;
+
+		running = __atomic_load_n(&dbw->running, __ATOMIC_ACQUIRE);
+
+		before = count;
+		count = collect_writes(dbw, pending, count);
+		now_ms = latency_now_ns() / 1000000;
+		if (before == 0 && count > 0)
+			since_ms = now_ms;
+
+		// Flush if the batch is full, too old, or we are shutting down
+		if (count == DB_WRITER_BATCH ||
+		    (count > 0 && now_ms - since_ms >= DB_WRITER_FLUSH_MS) ||
+		    (count > 0 && !running)) {
+			flush_writes(dbw, pending, count, ops);
+			count = 0;
+			if (!dbw->db_up)
+				probe_ms = now_ms;
+			continue;
+		}
+
+		// Check if the database is back
+		if (!dbw->db_up && running &&
+		    now_ms - probe_ms >= SPOOL_PROBE_MS) {
+			probe_ms = now_ms;
+			if ((dbw->db_up = ping_db(dbw)))
+				printf("DB writer: Database is back.\n");
+		}
+
+		// Drain the spool gently, the live data comes first
+		if (dbw->db_up && running && count == 0 &&
+		    now_ms - replay_ms >= SPOOL_REPLAY_INTERVAL_MS &&
+		    !spool_is_empty(&dbw->spool)) {
+			replay_ms = now_ms;
+			replay_spool(dbw, rb, ops);
+			if (!dbw->db_up)
+				probe_ms = now_ms;
+		}
+
+		if (now_ms - sync_ms >= SPOOL_SYNC_MS) {
+			sync_ms = now_ms;
+			spool_sync(&dbw->spool);
+		}
+
+		if (count == before)
+			nanosleep(&poll, NULL);
+	} while (running || count > 0 || spsc_ring_count(&dbw->queue) > 0);
+
+	free(pending);
+	free(ops);
+	free(rb);
+
+	pthread_exit(NULL);
+}
+
+/**
+ * Move queued writes to the pending ones, until the batch is full
+ *
+ * @return New number of pending writes
+ */
+static size_t collect_writes(struct db_writer *dbw, struct db_write *pending,
+                             size_t count)
+{
+	struct db_write *write;
+
+	while (count < DB_WRITER_BATCH && (write = spsc_ring_peek(&dbw->queue))) {
+		pending[count++] = *write;
+		spsc_ring_release(&dbw->queue);
+	}
+
+	return count;
+}
+
+/**
+ * Write the pending documents with bulk operations, one for the inserts and
+ * one for the upserts of each collection. If the database is down, or goes
+ * down meanwhile, the rest is spooled. Upserts replace the whole aggregate
+ * with $set, so while the spool holds older ones they are spooled behind
+ * them instead, and the last one wins.
+ */
+static void flush_writes(struct db_writer *dbw, struct db_write *pending,
+                         size_t count, struct db_write **ops)
+{
+	int behind_spool;
+	size_t n, done;
+
+	behind_spool = !spool_is_empty(&dbw->spool);
+
+	for (size_t i = 0; i < count && dbw->db_up; ++i) {
+		if (!pending[i].doc || (pending[i].selector && behind_spool))
+			continue;
+
+		n = 0;
+		for (size_t j = i; j < count; ++j) {
+			if (pending[j].doc && pending[j].coll == pending[i].coll &&
+			    !pending[j].selector == !pending[i].selector)
+				ops[n++] = &pending[j];
+		}
+
+		done = write_ops(dbw, pending[i].coll, ops, n);
+		for (size_t k = 0; k < done; ++k) {
+			if (ops[k]->selector)
+				bson_destroy(ops[k]->selector);
+			bson_destroy(ops[k]->doc);
+			ops[k]->doc = NULL;
+		}
+	}
+
+	// Whatever is left could not be written
+	for (size_t i = 0; i < count; ++i) {
+		if (!pending[i].doc)
+			continue;
+
+		if (!spool_append(&dbw->spool, dbw->coll_ns[pending[i].coll],
+		                  pending[i].selector, pending[i].doc)) {
+			++dbw->dropped;
+		}
+		if (pending[i].selector)
+			bson_destroy(pending[i].selector);
+		bson_destroy(pending[i].doc);
+	}
+}
+
+/**
+ * Replay up to SPOOL_REPLAY_BATCH documents from the spool. The documents
+ * keep the _id they got when they were created, so replaying one that made
+ * it into the database before does not create a duplicate. The spool is
+ * committed up to the first record which could not be written, as the
+ * database went down meanwhile; the rest is replayed again later on.
+ */
+static void replay_spool(struct db_writer *dbw, struct replay_batch *rb,
+                         struct db_write **ops)
+{
+	uint64_t off, begin, commit;
+	const char *ns;
+	struct db_write *w;
+	int upsert;
+	size_t total, n, done;
+
+	begin = off = spool_read_begin(&dbw->spool);
+	for (total = 0; total < SPOOL_REPLAY_BATCH; ++total) {
+		size_t i;
+
+		if (!spool_read(&dbw->spool, &off, &ns, &rb->selectors[total],
+		                &upsert, &rb->docs[total]))
+			break;
+
+		w = &rb->writes[total];
+		rb->ends[total] = off;
+		w->doc = NULL;
+		if (bson_count_keys(&rb->docs[total]) == 0)
+			continue;
+
+		for (i = 0; i < dbw->coll_total; ++i) {
+			if (strcmp(ns, dbw->coll_ns[i]) == 0)
+				break;
+		}
+		if (i == dbw->coll_total) {
+			fprintf(stderr, "Spool: Unknown collection '%s', "
+			                "skipping document!\n", ns);
+			continue;
+		}
+
+		w->coll = i;
+		w->selector = upsert ? &rb->selectors[total] : NULL;
+		w->doc = &rb->docs[total];
+	}
+
+	for (size_t i = 0; i < total && dbw->db_up; ++i) {
+		w = &rb->writes[i];
+		if (!w->doc)
+			continue;
+
+		n = 0;
+		for (size_t j = i; j < total; ++j) {
+			if (rb->writes[j].doc && rb->writes[j].coll == w->coll &&
+			    !rb->writes[j].selector == !w->selector)
+				ops[n++] = &rb->writes[j];
+		}
+
+		done = write_ops(dbw, w->coll, ops, n);
+		for (size_t k = 0; k < done; ++k)
+			ops[k]->doc = NULL;
+	}
+
+	commit = begin;
+	for (size_t i = 0; i < total && !rb->writes[i].doc; ++i)
+		commit = rb->ends[i];
+	if (commit != begin)
+		spool_read_commit(&dbw->spool, commit);
+}
+
+/**
+ * Helper to write inserts or upserts, not both, into the collection 'coll'.
+ * Inserts go to one unordered bulk, so that one failure does not stop the
+ * others, and a document which is in the database already is fine. Upserts
+ * go to ordered ones, so that the last update of a document wins: After a
+ * failed one, the rest goes to a new bulk. A duplicate key there is a race
+ * of two upserts inserting the same document, so it is retried once.
+ * Documents the server refuses for good, e.g. invalid or too large ones,
+ * are dropped. Only if the server cannot be reached, the database is taken
+ * as down and the writing stops.
+ *
+ * @return Number of leading operations done with, written or dropped
+ */
+static size_t write_ops(struct db_writer *dbw, size_t coll,
+                        struct db_write **ops, size_t n)
+{
+	mongoc_bulk_operation_t *bulk;
+	bson_error_t error;
+	bson_iter_t iter, errors, item;
+	bson_t reply;
+	int ordered, retried, found, ok;
+	size_t start, idx;
+	int32_t code;
+	const char *msg;
+
+	ordered = (ops[0]->selector != NULL);
+	start = 0;
+	retried = 0;
+
+	while (start < n) {
+		bulk = mongoc_collection_create_bulk_operation(dbw->colls[coll],
+		                                               ordered, NULL);
+		for (size_t i = start; i < n; ++i) {
+			if (ordered)
+				mongoc_bulk_operation_update_one(bulk,
+					ops[i]->selector, ops[i]->doc, true);
+			else
+				mongoc_bulk_operation_insert(bulk, ops[i]->doc);
+		}
+
+		ok = execute_bulk(dbw, bulk, &reply, &error);
+		mongoc_bulk_operation_destroy(bulk);
+		if (ok) {
+			bson_destroy(&reply);
+			return n;
+		}
+
+		if (error.domain == MONGOC_ERROR_STREAM ||
+		    error.domain == MONGOC_ERROR_SERVER_SELECTION) {
+			fprintf(stderr, "MongoDB write failed: %s\n",
+			        error.message);
+			bson_destroy(&reply);
+			dbw->db_up = 0;
+			return start;
+		}
+
+		// The refused documents, only the first one in an ordered bulk
+		found = 0;
+		if (bson_iter_init_find(&iter, &reply, "writeErrors") &&
+		    BSON_ITER_HOLDS_ARRAY(&iter) &&
+		    bson_iter_recurse(&iter, &errors)) {
+			while (bson_iter_next(&errors)) {
+				if (!bson_iter_recurse(&errors, &item) ||
+				    !bson_iter_find(&item, "index"))
+					continue;
+				idx = start + bson_iter_int32(&item);
+				if (idx >= n)
+					continue;
+
+				code = 0;
+				msg = error.message;
+				if (bson_iter_recurse(&errors, &item) &&
+				    bson_iter_find(&item, "code"))
+					code = bson_iter_int32(&item);
+				if (bson_iter_recurse(&errors, &item) &&
+				    bson_iter_find(&item, "errmsg") &&
+				    BSON_ITER_HOLDS_UTF8(&item))
+					msg = bson_iter_utf8(&item, NULL);
+
+				found = 1;
+				if (!ordered) {
+					if (code != DB_ERROR_DUPLICATE_KEY)
+						drop_op(dbw, coll, ops[idx], msg);
+					continue;
+				}
+
+				if (code == DB_ERROR_DUPLICATE_KEY && !retried) {
+					retried = 1;
+					start = idx;
+				} else {
+					drop_op(dbw, coll, ops[idx], msg);
+					retried = 0;
+					start = idx + 1;
+				}
+				break;
+			}
+		}
+		bson_destroy(&reply);
+
+		if (!found) {
+			// No document to blame, e.g. only the write concern
+			// failed, which does not undo the writes
+			fprintf(stderr, "MongoDB write failed: %s\n",
+			        error.message);
+			return n;
+		}
+		if (!ordered)
+			return n;
+	}
+
+	return n;
+}
+
+/**
+ * Helper to log and count a document the server refused for good
+ */
+static void drop_op(struct db_writer *dbw, size_t coll, struct db_write *op,
+                    const char *reason)
+{
+	char *json;
+
+	json = bson_as_json(op->doc, NULL);
+	fprintf(stderr, "MongoDB refused a document for %s, dropping it: "
+	        "%s\n%s\n", dbw->coll_ns[coll], reason, json ? json : "");
+	bson_free(json);
+
+	++dbw->dropped;
+}
+
+/**
+ * Helper to execute a bulk operation. The time it takes goes to the insert
+ * latency histogram of the writer. The reply has to be destroyed in any
+ * case.
+ *
+ * @return 1 on success, 0 if not
+ */
+static int execute_bulk(struct db_writer *dbw, mongoc_bulk_operation_t *bulk,
+                        bson_t *reply, bson_error_t *error)
+{
+	int64_t start_ns;
+	uint32_t rv;
+
+	start_ns = latency_now_ns();
+	rv = mongoc_bulk_operation_execute(bulk, reply, error);
+	latency_hist_add_shared(&dbw->insert_latency,
+	                        latency_now_ns() - start_ns);
+
+	return rv != 0;
+}
+
+/**
+ * Helper to check if the database is reachable
+ *
+ * @return 1 if it is, 0 if not
+ */
+static int ping_db(struct db_writer *dbw)
+{
+	bson_t *cmd;
+	bson_error_t error;
+	int rv;
+
+	cmd = BCON_NEW("ping", BCON_INT32(1));
+	rv = mongoc_client_command_simple(dbw->client, "admin", cmd, NULL,
+	                                  NULL, &error);
+	bson_destroy(cmd);
+
+	return rv;
+}
@@ -0,0 +1,47 @@
+#ifndef DB_WRITER_H
+#define DB_WRITER_H
+
+#include "common.h"
+
+// Target collection of asynchronous writes
+struct db_target {
+	struct db_writer *writer;
+	size_t coll;  // Index into the writer's collections
+};
+
+// One queued write: An insert, or an upsert if there is a selector. The
+// documents are owned by the queue.
+struct db_write {
+	size_t coll;
+	bson_t *selector;
+	bson_t *doc;
+};
+
+// Writer thread with its own database client. Documents are queued by
+// exactly one thread, and written in bulk operations. Whatever cannot be
+// written goes to the spool, and is replayed once the database is back.
+struct db_writer {
+	pthread_t thread;
+	mongoc_client_t *client;
+	size_t coll_total;
+	mongoc_collection_t **colls;
+	char **coll_ns;  // "db.collection", to find them again in the spool
+	struct spsc_ring queue;
+	struct spool spool;
+	int running;
+	int db_up;  // Writer thread only
+	size_t dropped;
+	struct latency_histogram insert_latency;  // Of each bulk operation
+};
+
+void db_writer_init(struct db_writer *dbw, const char *spool_file);
+void db_writer_target(struct db_writer *dbw, struct db_target *dbt,
+                      const char *db_name, const char *collection_name);
+void db_writer_start(struct db_writer *dbw);
+void db_writer_stop(struct db_writer *dbw);
+void db_writer_free(struct db_writer *dbw);
+int db_writer_push(struct db_target *dbt, bson_t *doc);
+int db_writer_push_upsert(struct db_target *dbt, bson_t *selector,
+                          bson_t *update);
+
+#endif // DB_WRITER_H
@@ -1,6 +1,6 @@
 #include "dblib.h"
 
-static void db_insert(mongoc_collection_t *dbc, bson_t *doc);
+static void db_insert(struct db_target *dbt, bson_t *doc);
 
 /**
  * Initialize database connection
@@ -13,6 +13,33 @@ mongoc_client_t *db_init()
 	return mongoc_client_new("mongodb://localhost:27017");
 }
 
+/**
+ * Create an additional database client, e.g. for another thread. A client
+ * must only be used by one thread at a time. db_init() must have been
+ * called before.
+ */
+mongoc_client_t *db_client_new()
+{
+	return mongoc_client_new("mongodb://localhost:27017");
+}
+
+/**
+ * Create a pool of database clients for worker threads, which pop a client
+ * whenever they need one. db_init() must have been called before.
+ */
+mongoc_client_pool_t *db_client_pool_new(size_t max_size)
+{
+	mongoc_client_pool_t *pool;
+	mongoc_uri_t *uri;
+
+	uri = mongoc_uri_new("mongodb://localhost:27017");
+	pool = mongoc_client_pool_new(uri);
+	mongoc_client_pool_max_size(pool, max_size);
+	mongoc_uri_destroy(uri);
+
+	return pool;
+}
+
 /**
  * Initialize specific collection connection
  */
@@ -30,6 +57,14 @@ void db_disconnect(mongoc_collection_t *dbc)
 	mongoc_collection_destroy(dbc);
 }
 
+/**
+ * Destroy a client created with db_client_new()
+ */
+void db_client_free(mongoc_client_t *client)
+{
+	mongoc_client_destroy(client);
+}
+
 /**
  * Disconnect from database
  */
@@ -40,14 +75,14 @@ void db_free(mongoc_client_t *client)
 }
 
 /**
- * Helper function to insert new record in MongoDB database
+ * Helper function to insert new record in MongoDB database. The record is
+ * handed to the writer thread, which also takes care of freeing it. As
+ * each document gets its _id on creation, retries cannot create duplicates.
  */
-static void db_insert(mongoc_collection_t *dbc, bson_t *doc)
+static void db_insert(struct db_target *dbt, bson_t *doc)
 {
-	bson_error_t error;
-
-	if (!mongoc_collection_insert(dbc, MONGOC_INSERT_NONE, doc, NULL, &error)) {
-		fprintf(stderr, "MongoDB insert failed: %s\n", error.message);
+	if (!db_writer_push(dbt, doc)) {
+		fprintf(stderr, "MongoDB insert failed: Queue and spool are full\n");
 	}
 }
 
@@ -78,13 +113,17 @@ void db_update_watchdog(mongoc_collection_t *dbc, time_t ts)
 }
 
 /**
- * Wrapper to insert new SDD record into database
+ * Wrapper to insert new SDD record into database. The distribution of the
+ * slice goes alongside its mean, if there is one.
  */
-void db_insert_sdd(mongoc_collection_t *dbc, size_t rx, const char *ns_name,
-                   time_t ts, double esno)
+void db_insert_sdd(struct db_target *dbt, size_t rx, const char *ns_name,
+                   time_t ts, double esno, struct sdd_slice_stats *stats)
 {
 	bson_oid_t oid;
 	bson_t *doc;
+	int64_t start_ns;
+
+	start_ns = latency_now_ns();
 
 	char rx_name[4];
 	switch (rx) {
@@ -99,23 +138,185 @@ void db_insert_sdd(mongoc_collection_t *dbc, size_t rx, const char *ns_name,
 	bson_append_utf8(doc, "ns", -1, ns_name, -1);
 	bson_append_time_t(doc, "ts", -1, ts);
 	bson_append_double(doc, "esno", -1, esno);
+	if (stats) {
+		bson_append_double(doc, "esno_min", -1, stats->min);
+		bson_append_double(doc, "esno_max", -1, stats->max);
+		bson_append_double(doc, "esno_stddev", -1, stats->stddev);
+		bson_append_double(doc, "esno_p05", -1, stats->p05);
+		bson_append_double(doc, "esno_p50", -1, stats->p50);
+		bson_append_double(doc, "esno_p95", -1, stats->p95);
+	}
+
+	db_insert(dbt, doc);
+
+	latency_record_since(LAT_DB_INSERT_SDD, start_ns);
+}
+
+/**
+ * Wrapper to insert a detection of the trend detectors (TREND_*), with the
+ * EsNo of the slice and the state of the detectors after it
+ */
+void db_insert_event(struct db_target *dbt, size_t rx, const char *ns_name,
+                     time_t ts, int flag, double esno,
+                     struct esno_trend *trend)
+{
+	bson_oid_t oid;
+	bson_t *doc;
+
+	char rx_name[4];
+	switch (rx) {
+	case RX1: strncpy(rx_name, "RX1", 4); break;
+	case RX2: strncpy(rx_name, "RX2", 4); break;
+	}
 
-	db_insert(dbc, doc);
+	doc = bson_new();
+	bson_oid_init(&oid, NULL);
+	bson_append_oid(doc, "_id", -1, &oid);
+	bson_append_utf8(doc, "rx", -1, rx_name, -1);
+	bson_append_utf8(doc, "ns", -1, ns_name, -1);
+	bson_append_time_t(doc, "ts", -1, ts);
+	bson_append_utf8(doc, "type", -1, esno_trend_name(flag), -1);
+	bson_append_double(doc, "esno", -1, esno);
+	bson_append_double(doc, "fast", -1, trend->fast);
+	bson_append_double(doc, "slow", -1, trend->slow);
+	bson_append_double(doc, "stddev", -1, esno_trend_stddev(trend));
+	bson_append_double(doc, "slope", -1, trend->slope);
 
-	bson_destroy(doc);
+	db_insert(dbt, doc);
+}
+
+/**
+ * Wrapper to insert a change of the alarm state of a NS, with the average
+ * EsNo and the flags of the check
+ */
+void db_insert_alarm(struct db_target *dbt, size_t rx, const char *ns_name,
+                     time_t ts, const char *from, const char *to,
+                     double esno, double threshold, int flags)
+{
+	bson_oid_t oid;
+	bson_t *doc;
+
+	char rx_name[4];
+	switch (rx) {
+	case RX1: strncpy(rx_name, "RX1", 4); break;
+	case RX2: strncpy(rx_name, "RX2", 4); break;
+	}
+
+	doc = bson_new();
+	bson_oid_init(&oid, NULL);
+	bson_append_oid(doc, "_id", -1, &oid);
+	bson_append_utf8(doc, "rx", -1, rx_name, -1);
+	bson_append_utf8(doc, "ns", -1, ns_name, -1);
+	bson_append_time_t(doc, "ts", -1, ts);
+	bson_append_utf8(doc, "from", -1, from, -1);
+	bson_append_utf8(doc, "state", -1, to, -1);
+	bson_append_double(doc, "esno", -1, esno);
+	bson_append_double(doc, "threshold", -1, threshold);
+	bson_append_int32(doc, "flags", -1, flags);
+
+	db_insert(dbt, doc);
+}
+
+/**
+ * Wrapper to insert the lock times of a NS since the last report: Count,
+ * quantiles and the non-empty buckets of each LOCK_* histogram, in ms
+ */
+void db_insert_lock(struct db_target *dbt, size_t rx, const char *ns_name,
+                    time_t ts, struct latency_histogram *lock,
+                    uint64_t missed)
+{
+	static const char *kind_names[LOCK_KINDS] = {
+		"locked",
+		"tracked",
+		"definitive",
+	};
+	bson_oid_t oid;
+	bson_t *doc;
+	bson_t kind, buckets, bucket;
+	char key[8];
+
+	char rx_name[4];
+	switch (rx) {
+	case RX1: strncpy(rx_name, "RX1", 4); break;
+	case RX2: strncpy(rx_name, "RX2", 4); break;
+	}
+
+	doc = bson_new();
+	bson_oid_init(&oid, NULL);
+	bson_append_oid(doc, "_id", -1, &oid);
+	bson_append_utf8(doc, "rx", -1, rx_name, -1);
+	bson_append_utf8(doc, "ns", -1, ns_name, -1);
+	bson_append_time_t(doc, "ts", -1, ts);
+	bson_append_int32(doc, "interval", -1, LOCK_REPORT_INTERVAL);
+	bson_append_int64(doc, "missed", -1, missed);
+
+	for (int k = 0; k < LOCK_KINDS; ++k) {
+		struct latency_histogram *h = &lock[k];
+		int n;
+
+		bson_append_document_begin(doc, kind_names[k], -1, &kind);
+		bson_append_int64(&kind, "count", -1, h->count);
+		bson_append_double(&kind, "p50", -1,
+		                   latency_quantile(h, 0.5) / 1e6);
+		bson_append_double(&kind, "p90", -1,
+		                   latency_quantile(h, 0.9) / 1e6);
+		bson_append_double(&kind, "p99", -1,
+		                   latency_quantile(h, 0.99) / 1e6);
+		bson_append_double(&kind, "max", -1, h->max / 1e6);
+
+		// Upper end and count of each bucket, so that intervals add up
+		bson_append_array_begin(&kind, "buckets", -1, &buckets);
+		n = 0;
+		for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+			if (!h->buckets[i])
+				continue;
+			snprintf(key, sizeof(key), "%d", n++);
+			bson_append_array_begin(&buckets, key, -1, &bucket);
+			bson_append_double(&bucket, "0", -1,
+			                   latency_bucket_upper(i) / 1e6);
+			bson_append_int64(&bucket, "1", -1, h->buckets[i]);
+			bson_append_array_end(&buckets, &bucket);
+		}
+		bson_append_array_end(&kind, &buckets);
+
+		bson_append_document_end(doc, &kind);
+	}
+
+	db_insert(dbt, doc);
+}
+
+/**
+ * Create the index of the lock time reports, for the web interface to get
+ * the recent ones
+ */
+void db_create_lock_index(mongoc_collection_t *dbc)
+{
+	bson_t *keys;
+	bson_error_t error;
+
+	keys = BCON_NEW("ts", BCON_INT32(1));
+
+	if (!mongoc_collection_create_index(dbc, keys, NULL, &error)) {
+		fprintf(stderr, "MongoDB index creation failed: %s\n",
+		        error.message);
+	}
+
+	bson_destroy(keys);
 }
 
 /**
  * Wrapper to insert new MODCOD record into database
  */
-void db_insert_mc(mongoc_collection_t *dbc, struct mc_accu *accu)
+void db_insert_mc(struct db_target *dbt, struct mc_accu *accu)
 {
 	bson_oid_t oid;
 	bson_t *doc;
 	bson_t *arr;
 	uint64_t *modcods;
 	char i_to_string[3];
+	int64_t start_ns;
 
+	start_ns = latency_now_ns();
 	modcods = accu->perc + 1;
 
 	arr = bson_new();
@@ -132,43 +333,293 @@ void db_insert_mc(mongoc_collection_t *dbc, struct mc_accu *accu)
 	bson_append_int64(doc, "total", -1, accu->curr[0]);
 	bson_append_array(doc, "arr", -1, arr);
 
-	db_insert(dbc, doc);
+	db_insert(dbt, doc);
 
 	bson_destroy(arr);
-	bson_destroy(doc);
+
+	latency_record_since(LAT_DB_INSERT_MC, start_ns);
+}
+
+/**
+ * Helper to build the _id of a rollup bucket. It is derived from the
+ * bucket itself, so that updates of the bucket can be upserts.
+ */
+static void rollup_id(char *buf, size_t len, const char *tier,
+                      const char *rx_name, const char *ns_name, time_t ts)
+{
+	snprintf(buf, len, "%s/%s/%s/%ld", tier, rx_name, ns_name, (long)ts);
 }
 
 /**
- * Get the average EsNo for specific [rx, ns] from 'ts_begin' to now. Uses the
- * Mongo aggregation framework. May be quite heavyweight. The results are given
- * through the referenced esno/count variables
+ * Write a rollup bucket of the given tier into the database, replacing the
+ * values written for this bucket before
+ */
+void db_upsert_rollup(struct db_target *dbt, const char *tier,
+                      const char *rx_name, const char *ns_name,
+                      struct rollup_bucket *bucket)
+{
+	bson_t *selector, *update;
+	bson_t set;
+	char id[320];
+	int64_t start_ns;
+
+	start_ns = latency_now_ns();
+	rollup_id(id, sizeof(id), tier, rx_name, ns_name, bucket->ts);
+	selector = BCON_NEW("_id", BCON_UTF8(id));
+
+	update = bson_new();
+	bson_append_document_begin(update, "$set", -1, &set);
+	bson_append_utf8(&set, "tier", -1, tier, -1);
+	bson_append_utf8(&set, "rx", -1, rx_name, -1);
+	bson_append_utf8(&set, "ns", -1, ns_name, -1);
+	bson_append_time_t(&set, "ts", -1, bucket->ts);
+	bson_append_double(&set, "sum", -1, bucket->sum);
+	bson_append_int32(&set, "count", -1, bucket->count);
+	bson_append_double(&set, "min", -1, bucket->min);
+	bson_append_double(&set, "max", -1, bucket->max);
+	bson_append_double(&set, "esno", -1, bucket->sum / bucket->count);
+	bson_append_document_end(update, &set);
+
+	if (!db_writer_push_upsert(dbt, selector, update)) {
+		fprintf(stderr, "MongoDB upsert failed: Queue and spool are full\n");
+	}
+
+	latency_record_since(LAT_DB_UPSERT_ROLLUP, start_ns);
+}
+
+/**
+ * Read a rollup bucket of the given tier from the database
  *
- * @return 1 on success, else 0
+ * @return 1 if found, else 0
  */
-int db_get_esno_avg(mongoc_collection_t *dbc, char *rx_name, char *ns_name,
-                    time_t ts_begin, double *esno, int *count)
+int db_get_rollup(mongoc_collection_t *dbc, const char *tier,
+                  const char *rx_name, const char *ns_name, time_t ts,
+                  struct rollup_bucket *bucket)
 {
-	bson_t *pipeline;
-	mongoc_cursor_t *cursor = NULL;
+	bson_t *query;
+	mongoc_cursor_t *cursor;
+	const bson_t *res;
 	bson_iter_t iter;
+	char id[320];
+	int found;
+
+	rollup_id(id, sizeof(id), tier, rx_name, ns_name, ts);
+	query = BCON_NEW("_id", BCON_UTF8(id));
+
+	cursor = mongoc_collection_find(dbc, MONGOC_QUERY_NONE, 0, 1, 0,
+	                                query, NULL, NULL);
+
+	bson_destroy(query);
+
+	found = 0;
+	if (mongoc_cursor_next(cursor, &res)) {
+		bucket->ts = ts;
+		bucket->sum = 0;
+		bucket->count = 0;
+		bucket->min = 0;
+		bucket->max = 0;
+
+		if (bson_iter_init_find(&iter, res, "sum"))
+			bucket->sum = bson_iter_double(&iter);
+		if (bson_iter_init_find(&iter, res, "count"))
+			bucket->count = bson_iter_int32(&iter);
+		if (bson_iter_init_find(&iter, res, "min"))
+			bucket->min = bson_iter_double(&iter);
+		if (bson_iter_init_find(&iter, res, "max"))
+			bucket->max = bson_iter_double(&iter);
+
+		// An empty bucket is useless, start over then
+		if (bucket->count < 1)
+			bucket->ts = 0;
+		else
+			found = 1;
+	}
+
+	mongoc_cursor_destroy(cursor);
+
+	return found;
+}
+
+/**
+ * Create the index the web interface uses to read the rollups
+ */
+void db_create_rollup_index(mongoc_collection_t *dbc)
+{
+	bson_t *keys;
+	bson_error_t error;
+
+	keys = BCON_NEW("tier", BCON_INT32(1), "ts", BCON_INT32(-1));
+
+	if (!mongoc_collection_create_index(dbc, keys, NULL, &error)) {
+		fprintf(stderr, "MongoDB index creation failed: %s\n",
+		        error.message);
+	}
+
+	bson_destroy(keys);
+}
+
+/**
+ * Write the trend detectors of a NS into the database, replacing the ones
+ * written before
+ */
+void db_upsert_trend(struct db_target *dbt, size_t rx, const char *ns_name,
+                     struct esno_trend *trend)
+{
+	bson_t *selector, *update;
+	bson_t set;
+	char id[320];
+
+	char rx_name[4];
+	switch (rx) {
+	case RX1: strncpy(rx_name, "RX1", 4); break;
+	case RX2: strncpy(rx_name, "RX2", 4); break;
+	}
+
+	snprintf(id, sizeof(id), "%s/%s", rx_name, ns_name);
+	selector = BCON_NEW("_id", BCON_UTF8(id));
+
+	update = bson_new();
+	bson_append_document_begin(update, "$set", -1, &set);
+	bson_append_utf8(&set, "rx", -1, rx_name, -1);
+	bson_append_utf8(&set, "ns", -1, ns_name, -1);
+	bson_append_time_t(&set, "first_ts", -1, trend->first_ts);
+	bson_append_time_t(&set, "last_ts", -1, trend->last_ts);
+	bson_append_double(&set, "fast", -1, trend->fast);
+	bson_append_double(&set, "slow", -1, trend->slow);
+	bson_append_double(&set, "slow_weight", -1, trend->slow_weight);
+	bson_append_double(&set, "var", -1, trend->var);
+	bson_append_double(&set, "var_weight", -1, trend->var_weight);
+	bson_append_double(&set, "sw", -1, trend->sw);
+	bson_append_double(&set, "sx", -1, trend->sx);
+	bson_append_double(&set, "sy", -1, trend->sy);
+	bson_append_double(&set, "sxx", -1, trend->sxx);
+	bson_append_double(&set, "sxy", -1, trend->sxy);
+	bson_append_double(&set, "slope", -1, trend->slope);
+	bson_append_double(&set, "cusum_lo", -1, trend->cusum_lo);
+	bson_append_double(&set, "cusum_hi", -1, trend->cusum_hi);
+	bson_append_int32(&set, "cusum_lo_n", -1, trend->cusum_lo_n);
+	bson_append_int32(&set, "cusum_hi_n", -1, trend->cusum_hi_n);
+	bson_append_int32(&set, "flags", -1, trend->flags);
+	bson_append_document_end(update, &set);
+
+	if (!db_writer_push_upsert(dbt, selector, update)) {
+		fprintf(stderr, "MongoDB upsert failed: Queue and spool are full\n");
+	}
+}
+
+/**
+ * Read the trend detectors of a NS from the database
+ *
+ * @return 1 if found, else 0
+ */
+int db_get_trend(mongoc_collection_t *dbc, size_t rx, const char *ns_name,
+                 struct esno_trend *trend)
+{
+	const char *keys[] = {
+		"fast", "slow", "slow_weight", "var", "var_weight", "sw", "sx",
+		"sy", "sxx", "sxy", "slope", "cusum_lo", "cusum_hi",
+	};
+	double *vals[] = {
+		&trend->fast, &trend->slow, &trend->slow_weight, &trend->var,
+		&trend->var_weight, &trend->sw, &trend->sx, &trend->sy,
+		&trend->sxx, &trend->sxy, &trend->slope, &trend->cusum_lo,
+		&trend->cusum_hi,
+	};
+	bson_t *query;
+	mongoc_cursor_t *cursor;
 	const bson_t *res;
+	bson_iter_t iter;
+	char id[320];
+	int found;
 
-	ts_begin *= 1000;
+	snprintf(id, sizeof(id), "%s/%s", rx == RX1 ? "RX1" : "RX2", ns_name);
+	query = BCON_NEW("_id", BCON_UTF8(id));
+
+	cursor = mongoc_collection_find(dbc, MONGOC_QUERY_NONE, 0, 1, 0,
+	                                query, NULL, NULL);
+
+	bson_destroy(query);
+
+	found = 0;
+	if (mongoc_cursor_next(cursor, &res)) {
+		memset(trend, 0, sizeof(struct esno_trend));
+
+		if (bson_iter_init_find(&iter, res, "first_ts") &&
+		    BSON_ITER_HOLDS_DATE_TIME(&iter))
+			trend->first_ts = bson_iter_date_time(&iter) / 1000;
+		if (bson_iter_init_find(&iter, res, "last_ts") &&
+		    BSON_ITER_HOLDS_DATE_TIME(&iter))
+			trend->last_ts = bson_iter_date_time(&iter) / 1000;
+		for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+			if (bson_iter_init_find(&iter, res, keys[i]) &&
+			    BSON_ITER_HOLDS_DOUBLE(&iter))
+				*vals[i] = bson_iter_double(&iter);
+		}
+		if (bson_iter_init_find(&iter, res, "cusum_lo_n"))
+			trend->cusum_lo_n = bson_iter_int32(&iter);
+		if (bson_iter_init_find(&iter, res, "cusum_hi_n"))
+			trend->cusum_hi_n = bson_iter_int32(&iter);
+		if (bson_iter_init_find(&iter, res, "flags"))
+			trend->flags = bson_iter_int32(&iter);
+
+		// Without a first slice, the detectors start over
+		if (trend->first_ts && trend->last_ts >= trend->first_ts)
+			found = 1;
+	}
+
+	mongoc_cursor_destroy(cursor);
+
+	return found;
+}
+
+/**
+ * Create the index of the alarm state changes, for the web interface to
+ * get the latest state of each NS
+ */
+void db_create_alarm_index(mongoc_collection_t *dbc)
+{
+	bson_t *keys;
+	bson_error_t error;
+
+	keys = BCON_NEW("rx", BCON_INT32(1), "ns", BCON_INT32(1),
+	                "ts", BCON_INT32(-1));
+
+	if (!mongoc_collection_create_index(dbc, keys, NULL, &error)) {
+		fprintf(stderr, "MongoDB index creation failed: %s\n",
+		        error.message);
+	}
+
+	bson_destroy(keys);
+}
+
+/**
+ * Load the latest alarm state of all [rx, ns] with a single aggregation.
+ * Each one is handed to 'found' with the time it was entered.
+ *
+ * @return 1 on success, else 0
+ */
+int db_get_alarm_states(mongoc_collection_t *dbc,
+                        void (*found)(void *carry, const char *rx_name,
+                                      const char *ns_name, const char *state,
+                                      time_t ts),
+                        void *carry)
+{
+	bson_t *pipeline;
+	mongoc_cursor_t *cursor;
+	const bson_t *res;
+	bson_iter_t iter, id;
+	bson_error_t error;
+	const char *rx_name, *ns_name, *state;
+	time_t ts;
 
 	pipeline = BCON_NEW(
 		"pipeline", "[",
-		  "{", "$match",
-		    "{",
-		      "rx", BCON_UTF8(rx_name),
-		      "ns", BCON_UTF8(ns_name),
-		      "ts", "{", "$gt", BCON_DATE_TIME(ts_begin), "}",
-		    "}",
-		  "}",
+		  "{", "$sort", "{", "ts", BCON_INT32(-1), "}", "}",
 		  "{", "$group",
 		    "{",
-		      "_id", "$ns",
-		      "esno_avg", "{", "$avg", "$esno", "}",
-		      "count", "{", "$sum", BCON_INT32(1), "}",
+		      "_id", "{", "rx", "$rx", "ns", "$ns", "}",
+		      "state", "{", "$first", "$state", "}",
+		      "ts", "{", "$first", "$ts", "}",
 		    "}",
 		  "}",
 		"]");
@@ -178,29 +629,153 @@ int db_get_esno_avg(mongoc_collection_t *dbc, char *rx_name, char *ns_name,
 
 	bson_destroy(pipeline);
 
-	if (!mongoc_cursor_next(cursor, &res)) {
-		return 0;
+	while (mongoc_cursor_next(cursor, &res)) {
+		if (!(bson_iter_init_find(&iter, res, "_id") &&
+		     bson_iter_recurse(&iter, &id)))
+			continue;
+		if (!(bson_iter_find(&id, "rx") && BSON_ITER_HOLDS_UTF8(&id)))
+			continue;
+		rx_name = bson_iter_utf8(&id, NULL);
+		bson_iter_recurse(&iter, &id);
+		if (!(bson_iter_find(&id, "ns") && BSON_ITER_HOLDS_UTF8(&id)))
+			continue;
+		ns_name = bson_iter_utf8(&id, NULL);
+
+		if (!(bson_iter_init_find(&iter, res, "state") &&
+		     BSON_ITER_HOLDS_UTF8(&iter)))
+			continue;
+		state = bson_iter_utf8(&iter, NULL);
+		if (!(bson_iter_init_find(&iter, res, "ts") &&
+		     BSON_ITER_HOLDS_DATE_TIME(&iter)))
+			continue;
+		ts = bson_iter_date_time(&iter) / 1000;
+
+		found(carry, rx_name, ns_name, state, ts);
 	}
 
-	if (!(bson_iter_init_find(&iter, res, "esno_avg") &&
-	     (BSON_ITER_HOLDS_DOUBLE(&iter)))) {
+	if (mongoc_cursor_error(cursor, &error)) {
+		fprintf(stderr, "MongoDB aggregation failed: %s\n",
+		        error.message);
 		mongoc_cursor_destroy(cursor);
 		return 0;
 	}
 
-	*esno = bson_iter_double(&iter);
+	mongoc_cursor_destroy(cursor);
 
-	if (!(bson_iter_init_find(&iter, res, "count") &&
-	     (BSON_ITER_HOLDS_INT32(&iter)))) {
-		mongoc_cursor_destroy(cursor);
-		return 0;
+	return 1;
+}
+
+/**
+ * Create the index used to load the EsNo windows. It covers the whole
+ * pipeline of db_get_esno_windows().
+ */
+void db_create_sdd_index(mongoc_collection_t *dbc)
+{
+	bson_t *keys;
+	bson_error_t error;
+
+	keys = BCON_NEW("ts", BCON_INT32(1), "rx", BCON_INT32(1),
+	                "ns", BCON_INT32(1), "esno", BCON_INT32(1));
+
+	if (!mongoc_collection_create_index(dbc, keys, NULL, &error)) {
+		fprintf(stderr, "MongoDB index creation failed: %s\n",
+		        error.message);
 	}
 
-	*count = bson_iter_int32(&iter);
+	bson_destroy(keys);
+}
+
+/**
+ * Load the EsNo values of all [rx, ns] from 'ts_begin' to now with a single
+ * aggregation, grouped by rx and ns. The values are pushed into the windows
+ * given by 'lookup', oldest first. Unknown [rx, ns] are skipped.
+ *
+ * @return 1 on success, else 0
+ */
+int db_get_esno_windows(mongoc_collection_t *dbc, time_t ts_begin,
+                        struct esno_window *(*lookup)(void *carry,
+                                                      const char *rx_name,
+                                                      const char *ns_name),
+                        void *carry)
+{
+	bson_t *pipeline;
+	mongoc_cursor_t *cursor;
+	const bson_t *res;
+	bson_iter_t iter, id, samples, sample;
+	bson_error_t error;
+	struct esno_window *w;
+	const char *rx_name, *ns_name;
+	time_t ts;
+	double esno;
+
+	ts_begin *= 1000;
+
+	pipeline = BCON_NEW(
+		"pipeline", "[",
+		  "{", "$match",
+		    "{",
+		      "ts", "{", "$gt", BCON_DATE_TIME(ts_begin), "}",
+		    "}",
+		  "}",
+		  "{", "$sort", "{", "ts", BCON_INT32(1), "}", "}",
+		  "{", "$group",
+		    "{",
+		      "_id", "{", "rx", "$rx", "ns", "$ns", "}",
+		      "samples", "{", "$push",
+		        "{", "ts", "$ts", "esno", "$esno", "}",
+		      "}",
+		    "}",
+		  "}",
+		"]");
+
+	cursor = mongoc_collection_aggregate(dbc, MONGOC_QUERY_NONE, pipeline,
+	                                     NULL, NULL);
+
+	bson_destroy(pipeline);
+
+	while (mongoc_cursor_next(cursor, &res)) {
+		// Find the window of this [rx, ns]
+		if (!(bson_iter_init_find(&iter, res, "_id") &&
+		     bson_iter_recurse(&iter, &id)))
+			continue;
+		if (!(bson_iter_find(&id, "rx") && BSON_ITER_HOLDS_UTF8(&id)))
+			continue;
+		rx_name = bson_iter_utf8(&id, NULL);
+		bson_iter_recurse(&iter, &id);
+		if (!(bson_iter_find(&id, "ns") && BSON_ITER_HOLDS_UTF8(&id)))
+			continue;
+		ns_name = bson_iter_utf8(&id, NULL);
+
+		if (!(w = lookup(carry, rx_name, ns_name)))
+			continue;
+
+		// Push its values
+		if (!(bson_iter_init_find(&iter, res, "samples") &&
+		     BSON_ITER_HOLDS_ARRAY(&iter) &&
+		     bson_iter_recurse(&iter, &samples)))
+			continue;
+
+		while (bson_iter_next(&samples)) {
+			if (!(BSON_ITER_HOLDS_DOCUMENT(&samples) &&
+			     bson_iter_recurse(&samples, &sample)))
+				continue;
+			if (!(bson_iter_find(&sample, "ts") &&
+			     BSON_ITER_HOLDS_DATE_TIME(&sample)))
+				continue;
+			ts = bson_iter_date_time(&sample) / 1000;
+			bson_iter_recurse(&samples, &sample);
+			if (!(bson_iter_find(&sample, "esno") &&
+			     BSON_ITER_HOLDS_DOUBLE(&sample)))
+				continue;
+			esno = bson_iter_double(&sample);
+
+			esno_window_push(w, ts, esno);
+		}
+	}
 
-	mongoc_cursor_next(cursor, &res);
-	if (mongoc_cursor_more(cursor)) {
-		fprintf(stderr, "EsNo monitor: DB cursor not exhausted!\n");
+	if (mongoc_cursor_error(cursor, &error)) {
+		fprintf(stderr, "MongoDB aggregation failed: %s\n",
+		        error.message);
 		mongoc_cursor_destroy(cursor);
 		return 0;
 	}
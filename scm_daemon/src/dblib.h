@@ -4,17 +4,57 @@
 #include "common.h"
 
 struct mc_accu;  // Needs forward declaration
+struct db_target;
+struct rollup_bucket;
+struct esno_window;
+struct latency_histogram;
+struct sdd_slice_stats;
+struct esno_trend;
 
 mongoc_client_t *db_init();
+mongoc_client_t *db_client_new();
+mongoc_client_pool_t *db_client_pool_new(size_t max_size);
+void db_client_free(mongoc_client_t *client);
 mongoc_collection_t *db_connect(mongoc_client_t *client, char *db_name,
                                 char *collection_name);
 void db_disconnect(mongoc_collection_t *dbc);
 void db_free(mongoc_client_t *client);
 void db_update_watchdog(mongoc_collection_t *dbc, time_t ts);
-void db_insert_sdd(mongoc_collection_t *dbc, size_t rx, const char *ns_name,
-                   time_t ts, double esno);
-void db_insert_mc(mongoc_collection_t *dbc, struct mc_accu *accu);
-int db_get_esno_avg(mongoc_collection_t *dbc, char *rx_name, char *ns_name,
-                    time_t ts_begin, double *esno, int *count);
+void db_insert_sdd(struct db_target *dbt, size_t rx, const char *ns_name,
+                   time_t ts, double esno, struct sdd_slice_stats *stats);
+void db_insert_mc(struct db_target *dbt, struct mc_accu *accu);
+void db_insert_event(struct db_target *dbt, size_t rx, const char *ns_name,
+                     time_t ts, int flag, double esno,
+                     struct esno_trend *trend);
+void db_insert_alarm(struct db_target *dbt, size_t rx, const char *ns_name,
+                     time_t ts, const char *from, const char *to,
+                     double esno, double threshold, int flags);
+void db_create_alarm_index(mongoc_collection_t *dbc);
+int db_get_alarm_states(mongoc_collection_t *dbc,
+                        void (*found)(void *carry, const char *rx_name,
+                                      const char *ns_name, const char *state,
+                                      time_t ts),
+                        void *carry);
+void db_insert_lock(struct db_target *dbt, size_t rx, const char *ns_name,
+                    time_t ts, struct latency_histogram *lock,
+                    uint64_t missed);
+void db_create_lock_index(mongoc_collection_t *dbc);
+void db_upsert_rollup(struct db_target *dbt, const char *tier,
+                      const char *rx_name, const char *ns_name,
+                      struct rollup_bucket *bucket);
+int db_get_rollup(mongoc_collection_t *dbc, const char *tier,
+                  const char *rx_name, const char *ns_name, time_t ts,
+                  struct rollup_bucket *bucket);
+void db_create_rollup_index(mongoc_collection_t *dbc);
+void db_upsert_trend(struct db_target *dbt, size_t rx, const char *ns_name,
+                     struct esno_trend *trend);
+int db_get_trend(mongoc_collection_t *dbc, size_t rx, const char *ns_name,
+                 struct esno_trend *trend);
+void db_create_sdd_index(mongoc_collection_t *dbc);
+int db_get_esno_windows(mongoc_collection_t *dbc, time_t ts_begin,
+                        struct esno_window *(*lookup)(void *carry,
+                                                      const char *rx_name,
+                                                      const char *ns_name),
+                        void *carry);
 
 #endif // DBLIB_H
@@ -0,0 +1,251 @@
+#include "device.h"
+
+static void cb_tuner_polled(void *arg, int ok, const unsigned char *locked);
+
+/**
+ * Fill in the configuration of a device. Nothing is connected yet, this is
+ * done in device_init().
+ */
+void device_setup(struct tc1_device *dev, const char *name, const char *ip_addr,
+                  const char *ns_config_file, const char *db_name)
+{
+	struct in_addr addr4;
+
+	memset(dev, 0, sizeof(struct tc1_device));
+	strncpy(dev->name, name, sizeof(dev->name) - 1);
+	strncpy(dev->ip_addr, ip_addr, sizeof(dev->ip_addr) - 1);
+	strncpy(dev->ns_config_file, ns_config_file,
+	        sizeof(dev->ns_config_file) - 1);
+	strncpy(dev->db_name, db_name, sizeof(dev->db_name) - 1);
+
+	// Keep the address in the form we get it from recvmmsg later on
+	if (inet_pton(AF_INET, ip_addr, &addr4) == 1) {
+		memset(&dev->addr, 0, sizeof(struct in6_addr));
+		dev->addr.s6_addr[10] = 0xff;
+		dev->addr.s6_addr[11] = 0xff;
+		memcpy(&dev->addr.s6_addr[12], &addr4, 4);
+	} else if (inet_pton(AF_INET6, ip_addr, &dev->addr) != 1) {
+		fprintf(stderr, "Device: Invalid IP address '%s'!\n", ip_addr);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Connect the device: Open the database collections and SNMP sessions,
+ * parse its network segments and add its monitor to the event base. The
+ * given clock, client, writer and event base must only be used by the
+ * thread which will drive this device. The writer must not be started yet.
+ */
+void device_init(struct tc1_device *dev, struct event_base *evbase,
+                 struct vclock *clock, mongoc_client_t *db_client,
+                 struct db_writer *dbw, struct mon_pool *mon_pool,
+                 struct alarm_dispatcher *alarms)
+{
+	dev->clock = clock;
+
+	// Database collections: Reads are done directly, writes are queued
+	dev->dbc_sdd = db_connect(db_client, dev->db_name, COLLECTION_NAME_SDD);
+	db_writer_target(dbw, &dev->dbt_sdd, dev->db_name, COLLECTION_NAME_SDD);
+	db_writer_target(dbw, &dev->dbt_mc, dev->db_name, COLLECTION_NAME_MC);
+	db_writer_target(dbw, &dev->dbt_rollup, dev->db_name,
+	                 COLLECTION_NAME_ROLLUP);
+	db_writer_target(dbw, &dev->dbt_lock, dev->db_name,
+	                 COLLECTION_NAME_LOCK);
+	db_writer_target(dbw, &dev->dbt_events, dev->db_name,
+	                 COLLECTION_NAME_EVENTS);
+	db_writer_target(dbw, &dev->dbt_alarms, dev->db_name,
+	                 COLLECTION_NAME_ALARMS);
+	db_writer_target(dbw, &dev->dbt_trend, dev->db_name,
+	                 COLLECTION_NAME_TREND);
+
+	// Init SNMP sessions, served by the event base like everything else
+	snmp_init(&dev->snmp_sess, dev->offline ? NULL : dev->ip_addr, evbase);
+
+	// Configure blades / network segments to use
+	rx_index_init(&dev->rx_idx, &dev->snmp_sess, dev->ns_config_file);
+
+	// Continue the rollup buckets written before a restart
+	mongoc_collection_t *dbc_rollup;
+	dbc_rollup = db_connect(db_client, dev->db_name, COLLECTION_NAME_ROLLUP);
+	rollup_seed(&dev->rx_idx, dbc_rollup, vclock_now(clock));
+	db_disconnect(dbc_rollup);
+
+	// Continue the trend detectors, too
+	mongoc_collection_t *dbc_trend;
+	dbc_trend = db_connect(db_client, dev->db_name, COLLECTION_NAME_TREND);
+	esno_trend_seed(&dev->rx_idx, dbc_trend);
+	db_disconnect(dbc_trend);
+
+	// Index the lock time reports for the web interface
+	mongoc_collection_t *dbc_lock;
+	dbc_lock = db_connect(db_client, dev->db_name, COLLECTION_NAME_LOCK);
+	db_create_lock_index(dbc_lock);
+	db_disconnect(dbc_lock);
+
+	// SDD handler state. The socket is bound by the caller.
+	dev->c_sdd.dbt = &dev->dbt_sdd;
+	dev->c_sdd.dbt_rollup = &dev->dbt_rollup;
+	dev->c_sdd.dbt_events = &dev->dbt_events;
+	dev->c_sdd.mon = &dev->c_mon;
+	dev->c_sdd.rx_idx = &dev->rx_idx;
+	dev->c_sdd.batch = NULL;
+	dev->c_sdd.rec = NULL;
+	dev->c_sdd.clock = clock;
+	dev->c_sdd.retune_ns = 0;
+	dev->c_sdd.lock_pending = 0;
+	dev->c_sdd.lock_armed = 0;
+	dev->c_sdd.slice_gen = 0;
+	dev->last_sdd_mono = vclock_mono(clock);
+	reset_sdd_accu(&dev->c_sdd.accu, RX1, 0, vclock_now(clock),
+	               dev->last_sdd_mono);
+
+	// MODCOD handler state
+	dev->c_mc.dbt = &dev->dbt_mc;
+	dev->c_mc.batch = NULL;
+	dev->c_mc.rec = NULL;
+	dev->c_mc.clock = clock;
+	init_mc_accu(&dev->c_mc.accu, vclock_now(clock));
+
+	// Monitor EsNo degradation and trigger alarm
+	struct timeval ev_timer_mon = { MON_CHECK_INTERVAL, 0 };
+	dev->c_mon.rx_idx = &dev->rx_idx;
+	mon_init(&dev->c_mon, evbase, clock, &dev->rx_idx, mon_pool, alarms,
+	         &dev->dbt_alarms, dev->db_name);
+	dev->ev_mon = event_new(evbase, -1, EV_PERSIST,
+	                        cb_esno_degradation_monitor, &dev->c_mon);
+	event_add(dev->ev_mon, &ev_timer_mon);
+
+	// Write the lock times out now and then
+	struct timeval ev_timer_lock = { LOCK_REPORT_INTERVAL, 0 };
+	dev->ev_lock = event_new(evbase, -1, EV_PERSIST, cb_lock_report, dev);
+	event_add(dev->ev_lock, &ev_timer_lock);
+
+	// Save the trend detectors now and then
+	struct timeval ev_timer_trend = { TREND_SAVE_INTERVAL, 0 };
+	dev->ev_trend = event_new(evbase, -1, EV_PERSIST, cb_trend_save, dev);
+	event_add(dev->ev_trend, &ev_timer_trend);
+
+	// Poll the tuner status, to cut slices without a lock short
+	dev->ev_poll = NULL;
+	dev->polling = 0;
+	dev->poll_gen = 0;
+	if (!dev->offline && TUNER_POLL_MS > 0) {
+		struct timeval ev_timer_poll = {
+			TUNER_POLL_MS / 1000, TUNER_POLL_MS % 1000 * 1000
+		};
+		dev->ev_poll = event_new(evbase, -1, EV_PERSIST, cb_poll_tuner,
+		                         dev);
+		event_add(dev->ev_poll, &ev_timer_poll);
+	}
+}
+
+/**
+ * Free resources. The event base of the device must not run anymore.
+ */
+void device_free(struct tc1_device *dev)
+{
+	event_free(dev->ev_mon);
+	event_free(dev->ev_lock);
+	event_free(dev->ev_trend);
+	if (dev->ev_poll)
+		event_free(dev->ev_poll);
+	mon_free(&dev->c_mon);
+	rx_index_free(&dev->rx_idx);
+	snmp_free(&dev->snmp_sess);
+	db_disconnect(dev->dbc_sdd);
+}
+
+/**
+ * Callback for LibEvent timer: Write the lock time histograms of every NS
+ * which has been visited since the last report, and start them over
+ */
+void cb_lock_report(evutil_socket_t fd, short events, void *carry)
+{
+	struct tc1_device *dev;
+	struct net_segment *this_ns;
+	time_t now;
+
+	// Unpack carry
+	dev = (struct tc1_device *)carry;
+	now = vclock_now(dev->clock);
+
+	for (size_t rx = 0; rx < 2; ++rx) {
+		for (size_t ns = 0; ns < dev->rx_idx.ns_idx[rx].total; ++ns) {
+			this_ns = ns_get(&dev->rx_idx, rx, ns);
+			if (!this_ns->lock[LOCK_DEMOD].count &&
+			    !this_ns->lock_missed)
+				continue;
+
+			db_insert_lock(&dev->dbt_lock, rx, this_ns->name, now,
+			               this_ns->lock, this_ns->lock_missed);
+			memset(this_ns->lock, 0, sizeof(this_ns->lock));
+			this_ns->lock_missed = 0;
+		}
+	}
+}
+
+/**
+ * Callback for LibEvent timer: Write the trend detectors of every NS, so
+ * that a restart continues with them
+ */
+void cb_trend_save(evutil_socket_t fd, short events, void *carry)
+{
+	struct tc1_device *dev;
+
+	// Unpack carry
+	dev = (struct tc1_device *)carry;
+
+	esno_trend_save(&dev->rx_idx, &dev->dbt_trend);
+}
+
+/**
+ * Callback for LibEvent timer: Poll the tuner status of both RXs, unless
+ * the last poll is still in flight
+ */
+void cb_poll_tuner(evutil_socket_t fd, short events, void *carry)
+{
+	struct tc1_device *dev;
+
+	// Unpack carry
+	dev = (struct tc1_device *)carry;
+
+	if (dev->polling)
+		return;
+
+	dev->polling = 1;
+	dev->poll_gen = dev->c_sdd.slice_gen;
+	snmp_poll_status(&dev->snmp_sess, cb_tuner_polled, dev);
+}
+
+/**
+ * Callback for the status poll: Hand the status to the SDD handler, which
+ * drops it if the slice changed meanwhile
+ */
+static void cb_tuner_polled(void *arg, int ok, const unsigned char *locked)
+{
+	struct tc1_device *dev = (struct tc1_device *)arg;
+
+	dev->polling = 0;
+	if (ok)
+		handle_tuner_status(&dev->c_sdd, locked, dev->poll_gen);
+}
+
+/**
+ * Helper to turn the sender address of a datagram into the device address
+ * representation, i.e. IPv6 with IPv4 mapped into it
+ */
+void device_addr_key(struct sockaddr_storage *sas, struct in6_addr *key)
+{
+	struct sockaddr *sa;
+	sa = (struct sockaddr *)sas;
+
+	if (sa->sa_family == AF_INET) {
+		memset(key, 0, sizeof(struct in6_addr));
+		key->s6_addr[10] = 0xff;
+		key->s6_addr[11] = 0xff;
+		memcpy(&key->s6_addr[12],
+		       &((struct sockaddr_in *)sa)->sin_addr, 4);
+		return;
+	}
+	*key = ((struct sockaddr_in6 *)sa)->sin6_addr;
+}
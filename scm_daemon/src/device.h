@@ -0,0 +1,55 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include "common.h"
+
+// Not part of common.h, as it embeds the structs of the other headers
+
+struct fleet_worker;  // Needs forward declaration
+struct mon_pool;
+struct alarm_dispatcher;
+
+// One TC1 demodulator, together with all the state needed to monitor it
+struct tc1_device {
+	char name[64];
+	char ip_addr[INET6_ADDRSTRLEN];
+	char ns_config_file[256];
+	char db_name[96];
+	struct in6_addr addr;  // Source of its UDP messages, IPv4 is mapped
+	mongoc_collection_t *dbc_sdd;  // For reading only
+	struct db_target dbt_sdd;
+	struct db_target dbt_mc;
+	struct db_target dbt_rollup;
+	struct db_target dbt_lock;
+	struct db_target dbt_events;
+	struct db_target dbt_alarms;
+	struct db_target dbt_trend;
+	struct snmp_sessions snmp_sess;
+	struct rx_index rx_idx;
+	struct ev_carry_sdd c_sdd;
+	struct ev_carry_mc c_mc;
+	struct ev_carry_mon c_mon;
+	struct event *ev_mon;
+	struct event *ev_lock;
+	struct event *ev_trend;
+	struct event *ev_poll;  // Tuner status, NULL without SNMP
+	unsigned char polling;  // A status poll is in flight
+	unsigned int poll_gen;  // Slice of the SDD handler it was sent in
+	struct vclock *clock;  // Of the thread driving the device
+	time_t last_sdd_mono;  // Fleet: For the timeout, on the monotonic clock
+	unsigned char offline;  // No SNMP, every retune is confirmed at once
+	struct fleet_worker *worker;
+};
+
+void device_setup(struct tc1_device *dev, const char *name, const char *ip_addr,
+                  const char *ns_config_file, const char *db_name);
+void device_init(struct tc1_device *dev, struct event_base *evbase,
+                 struct vclock *clock, mongoc_client_t *db_client, struct db_writer *dbw,
+                 struct mon_pool *mon_pool, struct alarm_dispatcher *alarms);
+void device_free(struct tc1_device *dev);
+void cb_lock_report(evutil_socket_t fd, short events, void *carry);
+void cb_trend_save(evutil_socket_t fd, short events, void *carry);
+void cb_poll_tuner(evutil_socket_t fd, short events, void *carry);
+void device_addr_key(struct sockaddr_storage *sas, struct in6_addr *key);
+
+#endif // DEVICE_H
@@ -1,8 +1,99 @@
 #include "esno_monitor.h"
+#include "mon_pool.h"
+#include "alarm_dispatch.h"
 
+static void mon_state_init(struct mon_state *state, struct rx_index *rx_idx);
+static void mon_state_destroy(struct mon_state *state);
 static int validity_check(int cnt, struct mon_state *state);
-static void execute_alarm_script(int flags, char *rx, char *ns);
-static void *worker_thread(void *carry);
+static int alarm_level(struct mon_alarm *alarm, int flags, double esno,
+                       double threshold);
+static void update_alarm(struct ev_carry_mon *mon, size_t idx, int flags,
+                         double esno, int urgent);
+static void seed_windows(struct mon_job *job, mongoc_client_t *client);
+static struct esno_window *seed_lookup(void *carry, const char *rx_name,
+                                       const char *ns_name);
+static void seed_alarm(void *carry, const char *rx_name, const char *ns_name,
+                       const char *state_name, time_t ts);
+static int find_ns(struct mon_job *job, const char *rx_name,
+                   const char *ns_name, size_t *idx);
+static int check_ns(struct mon_state *state, size_t idx, time_t now,
+                    double *esno);
+static void cb_mon_done(evutil_socket_t fd, short events, void *carry);
+
+// Names of the alarm states, as stored in the database
+static const char *state_names[] = {
+	[MON_OK] = "ok",
+	[MON_WARN] = "warn",
+	[MON_ALARM] = "alarm",
+	[MON_CLEARED] = "cleared",
+};
+
+/**
+ * Set up the monitor of one device. Its EsNo windows are loaded from the
+ * database by the pool, the monitor does nothing until this is done. The
+ * live windows keep growing meanwhile, so the names, sizes and spans the
+ * pool needs are taken here.
+ */
+void mon_init(struct ev_carry_mon *mon, struct event_base *evbase,
+              struct vclock *clock, struct rx_index *rx_idx,
+              struct mon_pool *pool, struct alarm_dispatcher *alarms,
+              struct db_target *dbt_alarms, const char *db_name)
+{
+	struct mon_job *job;
+
+	mon->rx_idx = rx_idx;
+	mon->clock = clock;
+	mon->pool = pool;
+	mon->alarms = alarms;
+	mon->dbt_alarms = dbt_alarms;
+	strncpy(mon->db_name, db_name, sizeof(mon->db_name) - 1);
+	mon->db_name[sizeof(mon->db_name) - 1] = 0;
+	mon->seeded = 0;
+	mon->done = NULL;
+	mon_state_init(&mon->state, rx_idx);
+	pthread_mutex_init(&mon->done_lock, NULL);
+	mon->ev_done = event_new(evbase, -1, 0, cb_mon_done, mon);
+
+	if (!(job = calloc(1, sizeof(struct mon_job)))) {
+		fprintf(stderr, "Monitor failed to allocate a job!\n");
+		exit(EXIT_FAILURE);
+	}
+	job->type = MON_JOB_SEED;
+	job->mon = mon;
+	job->ts = vclock_now(clock);
+
+	job->names = malloc(mon->state.total * sizeof(const char *));
+	job->windows = malloc(mon->state.total * sizeof(struct esno_window));
+	if (!job->names || !job->windows) {
+		fprintf(stderr, "Monitor failed to allocate EsNo windows!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t i = 0; i < mon->state.total; ++i) {
+		struct esno_window *live = &mon->state.ns[i]->window;
+		job->names[i] = mon->state.ns[i]->name;
+		esno_window_init(&job->windows[i], live->size, live->span);
+	}
+
+	mon_pool_submit(pool, job);
+}
+
+/**
+ * Free resources. The pool must have been stopped before.
+ */
+void mon_free(struct ev_carry_mon *mon)
+{
+	struct mon_job *job;
+
+	while ((job = mon->done)) {
+		mon->done = job->next;
+		mon_job_free(job);
+	}
+
+	event_free(mon->ev_done);
+	pthread_mutex_destroy(&mon->done_lock);
+	mon_state_destroy(&mon->state);
+}
 
 /**
  * Initialize the subsystem to raise alarms if e.g. the EsNo threshold
@@ -10,12 +101,15 @@ static void *worker_thread(void *carry);
  * RX / NS index (which is hierarchical, not linear). We just rearrange
  * the hierarchical data into our own linear structures here.
 e*/
-void mon_state_init(struct mon_state *state, struct rx_index *rx_idx)
+static void mon_state_init(struct mon_state *state, struct rx_index *rx_idx)
 {
 	state->total = rx_idx->ns_rx_total;
 	state->curr = 0;
 	state->ns = malloc(state->total * sizeof(struct net_segment *));
 	state->rx_for_ns = malloc(state->total * sizeof(size_t));
+	state->alarm = calloc(state->total, sizeof(struct mon_alarm));
+	for (size_t i = 0; i < state->total; ++i)
+		state->alarm[i].pending = -1;
 
 	// Copy pointers to all the net segments to our ns array
 	int rx1_total, rx2_total;
@@ -47,10 +141,11 @@ void mon_state_init(struct mon_state *state, struct rx_index *rx_idx)
 /**
  * Free memory
  */
-void mon_state_destroy(struct mon_state *state)
+static void mon_state_destroy(struct mon_state *state)
 {
 	free(state->ns);
 	free(state->rx_for_ns);
+	free(state->alarm);
 }
 
 /**
@@ -72,61 +167,326 @@ static int validity_check(int cnt, struct mon_state *state)
 }
 
 /**
- * Helper function to execute alarm shell script
+ * Helper to get the level the EsNo of a NS points to: MON_ALARM below its
+ * threshold, MON_WARN within MON_WARN_MARGIN above it or with any other
+ * flags, else MON_OK. Leaving a level takes MON_HYSTERESIS more, so that
+ * an EsNo on the edge does not flap.
  */
-static void execute_alarm_script(int flags, char *rx, char *ns)
+static int alarm_level(struct mon_alarm *alarm, int flags, double esno,
+                       double threshold)
 {
-	int rv;
-	char *exe_cmd;
+	double hyst_alarm, hyst_warn;
+
+	hyst_alarm = alarm->state == MON_ALARM ? MON_HYSTERESIS : 0;
+	hyst_warn = alarm->state == MON_ALARM || alarm->state == MON_WARN ?
+	            MON_HYSTERESIS : 0;
+
+	if (esno < threshold + hyst_alarm)
+		return MON_ALARM;
+	if (esno < threshold + MON_WARN_MARGIN + hyst_warn ||
+	    (flags & ~(1 << 1)))
+		return MON_WARN;
+	return MON_OK;
+}
 
-	if ((rv = asprintf(&exe_cmd, "./%s '%s' '%s' %d", MON_ALARM_EXE,
-		      rx, ns, flags)) == -1) {
-		fprintf(stderr, "Monitor failed to allocate space for the "
-		                "alarm command string!\n");
+/**
+ * Helper to run the alarm state machine of a NS with the result of a check:
+ *
+ *   OK -> WARN <-> ALARM -> CLEARED -> OK
+ *
+ * A warning or alarm may also follow a clear at once. A new state is only
+ * taken once the checks pointed to it for MON_HOLD_OFF seconds, except for
+ * an 'urgent' warning. Every change is written to the database, and only
+ * an escalation is handed to the dispatcher.
+ */
+static void update_alarm(struct ev_carry_mon *mon, size_t idx, int flags,
+                         double esno, int urgent)
+{
+	struct mon_state *state;
+	struct mon_alarm *alarm;
+	const char *rx_name;
+	int next, from;
+	time_t now;
+
+	state = &mon->state;
+	alarm = &state->alarm[idx];
+	rx_name = state->rx_for_ns[idx] == RX1 ? "RX1" : "RX2";
+	now = vclock_now(mon->clock);
+
+	alarm->flags = flags;
+	next = alarm_level(alarm, flags, esno, state->ns[idx]->alarm);
+	if (next == MON_OK &&
+	    (alarm->state == MON_WARN || alarm->state == MON_ALARM))
+		next = MON_CLEARED;
+
+	if (next == alarm->state) {
+		alarm->pending = -1;
 		return;
+	}
 
+	if (next != alarm->pending) {
+		alarm->pending = next;
+		alarm->pending_ts = now;
 	}
+	if (!(urgent && next == MON_WARN) &&
+	    now - alarm->pending_ts < MON_HOLD_OFF)
+		return;
+
+	from = alarm->state;
+	alarm->state = next;
+	alarm->since_ts = now;
+	alarm->pending = -1;
+
+	printf("Alarm state of %s on %s: %s -> %s.\n", state->ns[idx]->name,
+	       rx_name, state_names[from], state_names[next]);
+	db_insert_alarm(mon->dbt_alarms, state->rx_for_ns[idx],
+	                state->ns[idx]->name, now, state_names[from],
+	                state_names[next], esno, state->ns[idx]->alarm, flags);
 
-	if ((rv = system(exe_cmd)) != 0) {
-		fprintf(stderr, "Error while executing alarm script! "
-				"Command <%s> returned %d!\n", exe_cmd, rv);
+	if (next == MON_ALARM || (next == MON_WARN && from != MON_ALARM))
+		alarm_dispatch(mon->alarms, rx_name, state->ns[idx]->name, flags);
+}
+
+/**
+ * Escalate a NS at once for detections of its trend detectors (TREND_*
+ * bits), on top of what the last check found
+ */
+void mon_trend_detected(struct ev_carry_mon *mon, size_t rx, size_t ns,
+                        int flags)
+{
+	struct mon_state *state;
+	size_t idx = ns;
+
+	state = &mon->state;
+	if (!mon->seeded)
+		return;
+
+	// RX2 follows RX1 in the monitor state
+	if (rx == RX2)
+		idx += mon->rx_idx->ns_idx[RX1].total;
+
+	update_alarm(mon, idx, state->alarm[idx].flags | flags,
+	             esno_window_avg(&state->ns[idx]->window), 1);
+}
+
+/**
+ * Run a job on a pool worker. The NS of the monitor state must not be read
+ * here, their windows are changed by the event loop meanwhile.
+ */
+void mon_job_run(struct mon_job *job, mongoc_client_t *client)
+{
+	switch (job->type) {
+	case MON_JOB_SEED:
+		seed_windows(job, client);
+		break;
 	}
+}
 
-	free(exe_cmd);
+/**
+ * Hand a finished job back to the event loop of its monitor. Called by the
+ * pool workers.
+ */
+void mon_job_complete(struct mon_job *job)
+{
+	struct ev_carry_mon *mon = job->mon;
+
+	pthread_mutex_lock(&mon->done_lock);
+	job->next = mon->done;
+	mon->done = job;
+	pthread_mutex_unlock(&mon->done_lock);
+
+	event_active(mon->ev_done, EV_READ, 0);
 }
 
 /**
- * Fetch average EsNo + packet count from database, check if everything
- * is in it's designated limits and finally call the alarm script
+ * Free a job
  */
-static void *worker_thread(void *carry)
+void mon_job_free(struct mon_job *job)
 {
+	if (job->windows) {
+		for (size_t i = 0; i < job->mon->state.total; ++i)
+			esno_window_free(&job->windows[i]);
+		free(job->windows);
+	}
+	free(job->names);
+	free(job->alarms);
+	free(job);
+}
+
+/**
+ * Load the EsNo windows and the latest alarm states of all NS of the
+ * monitor from the database, in one request each. They are merged into the
+ * live state by the event loop.
+ */
+static void seed_windows(struct mon_job *job, mongoc_client_t *client)
+{
+	struct mon_state *state;
 	mongoc_collection_t *dbc;
+	int64_t start_ns;
+
+	state = &job->mon->state;
+	if (!(job->alarms = calloc(state->total, sizeof(struct mon_alarm)))) {
+		fprintf(stderr, "Monitor failed to allocate alarm states!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t i = 0; i < state->total; ++i)
+		job->alarms[i].state = -1;
+
+	dbc = db_connect(client, job->mon->db_name, COLLECTION_NAME_ALARMS);
+	db_create_alarm_index(dbc);
+	if (!db_get_alarm_states(dbc, seed_alarm, job)) {
+		fprintf(stderr, "EsNo monitor: Could not load alarm states "
+		        "of %s!\n", job->mon->db_name);
+	}
+	db_disconnect(dbc);
+
+	dbc = db_connect(client, job->mon->db_name, COLLECTION_NAME_SDD);
+	db_create_sdd_index(dbc);
+
+	start_ns = latency_now_ns();
+	if (!db_get_esno_windows(dbc, job->ts - MON_OBSERVATION_TIME,
+	                         seed_lookup, job)) {
+		fprintf(stderr, "EsNo monitor: Could not load recent values "
+		        "of %s!\n", job->mon->db_name);
+	}
+	latency_hist_add_shared(&job->mon->pool->query_latency,
+	                        latency_now_ns() - start_ns);
+
+	db_disconnect(dbc);
+}
+
+/**
+ * Helper to find the window of [rx, ns] in a seed job
+ *
+ * @return The window, or NULL if the NS is not monitored
+ */
+static struct esno_window *seed_lookup(void *carry, const char *rx_name,
+                                       const char *ns_name)
+{
+	struct mon_job *job;
+	size_t idx;
+
+	job = (struct mon_job *)carry;
+
+	if (!find_ns(job, rx_name, ns_name, &idx))
+		return NULL;
+
+	return &job->windows[idx];
+}
+
+/**
+ * Helper to take the latest stored alarm state of [rx, ns] in a seed job.
+ * Unknown NS and states are skipped.
+ */
+static void seed_alarm(void *carry, const char *rx_name, const char *ns_name,
+                       const char *state_name, time_t ts)
+{
+	struct mon_job *job;
+	size_t idx;
+
+	job = (struct mon_job *)carry;
+
+	if (!find_ns(job, rx_name, ns_name, &idx))
+		return;
+
+	for (int i = MON_OK; i <= MON_CLEARED; ++i) {
+		if (strcmp(state_name, state_names[i]) == 0) {
+			job->alarms[idx].state = i;
+			job->alarms[idx].since_ts = ts;
+			return;
+		}
+	}
+}
+
+/**
+ * Helper to find the index of [rx, ns] in the monitor state, by the names
+ * taken for a seed job
+ *
+ * @return 1 if found, 0 if the NS is not monitored
+ */
+static int find_ns(struct mon_job *job, const char *rx_name,
+                   const char *ns_name, size_t *idx)
+{
+	struct mon_state *state = &job->mon->state;
+	size_t rx;
+
+	if (strcmp(rx_name, "RX1") == 0)
+		rx = RX1;
+	else if (strcmp(rx_name, "RX2") == 0)
+		rx = RX2;
+	else
+		return 0;
+
+	for (size_t i = 0; i < state->total; ++i) {
+		if (state->rx_for_ns[i] == rx &&
+		    strcmp(job->names[i], ns_name) == 0) {
+			*idx = i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Callback for LibEvent, activated by the pool: Take the finished jobs off
+ * the completion queue and apply their results
+ */
+static void cb_mon_done(evutil_socket_t fd, short events, void *carry)
+{
+	struct ev_carry_mon *mon;
+	struct mon_job *job, *next;
 	struct mon_state *state;
 
-	// Unpack carry
-	dbc = ((struct ev_carry_mon *)carry)->dbc;
-	state = &((struct ev_carry_mon *)carry)->state;
+	mon = (struct ev_carry_mon *)carry;
+	state = &mon->state;
+
+	pthread_mutex_lock(&mon->done_lock);
+	job = mon->done;
+	mon->done = NULL;
+	pthread_mutex_unlock(&mon->done_lock);
+
+	for (; job; job = next) {
+		next = job->next;
+
+		switch (job->type) {
+		case MON_JOB_SEED:
+			for (size_t i = 0; i < state->total; ++i) {
+				esno_window_merge(&state->ns[i]->window,
+				                  &job->windows[i]);
+				if (job->alarms[i].state < 0)
+					continue;
+				state->alarm[i].state = job->alarms[i].state;
+				state->alarm[i].since_ts = job->alarms[i].since_ts;
+			}
+			mon->seeded = 1;
+			break;
+		}
+
+		mon_job_free(job);
+	}
+}
 
+/**
+ * Check if everything is in it's designated limits for one NS, over the
+ * observation time before 'now'. The average EsNo goes to 'esno'.
+ *
+ * @return The flags indicating the observations
+ */
+static int check_ns(struct mon_state *state, size_t idx, time_t now,
+                    double *esno)
+{
 	// Bootstrap: Select target NS
 	struct net_segment *ns;
-	char rx_name[4];
+	ns = state->ns[idx];
 
-	ns = state->ns[state->curr];
-	switch (state->rx_for_ns[state->curr]) {
-	case RX1: strncpy(rx_name, "RX1", 4); break;
-	case RX2: strncpy(rx_name, "RX2", 4); break;
-	}
-
-	// Get recent EsNo averag & entry count from db
-	time_t ts_begin;
+	// Get recent EsNo average & entry count
 	double esno_avg;
 	int doc_count;
-	ts_begin = time(NULL) - MON_OBSERVATION_TIME;
-	if (!db_get_esno_avg(dbc, rx_name, ns->name, ts_begin, &esno_avg, &doc_count)) {
-		fprintf(stderr, "EsNo monitor: Error at database request!\n");
-		exit(EXIT_FAILURE);
-	}
+	esno_window_expire(&ns->window, now);
+	esno_avg = esno_window_avg(&ns->window);
+	doc_count = (int)ns->window.count;
 
 	// Perform validity check
 	unsigned char flag_validity_check;
@@ -149,54 +509,51 @@ static void *worker_thread(void *carry)
 		flag_esno_threshold = 1 << 1;
 	}
 
-	// Call the script. The flags will indicate the observations
-	int flags;
-
-	flags = flag_validity_check + flag_esno_threshold;
-	execute_alarm_script(flags, rx_name, ns->name);
-
-	if (flags != 0) {
-		printf("Alarm raised for %s on %s!\n", ns->name, rx_name);
-	}
+	// Lasting detections of the trend detectors
+	int flag_trend;
+	flag_trend = ns->trend.flags;
 
-	// Finalize: Adapt monitor state etc
-	state->curr = (state->curr + 1) % state->total;
+	*esno = esno_avg;
 
-	pthread_exit(NULL);
+	return flag_validity_check + flag_esno_threshold + flag_trend;
 }
 
 /**
  * Callback for LibEvent timer: Periodically check for long-term EsNo
- * degradation in a round-robin fashion. Spawn a thread to do the work
- * as it may consume enough time to disturb the other event callbacks.
+ * degradation, either for every NS or for one NS in a round-robin fashion
+ * (MON_CHECK_ALL). The observations are taken from memory, and the alarms
+ * are delivered asynchronously, so this does not disturb the other event
+ * callbacks.
  */
 void cb_esno_degradation_monitor(evutil_socket_t fd, short events, void *carry)
 {
-	pthread_t thread;
-	pthread_attr_t attr;
-	int rc;
-	void *status;
+	struct ev_carry_mon *mon;
+	struct mon_state *state;
+	size_t count;
+	time_t now;
+	int64_t start_ns;
+	double esno;
+	int flags;
 
-	// Start worker thread
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+	mon = (struct ev_carry_mon *)carry;
+	state = &mon->state;
 
-	rc = pthread_create(&thread, NULL, worker_thread, carry);
-	if (rc) {
-		fprintf(stderr, "Error spawning thread. Code: %d.\n", rc);
-		exit(EXIT_FAILURE);
+	if (!mon->seeded) {
+		printf("EsNo monitor: Still loading recent values, "
+		       "skipping check.\n");
+		return;
 	}
 
-	pthread_attr_destroy(&attr);
+	start_ns = latency_now_ns();
+	now = vclock_now(mon->clock);
+	count = MON_CHECK_ALL ? state->total : 1;
+	for (size_t i = 0; i < count; ++i) {
+		flags = check_ns(state, state->curr, now, &esno);
+		update_alarm(mon, state->curr, flags, esno, 0);
 
-	// Join the thread when it's done
-	rc = pthread_join(thread, &status);
-	if (rc) {
-		fprintf(stderr, "Error return code from thread: %d.\n", rc);
-		exit(EXIT_FAILURE);
-	}
-	if (status != 0) {
-		fprintf(stderr, "Thread joined with status %ld.\n",
-		                (long)status);
+		// Finalize: Adapt monitor state etc
+		state->curr = (state->curr + 1) % state->total;
 	}
+
+	latency_record_since(LAT_MON_CHECK, start_ns);
 }
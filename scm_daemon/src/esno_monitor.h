@@ -3,23 +3,69 @@
 
 #include "common.h"
 
+struct mon_pool;  // Needs forward declaration
+struct mon_job;
+struct alarm_dispatcher;
+
+enum { MON_JOB_SEED = 0 };
+
+// Alarm states of a NS
+enum { MON_OK = 0, MON_WARN = 1, MON_ALARM = 2, MON_CLEARED = 3 };
+
+// Alarm state machine of a NS
+struct mon_alarm {
+	int state;  // MON_*
+	int flags;  // Of the last check
+	time_t since_ts;  // Of the current state
+	int pending;  // State the checks point to, -1 if none
+	time_t pending_ts;  // Since when they do
+};
+
 // State holder for the monitor
 struct mon_state {
 	size_t total;
 	size_t curr;
 	struct net_segment **ns;
 	size_t *rx_for_ns;
+	struct mon_alarm *alarm;  // Of each NS
 };
 
 // Carry for LibEvent callback
 struct ev_carry_mon {
-	mongoc_collection_t *dbc;
 	struct rx_index *rx_idx;
+	struct vclock *clock;
 	struct mon_state state;
+	struct mon_pool *pool;
+	struct alarm_dispatcher *alarms;
+	struct db_target *dbt_alarms;  // Gets the state changes
+	char db_name[96];
+	unsigned char seeded;  // EsNo windows have been loaded
+	struct event *ev_done;
+	pthread_mutex_t done_lock;
+	struct mon_job *done;  // Completion queue, filled by the pool
+};
+
+// Work for the monitor pool
+struct mon_job {
+	int type;
+	struct ev_carry_mon *mon;
+	struct mon_job *next;
+	time_t ts;  // Submission time
+	const char **names;  // Of each NS of the monitor state
+	struct esno_window *windows;  // One for each NS, sized like the live one
+	struct mon_alarm *alarms;  // Latest stored states, MON_* or -1 if none
 };
 
-void mon_state_init(struct mon_state *state, struct rx_index *rx_idx);
-void mon_state_destroy(struct mon_state *state);
+void mon_init(struct ev_carry_mon *mon, struct event_base *evbase,
+              struct vclock *clock, struct rx_index *rx_idx, struct mon_pool *pool,
+              struct alarm_dispatcher *alarms, struct db_target *dbt_alarms,
+              const char *db_name);
+void mon_free(struct ev_carry_mon *mon);
+void mon_trend_detected(struct ev_carry_mon *mon, size_t rx, size_t ns,
+                        int flags);
+void mon_job_run(struct mon_job *job, mongoc_client_t *client);
+void mon_job_complete(struct mon_job *job);
+void mon_job_free(struct mon_job *job);
 void cb_esno_degradation_monitor(evutil_socket_t fd, short events, void *carry);
 
 #endif // ESNO_MONITOR_H
@@ -0,0 +1,203 @@
+#include "esno_trend.h"
+#include "common.h"
+#include <math.h>
+
+static int detect_shift(struct esno_trend *t, double z, double alpha);
+
+/**
+ * Feed the detectors of a NS with the EsNo of a valid slice, in time
+ * order. Three detectors watch for degradation long before the average
+ * crosses the alarm threshold:
+ *
+ * - EWMA baselines: The fast one drops TREND_DRIFT_DB below the slow one.
+ * - Slope: A least squares fit, whose weights decay with TREND_SLOPE_TAU,
+ *   declines faster than TREND_SLOPE_LIMIT dB per day.
+ * - CUSUM: The deviations from the slow baseline add up to TREND_CUSUM_H
+ *   standard deviations, i.e. the EsNo shifted. The baseline moves on to
+ *   the new level then.
+ *
+ * Nothing is detected within TREND_WARMUP seconds of the first slice.
+ *
+ * @return The detections which are new with this slice, as TREND_* bits
+ */
+int esno_trend_push(struct esno_trend *t, time_t ts, double esno)
+{
+	double dt, d, alpha, decay, z, denom;
+	int flags, before;
+
+	if (!t->first_ts) {
+		memset(t, 0, sizeof(struct esno_trend));
+		t->first_ts = ts;
+		t->last_ts = ts;
+		t->fast = esno;
+		t->slow = esno;
+		t->sw = 1;
+		t->sy = esno;
+		return 0;
+	}
+
+	dt = ts > t->last_ts ? ts - t->last_ts : 0;
+	t->last_ts = ts;
+
+	// Standardized deviation, before the slice moves the baseline
+	z = (esno - t->slow) / esno_trend_stddev(t);
+
+	// Baselines and the variance around the slow one, weighted by the
+	// time since the last slice, as the slices of a NS are irregular.
+	// The slow one is corrected for its start like the variance, so that
+	// it does not stick to the first slices.
+	t->fast += (1 - exp(-dt / TREND_FAST_TAU)) * (esno - t->fast);
+	d = esno - t->slow;
+	alpha = 1 - exp(-dt / TREND_SLOW_TAU);
+	t->slow_weight += alpha * (1 - t->slow_weight);
+	if (t->slow_weight > 0)
+		t->slow += alpha / t->slow_weight * d;
+	t->var += alpha * (d * d - t->var);
+	t->var_weight += alpha * (1 - t->var_weight);
+
+	// Slope: Discount the sums and shift their time axis to the new
+	// slice, which is at x = 0
+	decay = exp(-dt / TREND_SLOPE_TAU);
+	d = dt / 86400.0;
+	t->sw *= decay;
+	t->sx *= decay;
+	t->sy *= decay;
+	t->sxx *= decay;
+	t->sxy *= decay;
+	t->sxx -= 2 * d * t->sx - d * d * t->sw;
+	t->sxy -= d * t->sy;
+	t->sx -= d * t->sw;
+	t->sw += 1;
+	t->sy += esno;
+	denom = t->sw * t->sxx - t->sx * t->sx;
+	t->slope = denom > 0 ? (t->sw * t->sxy - t->sx * t->sy) / denom : 0;
+
+	if (ts - t->first_ts < TREND_WARMUP)
+		return 0;
+
+	// The lasting detections, with some hysteresis
+	before = t->flags;
+	if (t->fast < t->slow - TREND_DRIFT_DB)
+		t->flags |= TREND_DRIFT;
+	else if (t->fast > t->slow - TREND_DRIFT_DB / 2)
+		t->flags &= ~TREND_DRIFT;
+	if (t->slope < -TREND_SLOPE_LIMIT)
+		t->flags |= TREND_SLOPE;
+	else if (t->slope > -TREND_SLOPE_LIMIT / 2)
+		t->flags &= ~TREND_SLOPE;
+
+	flags = t->flags & ~before;
+	flags |= detect_shift(t, z, alpha);
+
+	return flags;
+}
+
+/**
+ * Name of a detection, as stored in the events
+ */
+const char *esno_trend_name(int flag)
+{
+	switch (flag) {
+	case TREND_DRIFT: return "drift";
+	case TREND_SLOPE: return "slope";
+	case TREND_SHIFT_DOWN: return "shift_down";
+	case TREND_SHIFT_UP: return "shift_up";
+	}
+	return "unknown";
+}
+
+/**
+ * Standard deviation of the slices around the slow baseline, but not below
+ * TREND_SIGMA_MIN, the resolution of the slices being 0.1 dB. The variance
+ * is divided by its weight, as it starts out at 0.
+ */
+double esno_trend_stddev(struct esno_trend *t)
+{
+	double s;
+
+	s = t->var_weight > 0 ? sqrt(t->var / t->var_weight) : 0;
+
+	return s > TREND_SIGMA_MIN ? s : TREND_SIGMA_MIN;
+}
+
+/**
+ * Helper for the CUSUM detector: Add the standardized deviation 'z' of a
+ * slice, after a slow baseline update by 'alpha'. On a shift, the slow
+ * baseline moves towards the new level and both sums start over, so that
+ * a shift is detected only once. The move leaves out the allowance, as a
+ * sum which just crossed the threshold overstates the shift, and a move
+ * too far would be detected as a shift back.
+ *
+ * @return TREND_SHIFT_DOWN, TREND_SHIFT_UP or 0
+ */
+static int detect_shift(struct esno_trend *t, double z, double alpha)
+{
+	double s = esno_trend_stddev(t);
+	unsigned int n;
+	int shift;
+
+	t->cusum_lo = fmax(0, t->cusum_lo - z - TREND_CUSUM_K);
+	t->cusum_lo_n = t->cusum_lo > 0 ? t->cusum_lo_n + 1 : 0;
+	t->cusum_hi = fmax(0, t->cusum_hi + z - TREND_CUSUM_K);
+	t->cusum_hi_n = t->cusum_hi > 0 ? t->cusum_hi_n + 1 : 0;
+
+	if (t->cusum_lo > TREND_CUSUM_H) {
+		t->slow -= s * t->cusum_lo / t->cusum_lo_n;
+		n = t->cusum_lo_n;
+		shift = TREND_SHIFT_DOWN;
+	} else if (t->cusum_hi > TREND_CUSUM_H) {
+		t->slow += s * t->cusum_hi / t->cusum_hi_n;
+		n = t->cusum_hi_n;
+		shift = TREND_SHIFT_UP;
+	} else {
+		return 0;
+	}
+
+	// The new level is only known from the slices since the change, so
+	// the following ones may still correct it quickly
+	t->slow_weight = fmin(t->slow_weight, n * alpha);
+	t->fast = t->slow;
+	t->cusum_lo = 0;
+	t->cusum_lo_n = 0;
+	t->cusum_hi = 0;
+	t->cusum_hi_n = 0;
+
+	return shift;
+}
+
+/**
+ * Write the detectors of all network segments with slices to the database,
+ * replacing the ones written before
+ */
+void esno_trend_save(struct rx_index *rx_idx, struct db_target *dbt)
+{
+	for (size_t rx = 0; rx < 2; ++rx) {
+		struct ns_index *ns_idx = &rx_idx->ns_idx[rx];
+
+		for (size_t ns = 0; ns < ns_idx->total; ++ns) {
+			struct net_segment *this_ns = &ns_idx->ns[ns];
+
+			if (!this_ns->trend.first_ts)
+				continue;
+			db_upsert_trend(dbt, rx, this_ns->name, &this_ns->trend);
+		}
+	}
+}
+
+/**
+ * Load the detectors of all network segments from the database, so that a
+ * restart neither loses the baselines nor starts the warm-up over
+ */
+void esno_trend_seed(struct rx_index *rx_idx, mongoc_collection_t *dbc)
+{
+	for (size_t rx = 0; rx < 2; ++rx) {
+		struct ns_index *ns_idx = &rx_idx->ns_idx[rx];
+
+		for (size_t ns = 0; ns < ns_idx->total; ++ns) {
+			struct net_segment *this_ns = &ns_idx->ns[ns];
+
+			if (!db_get_trend(dbc, rx, this_ns->name, &this_ns->trend))
+				memset(&this_ns->trend, 0, sizeof(this_ns->trend));
+		}
+	}
+}
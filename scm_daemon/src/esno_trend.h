@@ -0,0 +1,44 @@
+#ifndef ESNO_TREND_H
+#define ESNO_TREND_H
+
+// Leaf header without common.h, as the network segments embed the detectors
+#include <time.h>
+#include <mongoc.h>
+
+struct db_target;  // Needs forward declaration
+struct rx_index;
+
+// Detections, as bits which can be ORed into the alarm flags of the monitor
+enum {
+	TREND_DRIFT = 1 << 2,  // Fast baseline well below the slow one
+	TREND_SLOPE = 1 << 3,  // EsNo declining faster than TREND_SLOPE_LIMIT
+	TREND_SHIFT_DOWN = 1 << 4,  // Change point to a lower EsNo
+	TREND_SHIFT_UP = 1 << 5,  // Change point to a higher EsNo
+};
+
+// The detectors of one NS. Each slice updates them in O(1).
+struct esno_trend {
+	time_t first_ts;
+	time_t last_ts;
+	double fast;  // EWMA baseline over TREND_FAST_TAU
+	double slow;  // EWMA baseline over TREND_SLOW_TAU
+	double slow_weight;  // Weight of the slices in 'slow', to correct its start
+	double var;  // EWMA variance around the slow baseline
+	double var_weight;  // Weight of the slices in 'var', to correct its start
+	// Discounted sums for the slope, x in days relative to the last slice
+	double sw, sx, sy, sxx, sxy;
+	double slope;  // dB per day
+	double cusum_lo;  // Evidence for a shift down, in standard deviations
+	double cusum_hi;  // Evidence for a shift up, ditto
+	unsigned int cusum_lo_n;  // Slices since cusum_lo was last zero
+	unsigned int cusum_hi_n;  // Slices since cusum_hi was last zero
+	int flags;  // TREND_DRIFT and TREND_SLOPE, while they last
+};
+
+int esno_trend_push(struct esno_trend *t, time_t ts, double esno);
+double esno_trend_stddev(struct esno_trend *t);
+const char *esno_trend_name(int flag);
+void esno_trend_save(struct rx_index *rx_idx, struct db_target *dbt);
+void esno_trend_seed(struct rx_index *rx_idx, mongoc_collection_t *dbc);
+
+#endif // ESNO_TREND_H
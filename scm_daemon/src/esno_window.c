@@ -0,0 +1,123 @@
+#include "esno_window.h"
+#include "common.h"
+
+/**
+ * Allocate a window for 'size' slices over 'span' seconds. The window grows
+ * if more slices fall into the span.
+ */
+void esno_window_init(struct esno_window *w, size_t size, time_t span)
+{
+	w->size = size;
+	w->head = 0;
+	w->count = 0;
+	w->span = span;
+	w->sum = 0;
+
+	if (!(w->samples = malloc(size * sizeof(struct esno_sample)))) {
+		fprintf(stderr, "Failed to allocate EsNo window!\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Free memory
+ */
+void esno_window_free(struct esno_window *w)
+{
+	free(w->samples);
+}
+
+/**
+ * Helper to get the oldest sample. The window must not be empty.
+ */
+static inline struct esno_sample *oldest(struct esno_window *w)
+{
+	return &w->samples[(w->head + w->size - w->count) % w->size];
+}
+
+/**
+ * Drop all slices which are older than the span of the window
+ */
+void esno_window_expire(struct esno_window *w, time_t now)
+{
+	while (w->count > 0 && oldest(w)->ts <= now - w->span) {
+		w->sum -= oldest(w)->esno;
+		--w->count;
+	}
+
+	if (w->count == 0)
+		w->sum = 0;
+}
+
+/**
+ * Double the size of a full window. The ring is unrolled, so the oldest
+ * sample lands in the first slot.
+ */
+static void grow(struct esno_window *w)
+{
+	struct esno_sample *samples;
+	size_t tail = w->size - w->head;
+
+	if (!(samples = malloc(2 * w->size * sizeof(struct esno_sample)))) {
+		fprintf(stderr, "Failed to grow EsNo window!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(samples, &w->samples[w->head], tail * sizeof(struct esno_sample));
+	memcpy(&samples[tail], w->samples, w->head * sizeof(struct esno_sample));
+
+	free(w->samples);
+	w->samples = samples;
+	w->head = w->size;
+	w->size *= 2;
+}
+
+/**
+ * Add the result of a slice. Slices only leave the window by age, short
+ * void slices make it grow instead.
+ */
+void esno_window_push(struct esno_window *w, time_t ts, double esno)
+{
+	esno_window_expire(w, ts);
+
+	if (w->count == w->size)
+		grow(w);
+
+	w->samples[w->head].ts = ts;
+	w->samples[w->head].esno = esno;
+	w->head = (w->head + 1) % w->size;
+	w->sum += esno;
+	++w->count;
+
+	// Recalculate the sum once per round, so rounding errors can't pile up
+	if (w->head == 0) {
+		w->sum = 0;
+		for (size_t i = w->size - w->count; i < w->size; ++i)
+			w->sum += w->samples[i].esno;
+	}
+}
+
+/**
+ * Merge the slices of 'older', e.g. loaded from the database, into the
+ * window. Only slices which precede the oldest slice of the window are
+ * taken. 'older' is consumed and must only be freed afterwards.
+ */
+void esno_window_merge(struct esno_window *w, struct esno_window *older)
+{
+	struct esno_sample *s;
+	time_t newest;
+
+	newest = older->count ? older->samples[(older->head + older->size - 1)
+	                                       % older->size].ts : 0;
+
+	// Append the live slices to the older ones and take over the result
+	for (size_t i = w->count; i > 0; --i) {
+		s = &w->samples[(w->head + w->size - i) % w->size];
+		if (s->ts > newest)
+			esno_window_push(older, s->ts, s->esno);
+	}
+
+	free(w->samples);
+	*w = *older;
+	older->samples = NULL;
+}
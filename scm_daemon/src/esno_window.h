@@ -0,0 +1,40 @@
+#ifndef ESNO_WINDOW_H
+#define ESNO_WINDOW_H
+
+// Leaf header without common.h, as the network segments embed the window
+#include <stddef.h>
+#include <time.h>
+
+// One flushed slice
+struct esno_sample {
+	time_t ts;
+	double esno;
+};
+
+// Ring of the slices of one NS within the last 'span' seconds
+struct esno_window {
+	size_t size;
+	size_t head;  // Next slot to write
+	size_t count;
+	time_t span;
+	double sum;
+	struct esno_sample *samples;
+};
+
+void esno_window_init(struct esno_window *w, size_t size, time_t span);
+void esno_window_free(struct esno_window *w);
+void esno_window_push(struct esno_window *w, time_t ts, double esno);
+void esno_window_expire(struct esno_window *w, time_t now);
+void esno_window_merge(struct esno_window *w, struct esno_window *older);
+
+/**
+ * Average EsNo of the slices in the window
+ *
+ * @return The average, 0 if the window is empty
+ */
+static inline double esno_window_avg(struct esno_window *w)
+{
+	return w->count ? w->sum / w->count : 0;
+}
+
+#endif // ESNO_WINDOW_H
@@ -0,0 +1,434 @@
+#include "fleet.h"
+#include "recorder.h"
+
+static int parse_fleet_config_file(struct fleet *fleet, const char *filename);
+static int compare_devices(const void *a, const void *b);
+static int compare_device_addr(const void *key, const void *dev);
+static struct tc1_device *fleet_lookup(struct fleet *fleet,
+                                       struct sockaddr_storage *sas);
+static void cb_fleet_inbox(evutil_socket_t fd, short events, void *carry);
+static void cb_fleet_tick(evutil_socket_t fd, short events, void *carry);
+static void *worker_thread(void *carry);
+
+/**
+ * Initialize fleet mode: Parse the device list, and distribute the devices
+ * over the worker threads. Every worker gets its own event base, database
+ * client and writer, so that no state is shared between the workers. The
+ * only thing in common is the receiving thread, which hands the datagrams
+ * over through each worker's inbox.
+ */
+void fleet_init(struct fleet *fleet, const char *config_file,
+                struct mon_pool *mon_pool, struct alarm_dispatcher *alarms)
+{
+	fleet->dev_total = 0;
+	fleet->devs = NULL;
+	fleet->unknown = 0;
+
+	if (parse_fleet_config_file(fleet, config_file) < 1) {
+		fprintf(stderr, "Fleet: No devices have been configured!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Sort by address, so the receiving thread can look devices up quickly
+	qsort(fleet->devs, fleet->dev_total, sizeof(struct tc1_device),
+	      compare_devices);
+	for (size_t i = 1; i < fleet->dev_total; ++i) {
+		if (compare_devices(&fleet->devs[i - 1], &fleet->devs[i]) == 0) {
+			fprintf(stderr, "Fleet: %s and %s have the same IP!\n",
+			        fleet->devs[i - 1].name, fleet->devs[i].name);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Set up the workers
+	fleet->worker_total = FLEET_WORKERS;
+	if (fleet->worker_total > fleet->dev_total)
+		fleet->worker_total = fleet->dev_total;
+	fleet->workers = calloc(fleet->worker_total, sizeof(struct fleet_worker));
+	fleet->wake = calloc(fleet->worker_total, sizeof(unsigned char));
+	if (!fleet->workers || !fleet->wake) {
+		fprintf(stderr, "Fleet: Failed to allocate memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t i = 0; i < fleet->worker_total; ++i) {
+		struct fleet_worker *w = &fleet->workers[i];
+		struct timeval ev_timer_tick = { 1, 0 };
+		char spool_file[256];
+
+		w->evbase = event_base_new();
+		vclock_init_real(&w->clock, w->evbase);
+		w->db_client = db_client_new();
+		snprintf(spool_file, sizeof(spool_file), "%s.%zu", SPOOL_FILE, i);
+		db_writer_init(&w->db_writer, spool_file);
+		w->dropped = 0;
+		w->dev_total = 0;
+		w->devs = NULL;
+		spsc_ring_init(&w->inbox, FLEET_INBOX_SIZE, sizeof(struct fleet_pkt));
+		w->ev_inbox = event_new(w->evbase, -1, 0, cb_fleet_inbox, w);
+		w->ev_tick = event_new(w->evbase, -1, EV_PERSIST, cb_fleet_tick, w);
+		event_add(w->ev_tick, &ev_timer_tick);
+	}
+
+	// Shard the devices round-robin and connect them
+	for (size_t i = 0; i < fleet->dev_total; ++i) {
+		struct tc1_device *dev = &fleet->devs[i];
+		struct fleet_worker *w = &fleet->workers[i % fleet->worker_total];
+
+		++w->dev_total;
+		if (!(w->devs = realloc(w->devs,
+		                        w->dev_total * sizeof(struct tc1_device *)))) {
+			fprintf(stderr, "Fleet: Failed to realloc memory!\n");
+			exit(EXIT_FAILURE);
+		}
+		w->devs[w->dev_total - 1] = dev;
+
+		dev->worker = w;
+		device_init(dev, w->evbase, &w->clock, w->db_client,
+		            &w->db_writer, mon_pool, alarms);
+	}
+
+	printf("Fleet: %zu devices on %zu worker threads.\n",
+	       fleet->dev_total, fleet->worker_total);
+}
+
+/**
+ * Start the worker threads. From now on, a device must only be touched by
+ * its worker.
+ */
+void fleet_start(struct fleet *fleet)
+{
+	int rc;
+
+	for (size_t i = 0; i < fleet->worker_total; ++i) {
+		db_writer_start(&fleet->workers[i].db_writer);
+		rc = pthread_create(&fleet->workers[i].thread, NULL,
+		                    worker_thread, &fleet->workers[i]);
+		if (rc) {
+			fprintf(stderr, "Error spawning thread. Code: %d.\n", rc);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/**
+ * Stop the worker threads and wait for them
+ */
+void fleet_stop(struct fleet *fleet)
+{
+	int rc;
+
+	for (size_t i = 0; i < fleet->worker_total; ++i)
+		event_base_loopbreak(fleet->workers[i].evbase);
+
+	for (size_t i = 0; i < fleet->worker_total; ++i) {
+		rc = pthread_join(fleet->workers[i].thread, NULL);
+		if (rc) {
+			fprintf(stderr, "Error return code from thread: %d.\n", rc);
+			exit(EXIT_FAILURE);
+		}
+		if (fleet->workers[i].dropped > 0) {
+			fprintf(stderr, "Fleet: Worker %zu dropped %zu datagrams.\n",
+			        i, fleet->workers[i].dropped);
+		}
+
+		// Nothing is queued anymore, let the writer finish
+		db_writer_stop(&fleet->workers[i].db_writer);
+	}
+}
+
+/**
+ * Free memory. The workers must have been stopped before.
+ */
+void fleet_free(struct fleet *fleet)
+{
+	for (size_t i = 0; i < fleet->dev_total; ++i)
+		device_free(&fleet->devs[i]);
+
+	for (size_t i = 0; i < fleet->worker_total; ++i) {
+		struct fleet_worker *w = &fleet->workers[i];
+
+		event_free(w->ev_inbox);
+		event_free(w->ev_tick);
+		event_base_free(w->evbase);
+		spsc_ring_free(&w->inbox);
+		db_writer_free(&w->db_writer);
+		db_client_free(w->db_client);
+		free(w->devs);
+	}
+
+	free(fleet->workers);
+	free(fleet->wake);
+	free(fleet->devs);
+}
+
+/**
+ * Callback for LibEvent on the receiving thread when datagrams arrived on
+ * one of the shared sockets. Look up the sending device of each datagram
+ * and copy it into the inbox of the device's worker. The workers are woken
+ * up once per batch.
+ */
+void cb_fleet_recv(evutil_socket_t fd, short events, void *carry)
+{
+	struct fleet *fleet;
+	struct udp_batch *batch;
+	struct flight_recorder *rec;
+	struct vclock *clock;
+	unsigned char type;
+	int min_len;
+	time_t curr_ts, curr_mono;
+	int64_t now_ns;
+	int count;
+
+	// Unpack carry
+	fleet = ((struct ev_carry_fleet_rx *)carry)->fleet;
+	batch = ((struct ev_carry_fleet_rx *)carry)->batch;
+	type = ((struct ev_carry_fleet_rx *)carry)->type;
+	rec = ((struct ev_carry_fleet_rx *)carry)->rec;
+	clock = ((struct ev_carry_fleet_rx *)carry)->clock;
+	min_len = (type == FLEET_PKT_SDD) ? SDD_MIN_LEN : MC_MIN_LEN;
+
+	do {
+		count = get_udp_batch(fd, batch);
+		if (rec && count > 0)
+			recorder_add_batch(rec, (type == FLEET_PKT_SDD) ?
+			                   REC_SDD : REC_MC, batch);
+		curr_ts = vclock_now(clock);
+		curr_mono = vclock_mono(clock);
+		now_ns = vclock_now_ns(clock);
+
+		for (int i = 0; i < count; ++i) {
+			struct tc1_device *dev;
+			struct fleet_worker *w;
+			struct fleet_pkt *pkt;
+			int len;
+
+			len = udp_batch_len(batch, i);
+			if (len < min_len)
+				continue;
+
+			if (!(dev = fleet_lookup(fleet, &batch->addrs[i]))) {
+				++fleet->unknown;
+				continue;
+			}
+
+			w = dev->worker;
+			if (!(pkt = spsc_ring_reserve(&w->inbox))) {
+				++w->dropped;
+				continue;
+			}
+
+			pkt->dev = dev;
+			pkt->ts = curr_ts;
+			pkt->mono = curr_mono;
+			if (!(pkt->ts_ns = udp_batch_ts_ns(batch, i)))
+				pkt->ts_ns = now_ns;
+			pkt->type = type;
+			pkt->len = len;
+			memcpy(pkt->buf, udp_batch_buf(batch, i), len);
+			spsc_ring_commit(&w->inbox);
+
+			fleet->wake[w - fleet->workers] = 1;
+		}
+
+		// Wake up the workers which got new datagrams
+		for (size_t j = 0; j < fleet->worker_total; ++j) {
+			if (!fleet->wake[j])
+				continue;
+			fleet->wake[j] = 0;
+			event_active(fleet->workers[j].ev_inbox, EV_READ, 0);
+		}
+	} while (count == batch->size);
+}
+
+/**
+ * Callback for LibEvent on a worker thread: Hand all the datagrams in the
+ * inbox to the handlers of their devices
+ */
+static void cb_fleet_inbox(evutil_socket_t fd, short events, void *carry)
+{
+	struct fleet_worker *w;
+	struct fleet_pkt *pkt;
+	int64_t start_ns;
+
+	start_ns = latency_now_ns();
+
+	// Unpack carry
+	w = (struct fleet_worker *)carry;
+
+	while ((pkt = spsc_ring_peek(&w->inbox))) {
+		struct tc1_device *dev = pkt->dev;
+
+		if (pkt->type == FLEET_PKT_SDD) {
+			dev->last_sdd_mono = pkt->mono;
+			handle_sdd_msg(&dev->c_sdd, pkt->buf, pkt->ts,
+			               pkt->mono, pkt->ts_ns);
+		} else {
+			handle_mc_msg(&dev->c_mc, pkt->buf, pkt->ts);
+		}
+
+		spsc_ring_release(&w->inbox);
+	}
+
+	latency_record_since(LAT_FLEET_INBOX, start_ns);
+}
+
+/**
+ * Callback for LibEvent timer on a worker thread: As the SDD socket is
+ * shared, the per-device timeout is checked here instead of by LibEvent
+ */
+static void cb_fleet_tick(evutil_socket_t fd, short events, void *carry)
+{
+	struct fleet_worker *w;
+	time_t curr_mono;
+
+	// Unpack carry
+	w = (struct fleet_worker *)carry;
+
+	if (!HANDLE_SDD_MESSAGES)
+		return;
+
+	curr_mono = vclock_mono(&w->clock);
+	for (size_t i = 0; i < w->dev_total; ++i) {
+		struct tc1_device *dev = w->devs[i];
+
+		if (curr_mono - dev->last_sdd_mono < SDD_TIMEOUT)
+			continue;
+
+		handle_sdd_timeout(&dev->c_sdd);
+		dev->last_sdd_mono = curr_mono;
+	}
+}
+
+/**
+ * Worker thread: Run the event loop of the worker's shard
+ */
+static void *worker_thread(void *carry)
+{
+	struct fleet_worker *w;
+
+	// Unpack carry
+	w = (struct fleet_worker *)carry;
+
+	event_base_dispatch(w->evbase);
+
+	pthread_exit(NULL);
+}
+
+/**
+ * Helper to order the devices by address
+ */
+static int compare_devices(const void *a, const void *b)
+{
+	return memcmp(&((const struct tc1_device *)a)->addr,
+	              &((const struct tc1_device *)b)->addr,
+	              sizeof(struct in6_addr));
+}
+
+/**
+ * Helper to compare an address with the one of a device, for bsearch
+ */
+static int compare_device_addr(const void *key, const void *dev)
+{
+	return memcmp(key, &((const struct tc1_device *)dev)->addr,
+	              sizeof(struct in6_addr));
+}
+
+/**
+ * Find the device which sent a datagram
+ *
+ * @return The device, or NULL if the sender is not configured
+ */
+static struct tc1_device *fleet_lookup(struct fleet *fleet,
+                                       struct sockaddr_storage *sas)
+{
+	struct in6_addr key;
+
+	device_addr_key(sas, &key);
+
+	return bsearch(&key, fleet->devs, fleet->dev_total,
+	               sizeof(struct tc1_device), compare_device_addr);
+}
+
+/**
+ * Parser for the fleet config file. Each device gets its own database,
+ * named after the device.
+ *
+ * @return Number of added devices
+ */
+static int parse_fleet_config_file(struct fleet *fleet, const char *filename)
+{
+	FILE *file;
+	int count;
+	char *name;
+	char *ip_addr;
+	char *ns_config;
+	char *line;
+	char db_name[96];
+
+	if (!(file = fopen(filename, "r"))) {
+		perror("Could not open fleet config file");
+		exit(EXIT_FAILURE);
+	}
+
+	const int linebuf_len = 1000 * sizeof(char);
+	char * const linebuf = malloc(linebuf_len);
+
+	count = 0;
+	while (fgets(linebuf, linebuf_len, file)) {
+		line = string_trim(linebuf);
+
+		// Ignore comment lines
+		if (strchr("#\n", *line) != NULL)
+			continue;
+
+		if (sscanf(line, " %m[^,\n] , %m[^,\n] , %m[^,\n] \n",
+		           &name, &ip_addr, &ns_config) != 3) {
+			fprintf(stderr, "Erroneous line in fleet config file!\n"
+			                "'%s'\n", line);
+			exit(EXIT_FAILURE);
+		}
+
+		// Trim trailing space
+		name = string_trim(name);
+		ip_addr = string_trim(ip_addr);
+		ns_config = string_trim(ns_config);
+
+		// The name ends up in the database name, so keep it simple
+		if (is_empty_string(name) || strlen(name) > 63 ||
+		    strspn(name, "abcdefghijklmnopqrstuvwxyz"
+		                 "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+		                 "0123456789_-") != strlen(name)) {
+			fprintf(stderr, "Fleet: Invalid device name '%s'!\n", name);
+			exit(EXIT_FAILURE);
+		}
+
+		// Add device
+		++fleet->dev_total;
+		if (!(fleet->devs = realloc(fleet->devs, fleet->dev_total *
+		                            sizeof(struct tc1_device)))) {
+			fprintf(stderr, "Failed to realloc memory for fleet!\n");
+			exit(EXIT_FAILURE);
+		}
+		snprintf(db_name, sizeof(db_name), "%s_%s", DB_NAME, name);
+		device_setup(&fleet->devs[fleet->dev_total - 1], name, ip_addr,
+		             ns_config, db_name);
+		++count;
+
+		// Print parsed config
+		printf("Fleet: Added '%s' at '%s' with config '%s' "
+		       "(database '%s').\n", name, ip_addr, ns_config, db_name);
+
+		// Free buffers, allocated by sscanf
+		free(name);
+		free(ip_addr);
+		free(ns_config);
+	}
+
+	printf("Fleet: Parsing done, added %d devices.\n", count);
+
+	free(linebuf);
+	fclose(file);
+
+	return count;
+}
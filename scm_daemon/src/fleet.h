@@ -0,0 +1,61 @@
+#ifndef FLEET_H
+#define FLEET_H
+
+#include "device.h"
+#include "spsc_ring.h"
+
+enum { FLEET_PKT_SDD = 0, FLEET_PKT_MC = 1 };
+
+// A datagram handed over from the receiving thread to a worker
+struct fleet_pkt {
+	struct tc1_device *dev;
+	time_t ts;
+	time_t mono;  // Of the receiving thread's clock, for the slice times
+	int64_t ts_ns;  // Kernel time stamp, for the lock times
+	unsigned char type;
+	unsigned short len;
+	unsigned char buf[MC_BUFSIZ];
+};
+
+// One worker thread with its own event base, driving a shard of the devices
+struct fleet_worker {
+	pthread_t thread;
+	struct event_base *evbase;
+	struct vclock clock;  // Of the devices on this worker
+	mongoc_client_t *db_client;
+	struct db_writer db_writer;
+	struct spsc_ring inbox;  // Filled by the receiving thread only
+	struct event *ev_inbox;
+	struct event *ev_tick;
+	size_t dropped;
+	size_t dev_total;
+	struct tc1_device **devs;
+};
+
+// The 'main' container
+struct fleet {
+	size_t dev_total;
+	struct tc1_device *devs;  // Sorted by address
+	size_t worker_total;
+	struct fleet_worker *workers;
+	unsigned char *wake;  // Workers to notify after a batch
+	size_t unknown;  // Datagrams from unconfigured senders
+};
+
+// Carry for LibEvent callback of the receiving sockets
+struct ev_carry_fleet_rx {
+	struct fleet *fleet;
+	struct udp_batch *batch;
+	struct flight_recorder *rec;  // Records the datagrams, or NULL
+	struct vclock *clock;
+	unsigned char type;
+};
+
+void fleet_init(struct fleet *fleet, const char *config_file,
+                struct mon_pool *mon_pool, struct alarm_dispatcher *alarms);
+void fleet_start(struct fleet *fleet);
+void fleet_stop(struct fleet *fleet);
+void fleet_free(struct fleet *fleet);
+void cb_fleet_recv(evutil_socket_t fd, short events, void *carry);
+
+#endif // FLEET_H
@@ -1,7 +1,6 @@
 #include "handler_mc.h"
+#include "recorder.h"
 
-static inline uint64_t build_uint64(unsigned char *buf);
-static int parse_buf_into_struct(struct mc_accu *accu, unsigned char *buf);
 static inline void print_array(struct mc_accu *accu);
 
 // Map MODCOD numbers to their names (Ref: ETSI 302307-1 V1.4.1, 5.5.2.2)
@@ -18,29 +17,15 @@ const char *modcod_names[32] = {
 };
 
 /**
- * Helper to build a 64-bit unsigned int byte-by-byte
+ * Parse the MODCOD stats UDP message, received at 'ts', and insert data in
+ * our struct
  *
- * @return Resulting uint64_t number
+ * @return 0 for the first message, which has nothing to compare with, else 1
  */
-static inline uint64_t build_uint64(unsigned char *buf)
-{
-	return (((uint64_t) buf[0]) << 7 * 8) +
-	       (((uint64_t) buf[1]) << 6 * 8) +
-	       (((uint64_t) buf[2]) << 5 * 8) +
-	       (((uint64_t) buf[3]) << 4 * 8) +
-	       (((uint64_t) buf[4]) << 3 * 8) +
-	       (((uint64_t) buf[5]) << 2 * 8) +
-	       (((uint64_t) buf[6]) << 1 * 8) +
-	       (((uint64_t) buf[7]) << 0 * 8);
-}
-
-/**
- * Parse the MODCOD stats UDP message and insert data in our struct
- */
-static int parse_buf_into_struct(struct mc_accu *accu, unsigned char *buf)
+int parse_buf_into_struct(struct mc_accu *accu, unsigned char *buf, time_t ts)
 {
 	unsigned char is_not_first_measurement = 1;
-	time_t ts, ts_old;
+	time_t ts_old;
 	uint64_t *curr;
 	uint64_t sum, sum_normal, sum_short;
 	uint64_t sum_normal_old, sum_short_old;
@@ -55,9 +40,6 @@ static int parse_buf_into_struct(struct mc_accu *accu, unsigned char *buf)
 	if (curr[0] == 0)
 		is_not_first_measurement = 0;
 
-	// Get current timestamp
-	ts = time(NULL);
-
 	// Process raw buffer and sum up needed data
 	for (int i = 1; i < 29; ++i) {
 		uint64_t this_modcod;
@@ -149,9 +131,9 @@ static inline void print_array(struct mc_accu *accu)
 /**
  * Initialize MODCOD accumulator (i.e. the "state holder")
  */
-void init_mc_accu(struct mc_accu *accu)
+void init_mc_accu(struct mc_accu *accu, time_t now)
 {
-	accu->ts = time(NULL);
+	accu->ts = now;
 	memset(accu->curr, 0, 29 * sizeof(uint64_t));
 	memset(accu->old, 0, 29 * sizeof(uint64_t));
 	memset(accu->diff, 0, 29 * sizeof(uint64_t));
@@ -161,35 +143,48 @@ void init_mc_accu(struct mc_accu *accu)
 }
 
 /**
- * Callback for LibEvent when MODCOD packet has been received. Parse raw buffer
- * and insert into database
+ * Process one MODCOD message: Parse raw buffer and insert into database
  */
-void cb_recv_mc_packet(evutil_socket_t fd, short events, void *carry)
+void handle_mc_msg(struct ev_carry_mc *carry, unsigned char *buf,
+                   time_t curr_ts)
 {
-	static unsigned char buf[MC_BUFSIZ];
-	struct mc_accu *accu;
-	struct sockaddr_storage remote_addr;
-	mongoc_collection_t *dbc;
-	int numbytes;
-
-	// Unpack carry
-	accu = &((struct ev_carry_mc *)carry)->accu;
-	dbc = ((struct ev_carry_mc *)carry)->dbc;
-
-	// Get UDP packet
-	numbytes = get_udp_packet(fd, buf, MC_BUFSIZ, &remote_addr);
-	if (numbytes < 1)
-		return;
-
 	// Fill message into struct
-	if (!parse_buf_into_struct(accu, buf)) {
+	if (!parse_buf_into_struct(&carry->accu, buf, curr_ts))
 		return;
-	}
 
 	// Print values
-	//print_array(accu);
+	//print_array(&carry->accu);
 
 	// Insert into database
-	db_insert_mc(dbc, accu);
+	db_insert_mc(carry->dbt, &carry->accu);
 }
 
+/**
+ * Callback for LibEvent when MODCOD packets have been received. Drain the
+ * socket batch-wise and handle every message
+ */
+void cb_recv_mc_packet(evutil_socket_t fd, short events, void *carry)
+{
+	struct ev_carry_mc *c_mc;
+	struct udp_batch *batch;
+	time_t curr_ts;
+	int count;
+
+	// Unpack carry
+	c_mc = (struct ev_carry_mc *)carry;
+	batch = c_mc->batch;
+
+	do {
+		// Get UDP packets
+		count = get_udp_batch(fd, batch);
+		if (c_mc->rec && count > 0)
+			recorder_add_batch(c_mc->rec, REC_MC, batch);
+		curr_ts = vclock_now(c_mc->clock);
+
+		for (int i = 0; i < count; ++i) {
+			if (udp_batch_len(batch, i) < MC_MIN_LEN)
+				continue;
+			handle_mc_msg(c_mc, udp_batch_buf(batch, i), curr_ts);
+		}
+	} while (count == batch->size);
+}
@@ -3,6 +3,10 @@
 
 #include "common.h"
 
+struct udp_batch;  // Needs forward declaration
+struct db_target;
+struct flight_recorder;
+
 // The MODCOD accumulator, to preserve the state of the function
 struct mc_accu {
 	time_t ts;
@@ -18,10 +22,33 @@ struct mc_accu {
 // Carry for LibEvent callback
 struct ev_carry_mc {
 	struct mc_accu accu;
-	mongoc_collection_t *dbc;
+	struct udp_batch *batch;
+	struct flight_recorder *rec;  // Records the datagrams, or NULL
+	struct vclock *clock;
+	struct db_target *dbt;
 };
 
-void init_mc_accu(struct mc_accu *accu);
+/**
+ * Helper to build a 64-bit unsigned int byte-by-byte
+ *
+ * @return Resulting uint64_t number
+ */
+static inline uint64_t build_uint64(unsigned char *buf)
+{
+	return (((uint64_t) buf[0]) << 7 * 8) +
+	       (((uint64_t) buf[1]) << 6 * 8) +
+	       (((uint64_t) buf[2]) << 5 * 8) +
+	       (((uint64_t) buf[3]) << 4 * 8) +
+	       (((uint64_t) buf[4]) << 3 * 8) +
+	       (((uint64_t) buf[5]) << 2 * 8) +
+	       (((uint64_t) buf[6]) << 1 * 8) +
+	       (((uint64_t) buf[7]) << 0 * 8);
+}
+
+int parse_buf_into_struct(struct mc_accu *accu, unsigned char *buf, time_t ts);
+void init_mc_accu(struct mc_accu *accu, time_t now);
+void handle_mc_msg(struct ev_carry_mc *carry, unsigned char *buf,
+                   time_t curr_ts);
 void cb_recv_mc_packet(evutil_socket_t fd, short events, void *carry);
 
 #endif // HANDLER_MC_H
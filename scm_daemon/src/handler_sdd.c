@@ -1,39 +1,52 @@
 #include "handler_sdd.h"
+#include "recorder.h"
+#include <math.h>
 
-static inline void fill_sdd_struct(struct sdd_msg *s, unsigned char *buf);
 static void check_validity(struct sdd_slice_accumulator *accu, const char *rx_name,
                           const char *ns_name);
-static void flush_accumulator(struct sdd_slice_accumulator *accu,
-                              mongoc_collection_t *dbc, struct rx_index *rx_idx);
+static void flush_accumulator(struct ev_carry_sdd *carry);
+static int dwell_done(struct sdd_slice_accumulator *accu, time_t curr_mono);
+static void cb_retuned(void *arg, int ok);
+static void time_lock(struct ev_carry_sdd *carry, unsigned char *buf,
+                      int64_t rx_ns);
+static void slice_stats(struct sdd_slice_accumulator *accu,
+                        struct sdd_slice_stats *stats);
+static double esno_quantile(struct sdd_slice_accumulator *accu, double q);
+static void report_trend(struct ev_carry_sdd *carry, size_t rx, size_t ns,
+                         double esno, int flags);
 
 /**
  * Initialize / reset the SDD accumulator. Shall be called for each network
  * segment change. The accumulator is a struct that allows the SDD handler to
  * be stateful, carrying information over multiple invocations and thus
- * allowing the calculation of e.g. an average
+ * allowing the calculation of e.g. an average. The new slice starts at
+ * 'now', or 'mono' on the monotonic clock. The accumulator must be zeroed
+ * before it is reset the first time, as only the used part of the histogram
+ * is cleared.
  */
-void reset_sdd_accu(struct sdd_slice_accumulator *accu, size_t rx, size_t ns)
+void reset_sdd_accu(struct sdd_slice_accumulator *accu, size_t rx, size_t ns,
+                    time_t now, time_t mono)
 {
+	if (accu->count > 0)
+		memset(&accu->esno_hist[accu->esno_min], 0,
+		       (accu->esno_max - accu->esno_min + 1) * sizeof(uint32_t));
+
 	accu->rx = rx;
 	accu->ns = ns;
 	accu->esno_sum = 0;
+	accu->esno_min = SDD_ESNO_MAX;
+	accu->esno_max = 0;
+	accu->esno_mean = 0;
+	accu->esno_m2 = 0;
 	accu->count = 0;
 	accu->count_bad = 0;
 	accu->count_total = 0;
 	accu->valid_flag = 1;
-	accu->since_ts = time(NULL);
-}
-
-/**
- * Helper to parse the SDD message. Takes the data from the appropriate offsets
- * and puts it into our message struct.
- */
-static inline void fill_sdd_struct(struct sdd_msg *s, unsigned char *buf)
-{
-	s->esno = (buf[150] << 8) + buf[151];
-	s->demod_locked = (buf[6] >> 4) & 0x1;
-	s->demod_tracked = (buf[6] >> 6) & 0x1;
-	s->lock_definitive = (buf[6] >> 7) & 0x1;
+	accu->retuning = 0;
+	accu->locked = 0;
+	accu->start_mono = mono;
+	accu->since_mono = mono;
+	accu->since_ts = now;
 }
 
 /**
@@ -64,14 +77,21 @@ static void check_validity(struct sdd_slice_accumulator *accu, const char *rx_na
 
 /**
  * Accumulator shall be flushed to database: Check accu validity, call database
- * insert function and proceed to next network segment
+ * insert function and proceed to next network segment. Its slice starts
+ * once the device confirmed the retune, see cb_retuned().
  */
-static void flush_accumulator(struct sdd_slice_accumulator *accu,
-                              mongoc_collection_t *dbc, struct rx_index *rx_idx)
+static void flush_accumulator(struct ev_carry_sdd *carry)
 {
+	struct sdd_slice_accumulator *accu = &carry->accu;
+	struct rx_index *rx_idx = carry->rx_idx;
+	struct net_segment *this_ns;
+	struct sdd_slice_stats stats, *dist;
 	size_t rx, ns;
 	double avg_esno;
 	const char *ns_name;
+	int64_t start_ns, take_ns;
+
+	start_ns = latency_now_ns();
 
 	// Get name of RX and NS
 	rx = accu->rx;
@@ -91,87 +111,410 @@ static void flush_accumulator(struct sdd_slice_accumulator *accu,
 		printf("Packet failed validity check! Setting EsNo to zero.\n");
 	}
 
-	// Calculate average EsNo
-	if (accu->count == 0 || !accu->valid_flag)
+	// Calculate average EsNo and its distribution
+	dist = NULL;
+	if (accu->count == 0 || !accu->valid_flag) {
 		avg_esno = 0;
-	else
+	} else {
 		avg_esno = accu->esno_sum / (accu->count * 10.0);
+		slice_stats(accu, &stats);
+		dist = &stats;
+	}
 
 	// printf("EsNo average for %s on %s of %d values over %d seconds: %f\n\n",
 	//        ns_name, rx_name, accu->count, SDD_TIME_SLICE, avg_esno);
 
 	// Insert into database
-	db_insert_sdd(dbc, rx, ns_name, accu->since_ts, avg_esno);
+	db_insert_sdd(carry->dbt, rx, ns_name, accu->since_ts, avg_esno,
+	              dist);
+
+	this_ns = ns_get(rx_idx, rx, ns);
+	metrics_inc(&this_ns->metrics.slices);
+	if (!accu->valid_flag)
+		metrics_inc(&this_ns->metrics.slices_invalid);
+
+	// Aggregate into the rollups for the web interface and the window
+	// of the degradation monitor
+	rollup_update(this_ns->rollup, carry->dbt_rollup,
+	              rx_name, ns_name, accu->since_ts, avg_esno);
+	esno_window_push(&this_ns->window, accu->since_ts, avg_esno);
+
+	// The trend detectors only get the valid slices
+	if (dist)
+		report_trend(carry, rx, ns, avg_esno,
+		             esno_trend_push(&this_ns->trend, accu->since_ts,
+		                             avg_esno));
 
-	// Proceed to next network segment
-	size_t new_ns = ns_take_next(rx_idx);
-	size_t new_rx = rx_idx->current;
-	reset_sdd_accu(accu, new_rx, new_ns);
+	// A slice without a definitive lock, after a confirmed retune
+	if (carry->lock_pending & (1 << LOCK_DEFINITIVE))
+		++this_ns->lock_missed;
+
+	// Proceed to next network segment. Until the retune is confirmed,
+	// the messages may still be about the old one. The lock bits of the
+	// new one are timed from now on.
+	take_ns = latency_now_ns();
+	accu->retuning = 1;
+	carry->retune_ns = vclock_now_ns(carry->clock);
+	carry->lock_pending = (1 << LOCK_KINDS) - 1;
+	carry->lock_armed = 0;
+	ns_sched_slice_done(rx_idx, rx, ns, avg_esno, dist != NULL);
+	ns_take_next(rx_idx, vclock_mono(carry->clock), cb_retuned, carry);
+	latency_record_since(LAT_NS_TAKE_NEXT, take_ns);
+
+	latency_record_since(LAT_SDD_FLUSH, start_ns);
 }
 
 /**
- * Callback for LibEvent when SDD message is received. Add info to accumulator
- * and flush the accu to the database if needed.
+ * Callback for the retune of flush_accumulator: Start the slice of the new
+ * network segment. If the device did not confirm the retune, the slice is
+ * void, as it is unknown what the messages are about.
  */
-void cb_recv_sdd_packet(evutil_socket_t fd, short events, void *carry)
+static void cb_retuned(void *arg, int ok)
 {
-	static unsigned char buf[SDD_BUFSIZ];
-	struct sockaddr_storage remote_addr;
-	struct sdd_slice_accumulator *accu;
-	struct sdd_msg sdd_msg;
-	mongoc_collection_t *dbc;
+	struct ev_carry_sdd *carry;
 	struct rx_index *rx_idx;
-	int numbytes;
+	size_t rx;
 
 	// Unpack carry
-	accu = &((struct ev_carry_sdd *)carry)->accu;
-	dbc = ((struct ev_carry_sdd *)carry)->dbc;
-	rx_idx = ((struct ev_carry_sdd *)carry)->rx_idx;
+	carry = (struct ev_carry_sdd *)arg;
+	rx_idx = carry->rx_idx;
 
-	// Get UDP packet
-	numbytes = get_udp_packet(fd, buf, SDD_BUFSIZ, &remote_addr);
+	rx = rx_idx->current;
+	++carry->slice_gen;
+	reset_sdd_accu(&carry->accu, rx, rx_idx->ns_idx[rx].current,
+	               vclock_now(carry->clock), vclock_mono(carry->clock));
 
-	// Handle two cases:
-	// 1. Normal: incoming packets are processed
-	// 2. Timeout: No packets during some period of time: "null" EsNo!
-	if (numbytes < 0) {
-		// Flush to database
-		accu->valid_flag = 0;
-		flush_accumulator(accu, dbc, rx_idx);
+	if (!ok) {
+		carry->lock_pending = 0;
+		printf("SDD handler: Retune to %s not confirmed, "
+		       "discarding its slice!\n",
+		       ns_get_name(rx_idx, rx, rx_idx->ns_idx[rx].current));
+		carry->accu.valid_flag = 0;
+	}
+}
 
-	} else {
-		// For stats, count every received packet
-		accu->count_total++;
+/**
+ * Helper to record how long after the retune the lock bits of the message,
+ * received at 'rx_ns', were set, in the histograms of the NS. Only a bit
+ * which has been seen clear since the retune is timed, as a set one may
+ * still be about the old NS. A bit which is set from the start is dropped
+ * untimed.
+ */
+static void time_lock(struct ev_carry_sdd *carry, unsigned char *buf,
+                      int64_t rx_ns)
+{
+	struct rx_index *rx_idx = carry->rx_idx;
+	struct net_segment *this_ns;
+	struct sdd_msg sdd_msg;
+	unsigned char bits, seen;
+	size_t rx;
 
-		// Ignore first few seconds, as packets from previous NS
-		// might come through
-		time_t curr_ts = time(NULL);
-		if (curr_ts - accu->since_ts < 1)
-			return;
+	// Sent before the retune
+	if (rx_ns < carry->retune_ns)
+		return;
 
-		// Fill message into struct
-		fill_sdd_struct(&sdd_msg, buf);
+	fill_sdd_struct(&sdd_msg, buf);
+	bits = (sdd_msg.demod_locked << LOCK_DEMOD) |
+	       (sdd_msg.demod_tracked << LOCK_TRACKED) |
+	       (sdd_msg.lock_definitive << LOCK_DEFINITIVE);
+	bits &= carry->lock_pending;
+	carry->lock_armed |= ~bits & carry->lock_pending;
 
-		// Only take if demod is locked
-		if (sdd_msg.demod_locked != 0x1) {
-			accu->count_bad++;
-			return;
+	seen = bits & carry->lock_armed;
+	if (seen) {
+		// The NS is the new one already, even while retuning
+		rx = rx_idx->current;
+		this_ns = ns_get(rx_idx, rx, rx_idx->ns_idx[rx].current);
+		for (int k = 0; k < LOCK_KINDS; ++k) {
+			if (seen & (1 << k))
+				latency_hist_add(&this_ns->lock[k],
+				                 rx_ns - carry->retune_ns);
 		}
+	}
 
-		// Filter out extremely high values
-		if (sdd_msg.esno > 0xF00) {
-			accu->count_bad++;
-			return;
+	carry->lock_pending &= ~bits;
+	carry->lock_armed &= ~bits;
+}
+
+/**
+ * Helper to hand the new detections of the trend detectors to the events
+ * and, except for a shift up, to the monitor to raise an alarm
+ */
+static void report_trend(struct ev_carry_sdd *carry, size_t rx, size_t ns,
+                         double esno, int flags)
+{
+	struct net_segment *this_ns;
+
+	if (!flags)
+		return;
+
+	this_ns = ns_get(carry->rx_idx, rx, ns);
+	for (int flag = TREND_DRIFT; flag <= TREND_SHIFT_UP; flag <<= 1) {
+		if (!(flags & flag))
+			continue;
+		printf("SDD handler: Trend '%s' detected for %s on %s!\n",
+		       esno_trend_name(flag), this_ns->name,
+		       rx == RX1 ? "RX1" : "RX2");
+		db_insert_event(carry->dbt_events, rx, this_ns->name,
+		                carry->accu.since_ts, flag, esno,
+		                &this_ns->trend);
+	}
+
+	if (carry->mon && (flags & ~TREND_SHIFT_UP))
+		mon_trend_detected(carry->mon, rx, ns, flags & ~TREND_SHIFT_UP);
+}
+
+/**
+ * Helper to get the distribution of a slice with messages, in dB
+ */
+static void slice_stats(struct sdd_slice_accumulator *accu,
+                        struct sdd_slice_stats *stats)
+{
+	stats->min = accu->esno_min / 10.0;
+	stats->max = accu->esno_max / 10.0;
+	stats->stddev = accu->count > 1 ?
+	                sqrt(accu->esno_m2 / (accu->count - 1)) / 10.0 : 0;
+	stats->p05 = esno_quantile(accu, 0.05);
+	stats->p50 = esno_quantile(accu, 0.5);
+	stats->p95 = esno_quantile(accu, 0.95);
+}
+
+/**
+ * Helper to get a quantile of a slice with messages from its histogram, in
+ * dB. It is the smallest value with at least 'q' of the messages at or
+ * below it (nearest rank), so exact to the 0.1 dB of the messages.
+ */
+static double esno_quantile(struct sdd_slice_accumulator *accu, double q)
+{
+	uint32_t rank, seen;
+	size_t i;
+
+	rank = (uint32_t)ceil(q * accu->count);
+	if (rank < 1)
+		rank = 1;
+
+	seen = 0;
+	for (i = accu->esno_min; i < accu->esno_max; ++i) {
+		seen += accu->esno_hist[i];
+		if (seen >= rank)
+			break;
+	}
+
+	return i / 10.0;
+}
+
+/**
+ * Helper for the adaptive dwell: Check if the slice has enough locked
+ * messages for the mean EsNo to be within SDD_DWELL_CI at SDD_DWELL_Z, and
+ * has been measured for at least SDD_DWELL_MIN seconds since the lock.
+ * Compared squared, in 0.1 dB.
+ *
+ * @return 1 if the slice can be flushed, 0 if not
+ */
+static int dwell_done(struct sdd_slice_accumulator *accu, time_t curr_mono)
+{
+	double n, var, limit;
+
+	if (curr_mono - accu->since_mono < SDD_DWELL_MIN ||
+	    accu->count < SDD_DWELL_MIN_SAMPLES)
+		return 0;
+
+	n = accu->count;
+	var = accu->esno_m2 / (n - 1);
+	limit = SDD_DWELL_CI * 10 / SDD_DWELL_Z;
+
+	return var / n <= limit * limit;
+}
+
+/**
+ * Process one SDD message: Add info to accumulator and flush the accu to the
+ * database if needed. With SDD_DWELL_ADAPTIVE, the slice only takes messages
+ * once the demod locked, and ends as soon as dwell_done() or after
+ * SDD_DWELL_MAX. The message arrived at 'curr_ts', or 'curr_mono' on the
+ * monotonic clock, which times the slice.
+ */
+void handle_sdd_msg(struct ev_carry_sdd *carry, unsigned char *buf,
+                    time_t curr_ts, time_t curr_mono, int64_t rx_ns)
+{
+	struct sdd_slice_accumulator *accu;
+	struct ns_metrics *metrics;
+	struct sdd_msg sdd_msg;
+	double diff;
+
+	accu = &carry->accu;
+	metrics = &ns_get(carry->rx_idx, accu->rx, accu->ns)->metrics;
+
+	// For stats, count every received packet
+	accu->count_total++;
+	metrics_inc(&metrics->packets);
+
+	// The lock bits are watched from the retune on, but nothing else is
+	// known about the messages until it is confirmed
+	if (carry->lock_pending)
+		time_lock(carry, buf, rx_ns);
+
+	if (accu->retuning) {
+		metrics_inc(&metrics->dropped);
+		return;
+	}
+
+	// Adaptive dwell: Give up on the slice, locked or not
+	if (SDD_DWELL_ADAPTIVE && curr_mono - accu->start_mono >= SDD_DWELL_MAX) {
+		metrics_inc(&metrics->dropped);
+		if (!accu->locked) {
+			printf("SDD handler: No lock on %s, "
+			       "discarding its slice!\n",
+			       ns_get_name(carry->rx_idx, accu->rx, accu->ns));
+			accu->valid_flag = 0;
 		}
+		flush_accumulator(carry);
+		return;
+	}
+
+	// Ignore first few seconds, as packets from previous NS
+	// might come through
+	if (curr_mono - accu->start_mono < 1) {
+		metrics_inc(&metrics->dropped);
+		return;
+	}
 
-		// Add current EsNo to accumulator
-		accu->count++;
-		accu->esno_sum += sdd_msg.esno;
+	// Fill message into struct
+	fill_sdd_struct(&sdd_msg, buf);
 
-		// Check if we need to flush the current accumulator to database
-		if (curr_ts - accu->since_ts - SDD_TIME_SLICE >= 0) {
-			flush_accumulator(accu, dbc, rx_idx);
+	// Adaptive dwell: Nothing to measure until the demod locked, the
+	// measurement starts then
+	if (SDD_DWELL_ADAPTIVE && !accu->locked) {
+		if (!sdd_msg.demod_locked || !sdd_msg.lock_definitive) {
+			metrics_inc(&metrics->dropped);
+			return;
 		}
+		accu->locked = 1;
+		accu->since_mono = curr_mono;
+		accu->since_ts = curr_ts;
+	}
+
+	// Only take if demod is locked
+	if (sdd_msg.demod_locked != 0x1) {
+		accu->count_bad++;
+		metrics_inc(&metrics->bad);
+		return;
+	}
+
+	// Filter out extremely high values
+	if (sdd_msg.esno > SDD_ESNO_MAX) {
+		accu->count_bad++;
+		metrics_inc(&metrics->bad);
+		return;
+	}
+
+	// Add current EsNo to accumulator
+	accu->count++;
+	accu->esno_sum += sdd_msg.esno;
+
+	// Its distribution: Extremes, variance by Welford and the histogram
+	diff = sdd_msg.esno - accu->esno_mean;
+	accu->esno_mean += diff / accu->count;
+	accu->esno_m2 += diff * (sdd_msg.esno - accu->esno_mean);
+	if (sdd_msg.esno < accu->esno_min)
+		accu->esno_min = sdd_msg.esno;
+	if (sdd_msg.esno > accu->esno_max)
+		accu->esno_max = sdd_msg.esno;
+	++accu->esno_hist[sdd_msg.esno];
+
+	// Check if we need to flush the current accumulator to database
+	if (SDD_DWELL_ADAPTIVE ? dwell_done(accu, curr_mono) :
+	    curr_mono - accu->since_mono - SDD_TIME_SLICE >= 0) {
+		flush_accumulator(carry);
 	}
 }
 
+/**
+ * No SDD messages arrived for some period of time: Flush a "null" EsNo
+ */
+void handle_sdd_timeout(struct ev_carry_sdd *carry)
+{
+	// No slice to flush while retuning
+	if (carry->accu.retuning)
+		return;
+
+	carry->accu.valid_flag = 0;
+	flush_accumulator(carry);
+}
+
+/**
+ * Handle a tuner status poll, sent during the slice 'gen' (slice_gen): If
+ * the tuner of the slice's RX is not locked TUNER_LOCK_GRACE seconds into
+ * the slice, it will not be any more useful, so it is void and the scheduler
+ * moves on at once.
+ */
+void handle_tuner_status(struct ev_carry_sdd *carry,
+                         const unsigned char *locked, unsigned int gen)
+{
+	struct sdd_slice_accumulator *accu = &carry->accu;
+	struct net_segment *this_ns;
+
+	// A poll sent before the slice started is about the old NS
+	if (gen != carry->slice_gen || accu->retuning || locked[accu->rx])
+		return;
+
+	if (vclock_mono(carry->clock) - accu->start_mono < TUNER_LOCK_GRACE)
+		return;
+
+	this_ns = ns_get(carry->rx_idx, accu->rx, accu->ns);
+	printf("SDD handler: Tuner unlocked on %s, aborting its slice!\n",
+	       this_ns->name);
+	metrics_inc(&this_ns->metrics.slices_aborted);
+
+	accu->valid_flag = 0;
+	flush_accumulator(carry);
+}
+
+/**
+ * Callback for LibEvent when SDD messages are received. Drain the socket
+ * batch-wise and hand every message to the accumulator.
+ */
+void cb_recv_sdd_packet(evutil_socket_t fd, short events, void *carry)
+{
+	struct ev_carry_sdd *c_sdd;
+	struct udp_batch *batch;
+	time_t curr_ts, curr_mono;
+	int64_t start_ns, now_ns, rx_ns;
+	int count;
+
+	start_ns = latency_now_ns();
+
+	// Unpack carry
+	c_sdd = (struct ev_carry_sdd *)carry;
+	batch = c_sdd->batch;
+
+	// Handle two cases:
+	// 1. Timeout: No packets during some period of time: "null" EsNo!
+	// 2. Normal: incoming packets are processed
+	if (events & EV_TIMEOUT) {
+		handle_sdd_timeout(c_sdd);
+		latency_record_since(LAT_SDD_RECV, start_ns);
+		return;
+	}
+
+	do {
+		count = get_udp_batch(fd, batch);
+		if (c_sdd->rec && count > 0)
+			recorder_add_batch(c_sdd->rec, REC_SDD, batch);
+
+		// All packets of a batch arrived at (about) the same time, to
+		// the second. The lock times take the kernel time stamps.
+		curr_ts = vclock_now(c_sdd->clock);
+		curr_mono = vclock_mono(c_sdd->clock);
+		now_ns = vclock_now_ns(c_sdd->clock);
+		for (int i = 0; i < count; ++i) {
+			if (udp_batch_len(batch, i) < SDD_MIN_LEN)
+				continue;
+			if (!(rx_ns = udp_batch_ts_ns(batch, i)))
+				rx_ns = now_ns;
+			handle_sdd_msg(c_sdd, udp_batch_buf(batch, i), curr_ts,
+			               curr_mono, rx_ns);
+		}
+	} while (count == batch->size);
+
+	latency_record_since(LAT_SDD_RECV, start_ns);
+}
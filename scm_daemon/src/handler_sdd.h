@@ -3,6 +3,13 @@
 
 #include "common.h"
 
+struct udp_batch;  // Needs forward declaration
+struct db_target;
+struct flight_recorder;
+struct ev_carry_mon;
+
+#define SDD_ESNO_MAX 0xF00  // Higher EsNo values (in 0.1 dB) are implausible
+
 // Holds (relevant) information from the SDD messages
 struct sdd_msg {
 	unsigned char lock_definitive : 1;
@@ -16,21 +23,69 @@ struct sdd_slice_accumulator {
 	size_t rx;
 	size_t ns;
 	int esno_sum;
+	uint16_t esno_min;
+	uint16_t esno_max;
+	double esno_mean;  // Welford: Running mean
+	double esno_m2;  // Welford: Sum of the squared deviations from the mean
+	uint32_t esno_hist[SDD_ESNO_MAX + 1];  // Per 0.1 dB, for the quantiles
 	int count;
 	int count_bad;
 	int count_total;
 	unsigned char valid_flag;
-	time_t since_ts;
+	unsigned char retuning;  // Waiting for the device to confirm the retune
+	unsigned char locked;  // Adaptive dwell: The demod locked in this slice
+	time_t start_mono;  // Of the slice, the retune was confirmed
+	time_t since_mono;  // Of the measurement, the lock with adaptive dwell
+	time_t since_ts;  // Wall time of since_mono, for the documents
+};
+
+// Distribution of the EsNo values of a slice, in dB
+struct sdd_slice_stats {
+	double min;
+	double max;
+	double stddev;
+	double p05;
+	double p50;
+	double p95;
 };
 
 // Carry for LibEvent callback
 struct ev_carry_sdd {
 	struct sdd_slice_accumulator accu;
-	mongoc_collection_t *dbc;
+	struct udp_batch *batch;
+	struct flight_recorder *rec;  // Records the datagrams, or NULL
+	struct vclock *clock;
+	struct db_target *dbt;
+	struct db_target *dbt_rollup;
+	struct db_target *dbt_events;
+	struct ev_carry_mon *mon;  // Gets the trend detections, or NULL
 	struct rx_index *rx_idx;
+	int64_t retune_ns;  // When the last retune was sent
+	unsigned char lock_pending;  // LOCK_* bits not seen since, as flags
+	unsigned char lock_armed;  // LOCK_* bits seen clear since, as flags
+	unsigned int slice_gen;  // Counts the slices, to tell stale polls apart
 };
 
-void reset_sdd_accu(struct sdd_slice_accumulator *accu, size_t rx, size_t ns);
+/**
+ * Helper to parse the SDD message. Takes the data from the appropriate offsets
+ * and puts it into our message struct. In the header, so that the benchmarks
+ * see the same inlined code.
+ */
+static inline void fill_sdd_struct(struct sdd_msg *s, unsigned char *buf)
+{
+	s->esno = (buf[150] << 8) + buf[151];
+	s->demod_locked = (buf[6] >> 4) & 0x1;
+	s->demod_tracked = (buf[6] >> 6) & 0x1;
+	s->lock_definitive = (buf[6] >> 7) & 0x1;
+}
+
+void reset_sdd_accu(struct sdd_slice_accumulator *accu, size_t rx, size_t ns,
+                    time_t now, time_t mono);
+void handle_sdd_msg(struct ev_carry_sdd *carry, unsigned char *buf,
+                    time_t curr_ts, time_t curr_mono, int64_t rx_ns);
+void handle_sdd_timeout(struct ev_carry_sdd *carry);
+void handle_tuner_status(struct ev_carry_sdd *carry,
+                         const unsigned char *locked, unsigned int gen);
 void cb_recv_sdd_packet(evutil_socket_t fd, short events, void *carry);
 
 #endif // HANDLER_SDD_H
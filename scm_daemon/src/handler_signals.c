@@ -16,3 +16,12 @@ void cb_handle_sigint(evutil_socket_t sig, short events, void *carry)
 	event_base_loopexit(evbase, NULL);
 }
 
+/**
+ * Callback for LibEvent to handle SIGUSR1: Print the latencies of the
+ * critical sections
+ */
+void cb_handle_sigusr1(evutil_socket_t sig, short events, void *carry)
+{
+	printf("SIGUSR1 received, latencies since start:\n");
+	latency_print(stdout);
+}
@@ -9,5 +9,6 @@ struct ev_carry_sigint {
 };
 
 void cb_handle_sigint(evutil_socket_t sig, short events, void *carry);
+void cb_handle_sigusr1(evutil_socket_t sig, short events, void *carry);
 
 #endif // HANDLER_SIGNALS_H
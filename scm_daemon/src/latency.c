@@ -0,0 +1,347 @@
+#include "latency.h"
+
+static struct latency_recorder *register_recorder();
+static inline size_t bucket_index(uint64_t ns);
+static inline uint64_t bucket_upper(size_t idx);
+static void cb_latency_report(evutil_socket_t fd, short events, void *carry);
+
+static const char *probe_names[LATENCY_PROBES] = {
+	"sdd_recv",
+	"fleet_inbox",
+	"sdd_flush",
+	"db_insert_sdd",
+	"db_insert_mc",
+	"db_upsert_rollup",
+	"ns_take_next",
+	"mon_check",
+	"mon_job",
+};
+
+// All recorders ever registered. They are only freed at exit, so that a
+// snapshot can walk the list without holding the lock.
+static pthread_mutex_t recorders_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct latency_recorder *recorders;
+static __thread struct latency_recorder *recorder;
+
+/**
+ * Record a latency of the calling thread. The first call of a thread
+ * registers its recorder, every other call only writes to it.
+ */
+void latency_record(enum latency_probe probe, int64_t ns)
+{
+	struct latency_histogram *h;
+
+	if (!recorder)
+		recorder = register_recorder();
+	if (ns < 0)
+		ns = 0;
+
+	h = &recorder->hist[probe];
+	metrics_inc(&h->buckets[bucket_index(ns)]);
+	metrics_inc(&h->count);
+	__atomic_store_n(&h->sum, h->sum + ns, __ATOMIC_RELAXED);
+	if ((uint64_t)ns > h->max)
+		__atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sum up the histograms of all threads into 'hist', an array of
+ * LATENCY_PROBES histograms. The threads may keep recording meanwhile.
+ */
+void latency_snapshot(struct latency_histogram *hist)
+{
+	struct latency_recorder *r;
+
+	memset(hist, 0, LATENCY_PROBES * sizeof(struct latency_histogram));
+
+	r = __atomic_load_n(&recorders, __ATOMIC_ACQUIRE);
+	for (; r; r = r->next) {
+		for (int p = 0; p < LATENCY_PROBES; ++p) {
+			struct latency_histogram *src = &r->hist[p];
+			uint64_t max;
+
+			for (size_t i = 0; i < LATENCY_BUCKETS; ++i)
+				hist[p].buckets[i] += metrics_get(&src->buckets[i]);
+			hist[p].count += metrics_get(&src->count);
+			hist[p].sum += metrics_get(&src->sum);
+			if ((max = metrics_get(&src->max)) > hist[p].max)
+				hist[p].max = max;
+		}
+	}
+}
+
+/**
+ * Get the value below which the fraction 'q' of the recorded latencies
+ * lies, rounded up to the end of its bucket
+ *
+ * @return The latency in ns, 0 if nothing has been recorded
+ */
+uint64_t latency_quantile(struct latency_histogram *hist, double q)
+{
+	uint64_t total, rank, seen;
+
+	total = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; ++i)
+		total += hist->buckets[i];
+	if (total == 0)
+		return 0;
+
+	rank = q * total;
+	if (rank >= total)
+		rank = total - 1;
+
+	seen = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+		seen += hist->buckets[i];
+		if (seen > rank) {
+			uint64_t upper = bucket_upper(i);
+			return (hist->max && upper > hist->max) ? hist->max : upper;
+		}
+	}
+
+	return hist->max;
+}
+
+/**
+ * Add a value to a histogram which is not shared between threads, e.g.
+ * one of a device
+ */
+void latency_hist_add(struct latency_histogram *hist, int64_t ns)
+{
+	if (ns < 0)
+		ns = 0;
+
+	++hist->buckets[bucket_index(ns)];
+	++hist->count;
+	hist->sum += ns;
+	if ((uint64_t)ns > hist->max)
+		hist->max = ns;
+}
+
+/**
+ * Add a value to a histogram which several threads record into or read
+ * while it is recorded, e.g. one of the monitor pool or a DB writer
+ */
+void latency_hist_add_shared(struct latency_histogram *hist, int64_t ns)
+{
+	uint64_t max;
+
+	if (ns < 0)
+		ns = 0;
+
+	__atomic_fetch_add(&hist->buckets[bucket_index(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->sum, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	while ((uint64_t)ns > max &&
+	       !__atomic_compare_exchange_n(&hist->max, &max, ns, 1,
+	                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * Get the largest value of a bucket, e.g. to write a histogram out
+ */
+uint64_t latency_bucket_upper(size_t idx)
+{
+	return bucket_upper(idx);
+}
+
+/**
+ * Print the quantiles of all probes since the start of the daemon
+ */
+void latency_print(FILE *out)
+{
+	struct latency_histogram *hist;
+
+	if (!(hist = malloc(LATENCY_PROBES * sizeof(struct latency_histogram)))) {
+		fprintf(stderr, "Latency: Failed to allocate memory!\n");
+		return;
+	}
+	latency_snapshot(hist);
+
+	fprintf(out, "%16s %12s %10s %10s %10s %10s\n", "Latency (us)",
+	        "count", "p50", "p99", "p999", "max");
+	for (int p = 0; p < LATENCY_PROBES; ++p) {
+		fprintf(out, "%16s %12"PRIu64" %10.1f %10.1f %10.1f %10.1f\n",
+		        probe_names[p], hist[p].count,
+		        latency_quantile(&hist[p], 0.5) / 1000.0,
+		        latency_quantile(&hist[p], 0.99) / 1000.0,
+		        latency_quantile(&hist[p], 0.999) / 1000.0,
+		        hist[p].max / 1000.0);
+	}
+	fflush(out);
+
+	free(hist);
+}
+
+/**
+ * Write a snapshot of the latencies to the database every
+ * LATENCY_REPORT_INTERVAL. The target must belong to a writer which is
+ * fed by the thread running 'evbase'.
+ */
+void latency_reporter_init(struct latency_reporter *rep,
+                           struct event_base *evbase, struct db_target *dbt)
+{
+	struct timeval ev_timer_report = { LATENCY_REPORT_INTERVAL, 0 };
+
+	rep->dbt = dbt;
+	if (!(rep->last = calloc(LATENCY_PROBES,
+	                         sizeof(struct latency_histogram)))) {
+		fprintf(stderr, "Latency: Failed to allocate memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	rep->ev_timer = event_new(evbase, -1, EV_PERSIST, cb_latency_report, rep);
+	event_add(rep->ev_timer, &ev_timer_report);
+}
+
+/**
+ * Free resources
+ */
+void latency_reporter_free(struct latency_reporter *rep)
+{
+	event_free(rep->ev_timer);
+	free(rep->last);
+}
+
+/**
+ * Free the recorders of all threads. No thread may record anymore.
+ */
+void latency_free()
+{
+	struct latency_recorder *r;
+
+	while ((r = recorders)) {
+		recorders = r->next;
+		free(r);
+	}
+}
+
+/**
+ * Get the name of a probe, as used in the snapshots
+ */
+const char *latency_probe_name(enum latency_probe probe)
+{
+	return probe_names[probe];
+}
+
+/**
+ * Helper to add the recorder of the calling thread to the list
+ *
+ * @return The new recorder
+ */
+static struct latency_recorder *register_recorder()
+{
+	struct latency_recorder *r;
+
+	if (!(r = calloc(1, sizeof(struct latency_recorder)))) {
+		fprintf(stderr, "Latency: Failed to allocate recorder!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_mutex_lock(&recorders_lock);
+	r->next = recorders;
+	__atomic_store_n(&recorders, r, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&recorders_lock);
+
+	return r;
+}
+
+/**
+ * Helper to find the bucket of a latency: Values below 2^LATENCY_SUB_BITS
+ * get a bucket each, above that the sub-buckets of a power of two are
+ * 2^(exponent - LATENCY_SUB_BITS) wide.
+ */
+static inline size_t bucket_index(uint64_t ns)
+{
+	int msb, shift;
+
+	if (ns >= (1ULL << LATENCY_MAX_BITS))
+		return LATENCY_BUCKETS - 1;
+	if (ns < (1ULL << LATENCY_SUB_BITS))
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+	shift = msb - LATENCY_SUB_BITS;
+
+	return ((size_t)(shift + 1) << LATENCY_SUB_BITS) +
+	       (ns >> shift) - (1 << LATENCY_SUB_BITS);
+}
+
+/**
+ * Helper to get the largest value of a bucket
+ */
+static inline uint64_t bucket_upper(size_t idx)
+{
+	int shift;
+
+	if (idx < (1 << LATENCY_SUB_BITS))
+		return idx;
+
+	shift = (idx >> LATENCY_SUB_BITS) - 1;
+
+	return ((((uint64_t)idx & ((1 << LATENCY_SUB_BITS) - 1)) +
+	         (1 << LATENCY_SUB_BITS)) << shift) + (1ULL << shift) - 1;
+}
+
+/**
+ * Callback for LibEvent timer: Write the quantiles of the latencies since
+ * the last snapshot to the sys collection. The max is the one since the
+ * start, as it cannot be taken apart.
+ */
+static void cb_latency_report(evutil_socket_t fd, short events, void *carry)
+{
+	struct latency_reporter *rep;
+	struct latency_histogram *hist;
+	bson_t *doc;
+	bson_t probes, probe;
+	bson_oid_t oid;
+
+	rep = (struct latency_reporter *)carry;
+
+	if (!(hist = malloc(LATENCY_PROBES * sizeof(struct latency_histogram)))) {
+		fprintf(stderr, "Latency: Failed to allocate memory!\n");
+		return;
+	}
+	latency_snapshot(hist);
+
+	doc = bson_new();
+	bson_oid_init(&oid, NULL);
+	bson_append_oid(doc, "_id", -1, &oid);
+	bson_append_utf8(doc, "key", -1, "latency", -1);
+	bson_append_time_t(doc, "ts", -1, time(NULL));
+	bson_append_int32(doc, "interval", -1, LATENCY_REPORT_INTERVAL);
+	bson_append_document_begin(doc, "probes", -1, &probes);
+	for (int p = 0; p < LATENCY_PROBES; ++p) {
+		struct latency_histogram diff;
+
+		// Only the latencies recorded since the last snapshot
+		diff.count = hist[p].count - rep->last[p].count;
+		diff.sum = hist[p].sum - rep->last[p].sum;
+		diff.max = hist[p].max;
+		for (size_t i = 0; i < LATENCY_BUCKETS; ++i)
+			diff.buckets[i] = hist[p].buckets[i] -
+			                  rep->last[p].buckets[i];
+
+		// Values in us, as in the print-out
+		bson_append_document_begin(&probes, probe_names[p], -1, &probe);
+		bson_append_int64(&probe, "count", -1, diff.count);
+		bson_append_double(&probe, "p50", -1,
+		                   latency_quantile(&diff, 0.5) / 1000.0);
+		bson_append_double(&probe, "p99", -1,
+		                   latency_quantile(&diff, 0.99) / 1000.0);
+		bson_append_double(&probe, "p999", -1,
+		                   latency_quantile(&diff, 0.999) / 1000.0);
+		bson_append_double(&probe, "max", -1, diff.max / 1000.0);
+		bson_append_document_end(&probes, &probe);
+	}
+	bson_append_document_end(doc, &probes);
+
+	if (!db_writer_push(rep->dbt, doc))
+		fprintf(stderr, "Latency: Snapshot dropped, queue and spool are full\n");
+
+	memcpy(rep->last, hist, LATENCY_PROBES * sizeof(struct latency_histogram));
+	free(hist);
+}
@@ -0,0 +1,58 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "common.h"
+
+struct db_target;  // Needs forward declaration
+
+// The timed critical sections
+enum latency_probe {
+	LAT_SDD_RECV = 0,  // Body of cb_recv_sdd_packet
+	LAT_FLEET_INBOX,  // Body of cb_fleet_inbox
+	LAT_SDD_FLUSH,  // flush_accumulator
+	LAT_DB_INSERT_SDD,  // db_insert_sdd
+	LAT_DB_INSERT_MC,  // db_insert_mc
+	LAT_DB_UPSERT_ROLLUP,  // db_upsert_rollup
+	LAT_NS_TAKE_NEXT,  // ns_take_next, including the SNMP requests
+	LAT_MON_CHECK,  // Degradation monitor tick
+	LAT_MON_JOB,  // Job on a monitor pool worker
+	LATENCY_PROBES
+};
+
+// The histograms recorded by one thread. Only that thread writes to them,
+// so recording takes no locks.
+struct latency_recorder {
+	struct latency_recorder *next;
+	struct latency_histogram hist[LATENCY_PROBES];
+};
+
+// Periodic snapshot of all recorders, written to the sys collection
+struct latency_reporter {
+	struct db_target *dbt;
+	struct event *ev_timer;
+	struct latency_histogram *last;  // Totals at the previous snapshot
+};
+
+void latency_record(enum latency_probe probe, int64_t ns);
+void latency_snapshot(struct latency_histogram *hist);
+uint64_t latency_quantile(struct latency_histogram *hist, double q);
+void latency_hist_add(struct latency_histogram *hist, int64_t ns);
+void latency_hist_add_shared(struct latency_histogram *hist, int64_t ns);
+uint64_t latency_bucket_upper(size_t idx);
+void latency_print(FILE *out);
+void latency_reporter_init(struct latency_reporter *rep,
+                           struct event_base *evbase, struct db_target *dbt);
+void latency_reporter_free(struct latency_reporter *rep);
+void latency_free();
+const char *latency_probe_name(enum latency_probe probe);
+
+/**
+ * Record the time since 'start_ns', taken with latency_now_ns()
+ */
+static inline void latency_record_since(enum latency_probe probe,
+                                        int64_t start_ns)
+{
+	latency_record(probe, latency_now_ns() - start_ns);
+}
+
+#endif // LATENCY_H
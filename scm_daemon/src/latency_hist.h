@@ -0,0 +1,38 @@
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+// Leaf header without common.h, as the network segments, DB writers and
+// the monitor pool embed histograms
+#include <stdint.h>
+#include <time.h>
+
+// Log-linear buckets: Each power of two is split into 2^LATENCY_SUB_BITS
+// linear sub-buckets, which gives a relative error below 1/16. Values
+// beyond 2^LATENCY_MAX_BITS ns (about 18 min) go to the last bucket.
+#define LATENCY_SUB_BITS 4
+#define LATENCY_MAX_BITS 40
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) \
+                         << LATENCY_SUB_BITS)
+
+// Histogram of latencies, in nanoseconds. Taken by the latency probes, the
+// lock times and the metrics endpoint alike.
+struct latency_histogram {
+	uint64_t count;
+	uint64_t max;
+	uint64_t sum;
+	uint64_t buckets[LATENCY_BUCKETS];
+};
+
+/**
+ * Monotonic time stamp in nanoseconds, to time anything within the daemon
+ */
+static inline int64_t latency_now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif // LATENCY_HIST_H
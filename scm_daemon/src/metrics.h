@@ -0,0 +1,36 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// Leaf header without common.h, as other headers embed the counters
+#include <stdint.h>
+
+// Counters of one NS. Written by the thread driving its device only, and
+// read by the metrics endpoint.
+struct ns_metrics {
+	uint64_t packets;  // SDD messages received while the NS was tuned
+	uint64_t bad;  // Unlocked demodulator or implausible EsNo
+	uint64_t dropped;  // Discarded while the tuner was settling
+	uint64_t slices;  // Slices flushed
+	uint64_t slices_invalid;  // Slices flushed with a zero EsNo
+	uint64_t slices_aborted;  // Slices cut short by an unlocked tuner
+};
+
+/**
+ * Increment a counter which has exactly one writing thread. This is a
+ * plain increment, only the store is made visible to the metrics endpoint.
+ */
+static inline void metrics_inc(uint64_t *counter)
+{
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + 1,
+	                 __ATOMIC_RELAXED);
+}
+
+/**
+ * Read a counter written by another thread
+ */
+static inline uint64_t metrics_get(const uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+#endif // METRICS_H
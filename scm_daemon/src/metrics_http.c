@@ -0,0 +1,332 @@
+#include "metrics_http.h"
+#include "mon_pool.h"
+#include <stddef.h>
+#include <event2/buffer.h>
+
+// Buckets of the histograms served: The powers of two from 2^17 ns (131 us)
+// to 2^34 ns (17 s), at which the log-linear buckets end exactly
+#define METRICS_HIST_MIN_BITS 17
+#define METRICS_HIST_MAX_BITS 34
+
+static void cb_metrics(struct evhttp_request *req, void *carry);
+static void cb_not_found(struct evhttp_request *req, void *carry);
+static void add_label_value(struct evbuffer *buf, const char *val);
+static void add_ns_counters(struct evbuffer *buf, struct metrics_server *srv);
+static void add_snmp_counters(struct evbuffer *buf, struct metrics_server *srv);
+static void add_writer_metrics(struct evbuffer *buf, struct metrics_server *srv);
+static void add_histogram_type(struct evbuffer *buf, const char *name);
+static void add_histogram(struct evbuffer *buf, const char *name,
+                          const char *labels, struct latency_histogram *h);
+
+// The counters of each NS, in the order they are served
+static const struct {
+	const char *name;
+	const char *help;
+	size_t offset;
+} ns_counters[] = {
+	{ "scm_sdd_packets_received_total",
+	  "SDD messages received while the NS was tuned.",
+	  offsetof(struct ns_metrics, packets) },
+	{ "scm_sdd_packets_bad_total",
+	  "SDD messages with an unlocked demodulator or implausible EsNo.",
+	  offsetof(struct ns_metrics, bad) },
+	{ "scm_sdd_packets_dropped_total",
+	  "SDD messages discarded while the tuner was retuning or settling.",
+	  offsetof(struct ns_metrics, dropped) },
+	{ "scm_slices_flushed_total",
+	  "Slices written to the database.",
+	  offsetof(struct ns_metrics, slices) },
+	{ "scm_slices_invalid_total",
+	  "Slices which failed the validity check.",
+	  offsetof(struct ns_metrics, slices_invalid) },
+	{ "scm_slices_aborted_total",
+	  "Slices aborted as the tuner reported no lock.",
+	  offsetof(struct ns_metrics, slices_aborted) },
+};
+
+// The SNMP counters of each device, in the order they are served
+static const struct {
+	const char *name;
+	const char *help;
+	size_t offset;
+} snmp_counters[] = {
+	{ "scm_snmp_sets_total",
+	  "SNMP SET requests issued.",
+	  offsetof(struct snmp_sessions, sets) },
+	{ "scm_snmp_sets_failed_total",
+	  "SNMP SET requests which were not sent, refused or not answered.",
+	  offsetof(struct snmp_sessions, sets_failed) },
+	{ "scm_snmp_timeouts_total",
+	  "SNMP requests which were not answered in time.",
+	  offsetof(struct snmp_sessions, timeouts) },
+	{ "scm_snmp_retries_total",
+	  "SNMP requests sent again after a timeout.",
+	  offsetof(struct snmp_sessions, retries) },
+};
+
+/**
+ * Start the HTTP server on the given event base. The devices, writers and
+ * the pool to report on are added afterwards.
+ */
+void metrics_server_init(struct metrics_server *srv, struct event_base *evbase,
+                         const char *addr, unsigned short port)
+{
+	srv->dev_total = 0;
+	srv->devs = NULL;
+	srv->writer_total = 0;
+	srv->writers = NULL;
+	srv->mon_pool = NULL;
+
+	if (!(srv->http = evhttp_new(evbase))) {
+		fprintf(stderr, "Metrics: Failed to create HTTP server!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (evhttp_bind_socket(srv->http, addr, port) != 0) {
+		fprintf(stderr, "Metrics: Could not bind to %s:%u!\n", addr, port);
+		exit(EXIT_FAILURE);
+	}
+
+	evhttp_set_allowed_methods(srv->http, EVHTTP_REQ_GET | EVHTTP_REQ_HEAD);
+	evhttp_set_cb(srv->http, "/metrics", cb_metrics, srv);
+	evhttp_set_gencb(srv->http, cb_not_found, srv);
+
+	printf("Metrics: Serving on http://%s:%u/metrics\n", addr, port);
+}
+
+/**
+ * Report on a device. It must be set up completely.
+ */
+void metrics_server_add_device(struct metrics_server *srv,
+                               struct tc1_device *dev)
+{
+	++srv->dev_total;
+	if (!(srv->devs = realloc(srv->devs, srv->dev_total *
+	                          sizeof(struct tc1_device *)))) {
+		fprintf(stderr, "Metrics: Failed to realloc memory!\n");
+		exit(EXIT_FAILURE);
+	}
+	srv->devs[srv->dev_total - 1] = dev;
+}
+
+/**
+ * Report on a DB writer
+ */
+void metrics_server_add_writer(struct metrics_server *srv,
+                               struct db_writer *dbw)
+{
+	++srv->writer_total;
+	if (!(srv->writers = realloc(srv->writers, srv->writer_total *
+	                             sizeof(struct db_writer *)))) {
+		fprintf(stderr, "Metrics: Failed to realloc memory!\n");
+		exit(EXIT_FAILURE);
+	}
+	srv->writers[srv->writer_total - 1] = dbw;
+}
+
+/**
+ * Report on the monitor pool
+ */
+void metrics_server_set_pool(struct metrics_server *srv,
+                             struct mon_pool *pool)
+{
+	srv->mon_pool = pool;
+}
+
+/**
+ * Stop the server and free memory
+ */
+void metrics_server_free(struct metrics_server *srv)
+{
+	evhttp_free(srv->http);
+	free(srv->devs);
+	free(srv->writers);
+}
+
+/**
+ * Callback for LibEvent when /metrics is requested: Render all metrics into
+ * one buffer and hand it to LibEvent, which sends it without blocking
+ */
+static void cb_metrics(struct evhttp_request *req, void *carry)
+{
+	struct metrics_server *srv;
+	struct evbuffer *buf;
+
+	srv = (struct metrics_server *)carry;
+
+	if (!(buf = evbuffer_new())) {
+		evhttp_send_error(req, HTTP_INTERNAL, NULL);
+		return;
+	}
+
+	add_ns_counters(buf, srv);
+	add_snmp_counters(buf, srv);
+	add_writer_metrics(buf, srv);
+	if (srv->mon_pool) {
+		add_histogram_type(buf, "scm_monitor_query_seconds");
+		add_histogram(buf, "scm_monitor_query_seconds", "",
+		              &srv->mon_pool->query_latency);
+	}
+
+	evhttp_add_header(evhttp_request_get_output_headers(req),
+	                  "Content-Type", "text/plain; version=0.0.4");
+	evhttp_send_reply(req, HTTP_OK, "OK", buf);
+	evbuffer_free(buf);
+}
+
+/**
+ * Callback for LibEvent for everything but /metrics
+ */
+static void cb_not_found(struct evhttp_request *req, void *carry)
+{
+	evhttp_send_error(req, HTTP_NOTFOUND, NULL);
+}
+
+/**
+ * Helper to add a label value, escaped as the text format requires
+ */
+static void add_label_value(struct evbuffer *buf, const char *val)
+{
+	evbuffer_add(buf, "\"", 1);
+	for (; *val; ++val) {
+		switch (*val) {
+		case '\\': evbuffer_add(buf, "\\\\", 2); break;
+		case '"': evbuffer_add(buf, "\\\"", 2); break;
+		case '\n': evbuffer_add(buf, "\\n", 2); break;
+		default: evbuffer_add(buf, val, 1); break;
+		}
+	}
+	evbuffer_add(buf, "\"", 1);
+}
+
+/**
+ * Helper to add the counters of every NS of every device
+ */
+static void add_ns_counters(struct evbuffer *buf, struct metrics_server *srv)
+{
+	size_t total = sizeof(ns_counters) / sizeof(ns_counters[0]);
+
+	for (size_t c = 0; c < total; ++c) {
+		evbuffer_add_printf(buf, "# HELP %s %s\n# TYPE %s counter\n",
+		                    ns_counters[c].name, ns_counters[c].help,
+		                    ns_counters[c].name);
+
+		for (size_t d = 0; d < srv->dev_total; ++d) {
+			struct rx_index *rx_idx = &srv->devs[d]->rx_idx;
+
+			for (int rx = 0; rx < 2; ++rx) {
+				struct ns_index *ns_idx = &rx_idx->ns_idx[rx];
+
+				for (size_t ns = 0; ns < ns_idx->total; ++ns) {
+					unsigned char *m;
+					m = (unsigned char *)&ns_idx->ns[ns].metrics;
+
+					evbuffer_add_printf(buf, "%s{device=",
+					                    ns_counters[c].name);
+					add_label_value(buf, srv->devs[d]->name);
+					evbuffer_add_printf(buf, ",rx=\"RX%d\",ns=",
+					                    rx + 1);
+					add_label_value(buf, ns_idx->ns[ns].name);
+					evbuffer_add_printf(buf, "} %"PRIu64"\n",
+						metrics_get((uint64_t *)
+						            (m + ns_counters[c].offset)));
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Helper to add the SNMP counters of every device
+ */
+static void add_snmp_counters(struct evbuffer *buf, struct metrics_server *srv)
+{
+	size_t total = sizeof(snmp_counters) / sizeof(snmp_counters[0]);
+
+	for (size_t c = 0; c < total; ++c) {
+		evbuffer_add_printf(buf, "# HELP %s %s\n# TYPE %s counter\n",
+		                    snmp_counters[c].name, snmp_counters[c].help,
+		                    snmp_counters[c].name);
+
+		for (size_t d = 0; d < srv->dev_total; ++d) {
+			unsigned char *ss;
+			ss = (unsigned char *)&srv->devs[d]->snmp_sess;
+
+			evbuffer_add_printf(buf, "%s{device=",
+			                    snmp_counters[c].name);
+			add_label_value(buf, srv->devs[d]->name);
+			evbuffer_add_printf(buf, "} %"PRIu64"\n",
+				metrics_get((uint64_t *)
+				            (ss + snmp_counters[c].offset)));
+		}
+	}
+}
+
+/**
+ * Helper to add the metrics of the DB writers
+ */
+static void add_writer_metrics(struct evbuffer *buf, struct metrics_server *srv)
+{
+	char labels[32];
+
+	evbuffer_add_printf(buf, "# HELP scm_db_writes_dropped_total "
+	                    "Documents lost as queue and spool were full.\n"
+	                    "# TYPE scm_db_writes_dropped_total counter\n");
+	for (size_t w = 0; w < srv->writer_total; ++w) {
+		evbuffer_add_printf(buf, "scm_db_writes_dropped_total"
+		                    "{writer=\"%zu\"} %zu\n", w,
+		                    __atomic_load_n(&srv->writers[w]->dropped,
+		                                    __ATOMIC_RELAXED));
+	}
+
+	add_histogram_type(buf, "scm_db_insert_seconds");
+	for (size_t w = 0; w < srv->writer_total; ++w) {
+		snprintf(labels, sizeof(labels), "writer=\"%zu\"", w);
+		add_histogram(buf, "scm_db_insert_seconds", labels,
+		              &srv->writers[w]->insert_latency);
+	}
+}
+
+/**
+ * Helper to add the HELP and TYPE lines of a histogram
+ */
+static void add_histogram_type(struct evbuffer *buf, const char *name)
+{
+	evbuffer_add_printf(buf, "# HELP %s Latency in seconds.\n"
+	                    "# TYPE %s histogram\n", name, name);
+}
+
+/**
+ * Helper to add the series of a histogram. The log-linear buckets are
+ * summed up to the powers of two between METRICS_HIST_MIN_BITS and
+ * METRICS_HIST_MAX_BITS. The count is taken from the buckets, so that it
+ * matches the +Inf bucket even while recording.
+ */
+static void add_histogram(struct evbuffer *buf, const char *name,
+                          const char *labels, struct latency_histogram *h)
+{
+	const char *sep;
+	uint64_t cumulative, end;
+
+	sep = labels[0] ? "," : "";
+
+	cumulative = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+		cumulative += metrics_get(&h->buckets[i]);
+
+		// Only where a power of two ends
+		end = latency_bucket_upper(i) + 1;
+		if ((end & (end - 1)) || end < (1ULL << METRICS_HIST_MIN_BITS) ||
+		    end > (1ULL << METRICS_HIST_MAX_BITS))
+			continue;
+
+		evbuffer_add_printf(buf, "%s_bucket{%s%sle=\"%g\"} %"PRIu64"\n",
+		                    name, labels, sep, end / 1e9, cumulative);
+	}
+	evbuffer_add_printf(buf, "%s_bucket{%s%sle=\"+Inf\"} %"PRIu64"\n",
+	                    name, labels, sep, cumulative);
+	evbuffer_add_printf(buf, "%s_sum{%s} %g\n", name, labels,
+	                    metrics_get(&h->sum) / 1e9);
+	evbuffer_add_printf(buf, "%s_count{%s} %"PRIu64"\n", name, labels,
+	                    cumulative);
+}
@@ -0,0 +1,33 @@
+#ifndef METRICS_HTTP_H
+#define METRICS_HTTP_H
+
+#include "device.h"
+#include <event2/http.h>
+
+// Not part of common.h, only the setup code needs it
+
+struct mon_pool;  // Needs forward declaration
+
+// Embedded HTTP server, serving the counters of the devices, DB writers and
+// the monitor pool in the Prometheus text format. All of them are only
+// read, so a scrape never waits for the threads updating them.
+struct metrics_server {
+	struct evhttp *http;
+	size_t dev_total;
+	struct tc1_device **devs;
+	size_t writer_total;
+	struct db_writer **writers;
+	struct mon_pool *mon_pool;
+};
+
+void metrics_server_init(struct metrics_server *srv, struct event_base *evbase,
+                         const char *addr, unsigned short port);
+void metrics_server_add_device(struct metrics_server *srv,
+                               struct tc1_device *dev);
+void metrics_server_add_writer(struct metrics_server *srv,
+                               struct db_writer *dbw);
+void metrics_server_set_pool(struct metrics_server *srv,
+                             struct mon_pool *pool);
+void metrics_server_free(struct metrics_server *srv);
+
+#endif // METRICS_HTTP_H
@@ -0,0 +1,130 @@
+#include "mon_pool.h"
+
+static void *pool_thread(void *carry);
+
+/**
+ * Initialize the pool and start its worker threads
+ */
+void mon_pool_init(struct mon_pool *pool, size_t total)
+{
+	int rc;
+
+	pool->total = total;
+	pool->head = NULL;
+	pool->tail = NULL;
+	pool->running = 1;
+	memset(&pool->query_latency, 0, sizeof(pool->query_latency));
+	pool->db_pool = db_client_pool_new(total);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	if (!(pool->threads = malloc(total * sizeof(pthread_t)))) {
+		fprintf(stderr, "Monitor pool: Failed to allocate memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t i = 0; i < total; ++i) {
+		rc = pthread_create(&pool->threads[i], NULL, pool_thread, pool);
+		if (rc) {
+			fprintf(stderr, "Error spawning thread. Code: %d.\n", rc);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/**
+ * Queue a job for the workers. May be called from any thread. The result
+ * is handed back through the completion queue of the job's monitor.
+ */
+void mon_pool_submit(struct mon_pool *pool, struct mon_job *job)
+{
+	job->next = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail)
+		pool->tail->next = job;
+	else
+		pool->head = job;
+	pool->tail = job;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Stop the workers and wait for them. Jobs which have not been started
+ * yet are discarded.
+ */
+void mon_pool_stop(struct mon_pool *pool)
+{
+	struct mon_job *job;
+	int rc;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->running = 0;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < pool->total; ++i) {
+		rc = pthread_join(pool->threads[i], NULL);
+		if (rc) {
+			fprintf(stderr, "Error return code from thread: %d.\n", rc);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	while ((job = pool->head)) {
+		pool->head = job->next;
+		mon_job_free(job);
+	}
+	pool->tail = NULL;
+}
+
+/**
+ * Free resources. The pool must have been stopped before.
+ */
+void mon_pool_free(struct mon_pool *pool)
+{
+	free(pool->threads);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+	mongoc_client_pool_destroy(pool->db_pool);
+}
+
+/**
+ * Worker: Take the next job, run it with a client from the pool and hand
+ * it over to the completion queue
+ */
+static void *pool_thread(void *carry)
+{
+	struct mon_pool *pool;
+	struct mon_job *job;
+	mongoc_client_t *client;
+	int64_t start_ns;
+
+	pool = (struct mon_pool *)carry;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->running && !pool->head)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		if (!pool->running) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		job = pool->head;
+		pool->head = job->next;
+		if (!pool->head)
+			pool->tail = NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		start_ns = latency_now_ns();
+		client = mongoc_client_pool_pop(pool->db_pool);
+		mon_job_run(job, client);
+		mongoc_client_pool_push(pool->db_pool, client);
+		latency_record_since(LAT_MON_JOB, start_ns);
+
+		mon_job_complete(job);
+	}
+
+	pthread_exit(NULL);
+}
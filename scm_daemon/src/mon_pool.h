@@ -0,0 +1,30 @@
+#ifndef MON_POOL_H
+#define MON_POOL_H
+
+#include "common.h"
+
+// Not part of common.h, only the monitor and the setup code need it
+
+struct mon_job;  // Needs forward declaration
+
+// Worker threads for the degradation monitors of all devices. The workers
+// take their database clients from a pool, so no client is shared with an
+// event loop.
+struct mon_pool {
+	size_t total;
+	pthread_t *threads;
+	mongoc_client_pool_t *db_pool;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct mon_job *head;  // Pending jobs, oldest first
+	struct mon_job *tail;
+	int running;
+	struct latency_histogram query_latency;  // Of the database reads
+};
+
+void mon_pool_init(struct mon_pool *pool, size_t total);
+void mon_pool_submit(struct mon_pool *pool, struct mon_job *job);
+void mon_pool_stop(struct mon_pool *pool);
+void mon_pool_free(struct mon_pool *pool);
+
+#endif // MON_POOL_H
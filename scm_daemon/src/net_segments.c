@@ -2,14 +2,18 @@
 
 static void ns_add(struct rx_index *rx_idx, size_t rx_id, char *name,
                    char *freq, float alarm);
-static char *string_trim(char *str);
-static int is_empty_string(const char *str);
 static int parse_ns_config_file(struct rx_index *rx_idx, const char *filename);
+static size_t take_next_pretuned(struct rx_index *rx_idx, time_t now,
+                                 ns_retuned_fn done, void *arg);
+static void cb_flipped(void *arg, int ok);
+static void pretune(struct rx_index *rx_idx);
+static void cb_pretuned(void *arg, int ok);
 
 /**
  * Initialize network segments: Parse config file and set up structs
  */
-void rx_index_init(struct rx_index *rx_idx, struct snmp_sessions *snmp_sess)
+void rx_index_init(struct rx_index *rx_idx, struct snmp_sessions *snmp_sess,
+                   const char *config_file)
 {
 	// Structure:
 	// Top level is a struct for the two RX'es (rx_idx)
@@ -24,6 +28,7 @@ void rx_index_init(struct rx_index *rx_idx, struct snmp_sessions *snmp_sess)
 	rx_idx->ns_rx_curr = 0;
 	rx_idx->ns_rx_list = NULL;
 	rx_idx->snmp_sess = snmp_sess;
+	memset(&rx_idx->pre, 0, sizeof(struct ns_pretune));
 
 	// Init the ns indexes
 	for (int i = 0; i < 2; ++i) {
@@ -36,7 +41,7 @@ void rx_index_init(struct rx_index *rx_idx, struct snmp_sessions *snmp_sess)
 	}
 
 	// Now that the structs are ready, add network segments
-	if (parse_ns_config_file(rx_idx, NS_CONFIG_FILE) < 1) {
+	if (parse_ns_config_file(rx_idx, config_file) < 1) {
 		fprintf(stderr, "No network segments have been configured!\n");
 		exit(EXIT_FAILURE);
 	}
@@ -49,106 +54,163 @@ void rx_index_init(struct rx_index *rx_idx, struct snmp_sessions *snmp_sess)
 		}
 		rx_idx->current = RX2;
 	}
-	snmp_set_active_rx(snmp_sess, rx_idx->current);
+	snmp_set_active_rx(snmp_sess, rx_idx->current, NULL, NULL);
+
+	// The switching policy starts from the current NS
+	ns_sched_init(rx_idx, NS_SCHEDULER);
+	printf("Config: Switching %s.\n", rx_idx->sched.ops->name);
 
 	// Activate respective profiles on the device via SNMP
 	for (int i = 0; i < 2; ++i) {
-		if (rx_idx->ns_idx[i].current > 0) {
+		rx_idx->profile[i] = TC1_DEFAULT_PROFILE;
+		if (rx_idx->ns_idx[i].total > 0) {
 			snmp_activate_default_profile(snmp_sess, i);
 		}
 	}
 }
 
 /**
- * Switching algorithm: Proceed to next target network segment.
- * Idea: Switch round-robin through the list of network segments as
- * given in the config file.
+ * Proceed to the next target network segment, as chosen by the switching
+ * policy (see ns_sched.c). The frequency and, if it changes, the active RX
+ * are set with a single asynchronous SNMP request. 'done' is called once
+ * the device confirmed it or it failed, which may be before this returns.
+ * With NS_PRETUNE, see take_next_pretuned() instead.
  *
  * @return array index of respective NS index. This information is not
  * sufficient for the function caller, but it may be convenient.
  */
-size_t ns_take_next(struct rx_index *rx_idx)
+size_t ns_take_next(struct rx_index *rx_idx, time_t now, ns_retuned_fn done,
+                    void *arg)
 {
 	size_t curr_rx;
 	size_t next_rx;
-	size_t next_rx_idx;
-	struct ns_index *ns_idx;
-	struct net_segment *next_ns;
-	struct snmp_sessions *ss;
-	char *freq;
+	size_t next_ns;
 
-	// Get appropriate RX
+	if (NS_PRETUNE)
+		return take_next_pretuned(rx_idx, now, done, arg);
+
+	// Get appropriate RX and NS
 	curr_rx = rx_idx->current;
-	next_rx_idx = (rx_idx->ns_rx_curr + 1) % rx_idx->ns_rx_total;
-	next_rx = rx_idx->ns_rx_list[next_rx_idx];
-
-	// Get next NS
-	ns_idx = &rx_idx->ns_idx[next_rx];
-	ns_idx->current = (ns_idx->current + 1) % ns_idx->total;
-	next_ns = &ns_idx->ns[ns_idx->current];
-
-	// Send SNMP frequency switch command
-	ss = rx_idx->snmp_sess;
-	freq = next_ns->freq;
-	snmp_set_freq(ss, next_rx, freq);
-
-	// Do we need to switch the RX too?
-	if (curr_rx != next_rx) {
-		snmp_set_active_rx(ss, next_rx);
-	}
+	ns_sched_next(rx_idx, now, &next_rx, &next_ns);
 
-	// Update local bookkeeping
+	// Update local bookkeeping, before the SET can complete
 	rx_idx->current = next_rx;
-	rx_idx->ns_rx_curr = next_rx_idx;
+	rx_idx->ns_idx[next_rx].current = next_ns;
+
+	// Send SNMP frequency switch command, switching the RX too if needed
+	snmp_retune(rx_idx->snmp_sess, next_rx, rx_idx->profile[next_rx],
+	            rx_idx->ns_idx[next_rx].ns[next_ns].tuner_freq,
+	            SNMP_TUNE_FREQ | (curr_rx != next_rx ? SNMP_TUNE_RX : 0),
+	            done, arg);
 
-	// Return new NS array position of respective ns_idx
-	return ns_idx->current;
+	return next_ns;
 }
 
 /**
- * Unused, old switching algorithm (the reason for the now sub-optimal RX/NS
- * data structures). Included in case it turns out it is still useful.
- * Idea: Always switch to other RX if possible, and prepare next profile on
- * unused RX. Turns out we do _not_ get better lock speeds with this mechanism.
- *
- * @return array index of respective NS index. This information is not
- * sufficient for the function caller, but it may be convenient.
+ * Pipelined switching: The next NS has been tuned on the inactive profile
+ * of its RX during the slice, so only that profile (and, if it changes,
+ * the RX) is activated. If the pre-tuning did not happen or is not
+ * confirmed yet, the frequency goes along. Once the device confirmed the
+ * switch, the NS after it is pre-tuned, see cb_flipped().
  */
-size_t ns_take_next_old(struct rx_index *rx_idx)
+static size_t take_next_pretuned(struct rx_index *rx_idx, time_t now,
+                                 ns_retuned_fn done, void *arg)
 {
-	size_t curr_rx;
-	size_t next_rx;
-	struct ns_index *next_ns_idx;
-	struct net_segment *next_ns;
+	struct ns_pretune *pre = &rx_idx->pre;
+	size_t curr_rx, next_rx, next_ns;
+	unsigned char profile;
+	int what;
+
+	// Nothing pre-tuned before the first switch or after a failed one
+	if (!pre->decided) {
+		ns_sched_next(rx_idx, now, &pre->rx, &pre->ns);
+		pre->tuned = 0;
+	}
 
-	// Decide which RX to take next
 	curr_rx = rx_idx->current;
-	next_rx = curr_rx ^ 1;  // xor
-	next_ns_idx = &rx_idx->ns_idx[next_rx];
+	next_rx = pre->rx;
+	next_ns = pre->ns;
+	profile = rx_idx->profile[next_rx] ^ 1;
 
-	if (next_ns_idx->total < 1) {
-		// This RX is not set up! Switch back
-		next_rx = curr_rx;
-		next_ns_idx = &rx_idx->ns_idx[curr_rx];
-	}
+	what = SNMP_TUNE_PROFILE;
+	if (!pre->tuned)
+		what |= SNMP_TUNE_FREQ;
+	if (curr_rx != next_rx)
+		what |= SNMP_TUNE_RX;
 
-	// Update local bookkeeping
+	// Update local bookkeeping, before the SET can complete
 	rx_idx->current = next_rx;
-	next_ns_idx->current = (next_ns_idx->current + 1) % next_ns_idx->total;
-	next_ns = &next_ns_idx->ns[next_ns_idx->current];
-
-	// Send update command to device using SNMP
-	struct snmp_sessions *ss = rx_idx->snmp_sess;
-	size_t target_rx = next_rx;
-	const char *freq = next_ns->freq;
-	snmp_set_freq(ss, target_rx, freq);
-
-	if (curr_rx != next_rx) {
-		// If RX has been switched
-		snmp_set_active_rx(ss, next_rx);
-	}
+	rx_idx->ns_idx[next_rx].current = next_ns;
+	rx_idx->profile[next_rx] = profile;
+	pre->decided = 0;
+	pre->tuned = 0;
+	pre->now = now;
+	pre->done = done;
+	pre->arg = arg;
+
+	snmp_retune(rx_idx->snmp_sess, next_rx, profile,
+	            rx_idx->ns_idx[next_rx].ns[next_ns].tuner_freq, what,
+	            cb_flipped, rx_idx);
+
+	return next_ns;
+}
 
-	return next_ns_idx->current;
+/**
+ * Callback for the SNMP layer: The switch of take_next_pretuned() has
+ * completed. Only then the profile which has just become inactive may be
+ * written to.
+ */
+static void cb_flipped(void *arg, int ok)
+{
+	struct rx_index *rx_idx;
+	ns_retuned_fn done;
+	void *done_arg;
+
+	// Unpack carry
+	rx_idx = (struct rx_index *)arg;
+	done = rx_idx->pre.done;
+	done_arg = rx_idx->pre.arg;
+
+	if (ok)
+		pretune(rx_idx);
+
+	if (done)
+		done(done_arg, ok);
+}
+
+/**
+ * Helper to decide on the NS after the current one, and tune it on the
+ * inactive profile of its RX
+ */
+static void pretune(struct rx_index *rx_idx)
+{
+	struct ns_pretune *pre = &rx_idx->pre;
+
+	ns_sched_next(rx_idx, pre->now, &pre->rx, &pre->ns);
+	pre->decided = 1;
+	pre->tuned = 0;
+	++pre->inflight;
+
+	snmp_retune(rx_idx->snmp_sess, pre->rx, rx_idx->profile[pre->rx] ^ 1,
+	            rx_idx->ns_idx[pre->rx].ns[pre->ns].tuner_freq,
+	            SNMP_TUNE_FREQ, cb_pretuned, rx_idx);
+}
+
+/**
+ * Callback for the SNMP layer: A pre-tuning SET has completed. An older
+ * one, overtaken by a switch, does not count.
+ */
+static void cb_pretuned(void *arg, int ok)
+{
+	struct rx_index *rx_idx;
+	struct ns_pretune *pre;
+
+	// Unpack carry
+	rx_idx = (struct rx_index *)arg;
+	pre = &rx_idx->pre;
+
+	if (--pre->inflight == 0 && pre->decided)
+		pre->tuned = ok;
 }
 
 /**
@@ -164,11 +226,27 @@ const char *ns_get_name(struct rx_index *rx_idx, size_t rx, size_t ns)
 	return ns_idx->ns[ns].name;
 }
 
+/**
+ * Get network segment, identified by [rx, ns] pair.
+ *
+ * @return Reference to the NS
+ */
+struct net_segment *ns_get(struct rx_index *rx_idx, size_t rx, size_t ns)
+{
+	return &rx_idx->ns_idx[rx].ns[ns];
+}
+
 /**
  * Free allocated memory
  */
 void rx_index_free(struct rx_index *rx_idx)
 {
+	ns_sched_free(rx_idx);
+
+	for (int rx = 0; rx < 2; ++rx)
+		for (size_t ns = 0; ns < rx_idx->ns_idx[rx].total; ++ns)
+			esno_window_free(&rx_idx->ns_idx[rx].ns[ns].window);
+
 	free(rx_idx->ns_idx[RX1].ns);
 	free(rx_idx->ns_idx[RX2].ns);
 	free(rx_idx->ns_rx_list);
@@ -195,8 +273,21 @@ static void ns_add(struct rx_index *rx_idx, size_t rx_id, char *name,
 	this_ns = ns_idx->ns + ns_idx->total - 1;
 
 	strncpy(this_ns->freq, freq, 12);
+	this_ns->tuner_freq = strtoul(freq, NULL, 10);
 	strncpy(this_ns->name, name, 256);
 	this_ns->alarm = alarm;
+	memset(this_ns->rollup, 0, sizeof(this_ns->rollup));
+	memset(&this_ns->metrics, 0, sizeof(this_ns->metrics));
+	memset(&this_ns->sched, 0, sizeof(this_ns->sched));
+	memset(this_ns->lock, 0, sizeof(this_ns->lock));
+	this_ns->lock_missed = 0;
+	memset(&this_ns->trend, 0, sizeof(struct esno_trend));
+
+	// Sized for a single NS being monitored with regular slices, the window
+	// grows if void slices pile up
+	esno_window_init(&this_ns->window,
+	                 MON_OBSERVATION_TIME / SDD_SLICE_MIN + 1,
+	                 MON_OBSERVATION_TIME);
 
 	// Add RX number to a list in rx_index, for easy round-robin switching
 	++rx_idx->ns_rx_total;
@@ -213,7 +304,7 @@ static void ns_add(struct rx_index *rx_idx, size_t rx_id, char *name,
  *
  * @return The new beginning of the string
  */
-static char *string_trim(char *str)
+char *string_trim(char *str)
 {
 	if (str == NULL) return str;
 
@@ -236,7 +327,7 @@ static char *string_trim(char *str)
  *
  * @return 0 if not empty, else 1
  */
-static int is_empty_string(const char *str)
+int is_empty_string(const char *str)
 {
 	if (str == NULL || strlen(str) < 1)
 		return 1;
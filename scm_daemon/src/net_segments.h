@@ -5,11 +5,22 @@
 
 enum { RX1 = 0, RX2 = 1 };
 
+// Lock bits of the SDD messages, timed from the retune
+enum { LOCK_DEMOD = 0, LOCK_TRACKED = 1, LOCK_DEFINITIVE = 2, LOCK_KINDS = 3 };
+
 // One actual network segment
 struct net_segment {
 	char freq[12];
+	unsigned long tuner_freq;  // Parsed once, as sent to the device
 	char name[256];
 	float alarm;  // Threshold
+	struct rollup_bucket rollup[ROLLUP_TIERS];  // Current bucket per tier
+	struct esno_window window;  // Slices within MON_OBSERVATION_TIME
+	struct esno_trend trend;  // Fed with every valid slice
+	struct ns_metrics metrics;
+	struct ns_sched_stats sched;  // For the weighted switching policy
+	struct latency_histogram lock[LOCK_KINDS];  // Since the last report
+	uint64_t lock_missed;  // Slices without a definitive lock, ditto
 };
 
 // Index of network segments for one RX
@@ -19,6 +30,22 @@ struct ns_index {
 	struct net_segment *ns;
 };
 
+// Completion of a retune: 'ok' is 1 if the device confirmed the SET
+typedef void (*ns_retuned_fn)(void *arg, int ok);
+
+// With NS_PRETUNE: The NS after the current one, tuned on the inactive
+// profile of its RX while the current one is measured
+struct ns_pretune {
+	size_t rx;
+	size_t ns;
+	unsigned char decided;  // Whether the NS above is the next one
+	unsigned char tuned;  // Whether the device confirmed its frequency
+	unsigned int inflight;  // Pre-tuning SETs not answered yet
+	time_t now;  // Of the retune in progress
+	ns_retuned_fn done;  // Of the retune in progress
+	void *arg;
+};
+
 // The 'main' container
 struct rx_index {
 	size_t current;  // RX1 or RX2
@@ -27,11 +54,19 @@ struct rx_index {
 	size_t ns_rx_curr;  // index in ns_rx_list array
 	size_t *ns_rx_list;
 	struct snmp_sessions *snmp_sess;
+	struct ns_sched sched;  // Switching policy
+	unsigned char profile[2];  // Active profile per RX
+	struct ns_pretune pre;
 };
 
-void rx_index_init(struct rx_index *rx_idx, struct snmp_sessions *snmp_sess);
-size_t ns_take_next(struct rx_index *rx_idx);
+void rx_index_init(struct rx_index *rx_idx, struct snmp_sessions *snmp_sess,
+                   const char *config_file);
+size_t ns_take_next(struct rx_index *rx_idx, time_t now, ns_retuned_fn done,
+                    void *arg);
 const char *ns_get_name(struct rx_index *rx_idx, size_t rx, size_t ns);
+struct net_segment *ns_get(struct rx_index *rx_idx, size_t rx, size_t ns);
 void rx_index_free(struct rx_index *rx_idx);
+char *string_trim(char *str);
+int is_empty_string(const char *str);
 
 #endif // NET_SEGMENTS_H
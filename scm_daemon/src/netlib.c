@@ -94,3 +94,118 @@ void *get_in_addr(struct sockaddr_storage *sas)
 	return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
+/**
+ * Have the kernel stamp every datagram of the socket with its receive time,
+ * see udp_batch_ts_ns()
+ */
+void udp_enable_timestamps(int sockfd)
+{
+	int on = 1;
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on,
+	               sizeof(on)) == -1)
+		perror("setsockopt SO_TIMESTAMPNS");
+}
+
+/**
+ * Allocate the buffers for batched receiving and wire them up, so that
+ * receiving a batch does not need any further allocation
+ */
+void udp_batch_init(struct udp_batch *batch, unsigned int size, size_t bufsiz)
+{
+	batch->size = size;
+	batch->bufsiz = bufsiz;
+	batch->count = 0;
+	batch->bufs = calloc(size, bufsiz);
+	batch->msgs = calloc(size, sizeof(struct mmsghdr));
+	batch->iovs = calloc(size, sizeof(struct iovec));
+	batch->addrs = calloc(size, sizeof(struct sockaddr_storage));
+	batch->ctrls = calloc(size, UDP_CTRL_SIZE);
+
+	if (!batch->bufs || !batch->msgs || !batch->iovs || !batch->addrs ||
+	    !batch->ctrls) {
+		fprintf(stderr, "Failed to allocate memory for UDP batch!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (unsigned int i = 0; i < size; ++i) {
+		batch->iovs[i].iov_base = batch->bufs + i * bufsiz;
+		batch->iovs[i].iov_len = bufsiz;
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
+		batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+		batch->msgs[i].msg_hdr.msg_control = batch->ctrls +
+		                                     i * UDP_CTRL_SIZE;
+	}
+}
+
+/**
+ * Get as many pending UDP packets as fit into the batch with one system
+ * call. If the batch comes back full, there may be more data waiting on the
+ * socket and the caller should call again.
+ *
+ * @return Number of packets received, 0 if there was no data
+ */
+int get_udp_batch(int sockfd, struct udp_batch *batch)
+{
+	int count;
+
+	// The kernel overwrites the address and ancillary data lengths, so
+	// reset them
+	for (unsigned int i = 0; i < batch->size; ++i) {
+		batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		batch->msgs[i].msg_hdr.msg_controllen = UDP_CTRL_SIZE;
+	}
+
+	if ((count = recvmmsg(sockfd, batch->msgs, batch->size,
+	                      MSG_DONTWAIT, NULL)) == -1) {
+
+		// Just no data on the nonblocking socket
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("recvmmsg");
+			exit(EXIT_FAILURE);
+		}
+
+		count = 0;
+	}
+
+	batch->count = count;
+
+	return count;
+}
+
+/**
+ * Get the kernel receive time stamp of the i-th datagram of the last
+ * received batch. Only available if enabled with udp_enable_timestamps().
+ *
+ * @return Nanoseconds since the epoch, 0 if there is no time stamp
+ */
+int64_t udp_batch_ts_ns(struct udp_batch *batch, unsigned int i)
+{
+	struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+	struct cmsghdr *cmsg;
+	struct timespec ts;
+
+	for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_TIMESTAMPNS)
+			continue;
+
+		memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+		return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+
+	return 0;
+}
+
+/**
+ * Free the batch buffers
+ */
+void udp_batch_free(struct udp_batch *batch)
+{
+	free(batch->bufs);
+	free(batch->msgs);
+	free(batch->iovs);
+	free(batch->addrs);
+	free(batch->ctrls);
+}
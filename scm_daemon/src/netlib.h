@@ -3,9 +3,46 @@
 
 #include "common.h"
 
+// Room for the ancillary data of one datagram: A receive time stamp
+#define UDP_CTRL_SIZE CMSG_SPACE(sizeof(struct timespec))
+
+// Preallocated set of datagram buffers, filled in one go by recvmmsg
+struct udp_batch {
+	unsigned int size;  // Number of slots
+	size_t bufsiz;  // Bytes per slot
+	unsigned int count;  // Slots filled by the last receive call
+	unsigned char *bufs;
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	struct sockaddr_storage *addrs;
+	unsigned char *ctrls;  // Ancillary data, i.e. the receive time stamps
+};
+
 int listen_to_udp(char *portnum);
 int get_udp_packet(int sockfd, void *buf, int bufsiz,
                    struct sockaddr_storage *remote_addr);
 void *get_in_addr(struct sockaddr_storage *sas);
+void udp_enable_timestamps(int sockfd);
+void udp_batch_init(struct udp_batch *batch, unsigned int size, size_t bufsiz);
+int get_udp_batch(int sockfd, struct udp_batch *batch);
+int64_t udp_batch_ts_ns(struct udp_batch *batch, unsigned int i);
+void udp_batch_free(struct udp_batch *batch);
+
+/**
+ * Get the payload of the i-th datagram of the last received batch
+ */
+static inline unsigned char *udp_batch_buf(struct udp_batch *batch,
+                                           unsigned int i)
+{
+	return batch->bufs + i * batch->bufsiz;
+}
+
+/**
+ * Get the payload length of the i-th datagram of the last received batch
+ */
+static inline int udp_batch_len(struct udp_batch *batch, unsigned int i)
+{
+	return batch->msgs[i].msg_len;
+}
 
 #endif // NETLIB_H
@@ -0,0 +1,336 @@
+#include "ns_sched.h"
+#include "common.h"
+#include <math.h>
+
+static void rr_next(struct rx_index *rx_idx, time_t now, size_t *rx,
+                    size_t *ns);
+static void alternate_next(struct rx_index *rx_idx, time_t now, size_t *rx,
+                           size_t *ns);
+static void weighted_init(struct rx_index *rx_idx);
+static void weighted_next(struct rx_index *rx_idx, time_t now, size_t *rx,
+                          size_t *ns);
+static void weighted_slice_done(struct rx_index *rx_idx, size_t rx, size_t ns,
+                                double esno, int valid);
+static void weighted_free(struct rx_index *rx_idx);
+static double weighted_weight(struct net_segment *this_ns);
+static time_t weighted_due(struct ns_sched *sched,
+                           struct net_segment *this_ns, time_t now);
+static int visit_before(struct ns_sched_visit *a, struct ns_sched_visit *b);
+static void heap_push(struct ns_sched *sched, time_t due, size_t rx, size_t ns);
+static void heap_pop(struct ns_sched *sched, struct ns_sched_visit *visit);
+
+static const struct ns_sched_ops policies[] = {
+	[NS_SCHED_ROUND_ROBIN] = {
+		.name = "round-robin",
+		.next = rr_next,
+	},
+	[NS_SCHED_ALTERNATE] = {
+		.name = "alternate",
+		.next = alternate_next,
+	},
+	[NS_SCHED_WEIGHTED] = {
+		.name = "weighted",
+		.init = weighted_init,
+		.next = weighted_next,
+		.slice_done = weighted_slice_done,
+		.free = weighted_free,
+	},
+};
+
+/**
+ * Set up the switching policy of the RX index, one of NS_SCHED_*. The
+ * network segments must have been added already.
+ */
+void ns_sched_init(struct rx_index *rx_idx, int policy)
+{
+	struct ns_sched *sched = &rx_idx->sched;
+
+	if (policy < 0 ||
+	    policy >= (int)(sizeof(policies) / sizeof(policies[0]))) {
+		fprintf(stderr, "Scheduler: Invalid policy %d!\n", policy);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(sched, 0, sizeof(struct ns_sched));
+	sched->ops = &policies[policy];
+	if (sched->ops->init)
+		sched->ops->init(rx_idx);
+}
+
+/**
+ * Decide which NS to measure next. It is up to the caller to tune to it.
+ */
+void ns_sched_next(struct rx_index *rx_idx, time_t now, size_t *rx,
+                   size_t *ns)
+{
+	rx_idx->sched.ops->next(rx_idx, now, rx, ns);
+}
+
+/**
+ * Tell the policy the result of the slice of [rx, ns]. The EsNo of a void
+ * slice ('valid' 0) means nothing.
+ */
+void ns_sched_slice_done(struct rx_index *rx_idx, size_t rx, size_t ns,
+                         double esno, int valid)
+{
+	if (rx_idx->sched.ops->slice_done)
+		rx_idx->sched.ops->slice_done(rx_idx, rx, ns, esno, valid);
+}
+
+/**
+ * Free memory
+ */
+void ns_sched_free(struct rx_index *rx_idx)
+{
+	if (rx_idx->sched.ops->free)
+		rx_idx->sched.ops->free(rx_idx);
+}
+
+/**
+ * Round-robin policy: Switch through the list of network segments as given
+ * in the config file.
+ */
+static void rr_next(struct rx_index *rx_idx, time_t now, size_t *rx,
+                    size_t *ns)
+{
+	struct ns_index *ns_idx;
+
+	// Get appropriate RX
+	rx_idx->ns_rx_curr = (rx_idx->ns_rx_curr + 1) % rx_idx->ns_rx_total;
+	*rx = rx_idx->ns_rx_list[rx_idx->ns_rx_curr];
+
+	// Get next NS
+	ns_idx = &rx_idx->ns_idx[*rx];
+	*ns = (ns_idx->current + 1) % ns_idx->total;
+}
+
+/**
+ * Old policy (the reason for the now sub-optimal RX/NS data structures).
+ * Idea: Always switch to other RX if possible, and prepare next profile on
+ * unused RX. Turns out we do _not_ get better lock speeds with this mechanism.
+ */
+static void alternate_next(struct rx_index *rx_idx, time_t now, size_t *rx,
+                           size_t *ns)
+{
+	struct ns_index *ns_idx;
+
+	// Decide which RX to take next
+	*rx = rx_idx->current ^ 1;  // xor
+	if (rx_idx->ns_idx[*rx].total < 1) {
+		// This RX is not set up! Switch back
+		*rx = rx_idx->current;
+	}
+
+	ns_idx = &rx_idx->ns_idx[*rx];
+	*ns = (ns_idx->current + 1) % ns_idx->total;
+}
+
+/**
+ * Weighted policy: Each NS gets a share of the slices by its weight, which
+ * grows the closer its EsNo is to the alarm threshold and the more it
+ * varies. A NS is due again after the time its share allows, but after
+ * NS_SCHED_REVISIT seconds at most. The NS due first is taken next
+ * (earliest deadline first), so the longer one waits, the sooner it is
+ * taken. The visits are kept in a heap, for O(log n) per decision.
+ */
+static void weighted_init(struct rx_index *rx_idx)
+{
+	struct ns_sched *sched = &rx_idx->sched;
+
+	// Until there is more known, every NS weighs the same
+	sched->weight_sum = 0;
+	for (size_t rx = 0; rx < 2; ++rx) {
+		for (size_t ns = 0; ns < rx_idx->ns_idx[rx].total; ++ns) {
+			rx_idx->ns_idx[rx].ns[ns].sched.weight = 1;
+			sched->weight_sum += 1;
+		}
+	}
+	sched->slice = SDD_TIME_SLICE;
+
+	if (!(sched->heap = malloc(rx_idx->ns_rx_total *
+	                           sizeof(struct ns_sched_visit)))) {
+		fprintf(stderr, "Failed to allocate scheduler heap!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Everything but the current NS is due at once
+	for (size_t rx = 0; rx < 2; ++rx) {
+		for (size_t ns = 0; ns < rx_idx->ns_idx[rx].total; ++ns) {
+			if (rx == rx_idx->current &&
+			    ns == rx_idx->ns_idx[rx].current)
+				continue;
+			heap_push(sched, 0, rx, ns);
+		}
+	}
+}
+
+/**
+ * Helper for the weighted policy: Requeue the NS measured last, then take
+ * the one due first
+ */
+static void weighted_next(struct rx_index *rx_idx, time_t now, size_t *rx,
+                          size_t *ns)
+{
+	struct ns_sched *sched = &rx_idx->sched;
+	struct ns_sched_visit visit;
+	size_t curr_rx, curr_ns;
+
+	// Keep track of how long the slices actually are
+	if (sched->last_ts)
+		sched->slice += NS_SCHED_EWMA * (now - sched->last_ts -
+		                                 sched->slice);
+	sched->last_ts = now;
+
+	curr_rx = rx_idx->current;
+	curr_ns = rx_idx->ns_idx[curr_rx].current;
+	heap_push(sched,
+	          weighted_due(sched, ns_get(rx_idx, curr_rx, curr_ns), now),
+	          curr_rx, curr_ns);
+
+	heap_pop(sched, &visit);
+	*rx = visit.rx;
+	*ns = visit.ns;
+}
+
+/**
+ * Helper for the weighted policy: Update the moving average and variance
+ * of the NS with the result of its slice, and with them its weight. Void
+ * slices only count towards the share of void ones.
+ */
+static void weighted_slice_done(struct rx_index *rx_idx, size_t rx, size_t ns,
+                                double esno, int valid)
+{
+	struct net_segment *this_ns = ns_get(rx_idx, rx, ns);
+	struct ns_sched_stats *stats = &this_ns->sched;
+	double diff, weight;
+
+	stats->voids += NS_SCHED_EWMA * ((valid ? 0 : 1) - stats->voids);
+
+	if (!valid) {
+		// Nothing to learn about the EsNo
+	} else if (!stats->seen) {
+		stats->mean = esno;
+		stats->var = 0;
+		stats->seen = 1;
+	} else {
+		diff = esno - stats->mean;
+		stats->mean += NS_SCHED_EWMA * diff;
+		stats->var = (1 - NS_SCHED_EWMA) * (stats->var +
+		             NS_SCHED_EWMA * diff * diff);
+	}
+
+	weight = weighted_weight(this_ns);
+	rx_idx->sched.weight_sum += weight - stats->weight;
+	stats->weight = weight;
+}
+
+/**
+ * Helper for the weighted policy: Free the heap
+ */
+static void weighted_free(struct rx_index *rx_idx)
+{
+	free(rx_idx->sched.heap);
+}
+
+/**
+ * Helper to get the weight of a NS. It grows from 1 to NS_SCHED_WEIGHT_MAX
+ * as its margin to the alarm threshold drops below NS_SCHED_MARGIN, or its
+ * deviation rises to NS_SCHED_STDDEV. Void slices add at most
+ * NS_SCHED_VOID_URGENCY, so that a NS without lock does not hog the tuner.
+ */
+static double weighted_weight(struct net_segment *this_ns)
+{
+	struct ns_sched_stats *stats = &this_ns->sched;
+	double urgency, by_dev;
+
+	urgency = 0;
+	if (stats->seen) {
+		urgency = (NS_SCHED_MARGIN - (stats->mean - this_ns->alarm)) /
+		          NS_SCHED_MARGIN;
+		by_dev = sqrt(stats->var) / NS_SCHED_STDDEV;
+		if (by_dev > urgency)
+			urgency = by_dev;
+	}
+	if (NS_SCHED_VOID_URGENCY * stats->voids > urgency)
+		urgency = NS_SCHED_VOID_URGENCY * stats->voids;
+	if (urgency < 0)
+		urgency = 0;
+	if (urgency > 1)
+		urgency = 1;
+
+	return 1 + (NS_SCHED_WEIGHT_MAX - 1) * urgency;
+}
+
+/**
+ * Helper to get when a NS measured 'now' is due again: Once the slices of
+ * the others have had their share, but within NS_SCHED_REVISIT
+ */
+static time_t weighted_due(struct ns_sched *sched,
+                           struct net_segment *this_ns, time_t now)
+{
+	double period;
+
+	if (!this_ns->sched.seen)
+		return now;
+
+	period = sched->slice * sched->weight_sum / this_ns->sched.weight;
+	if (period > NS_SCHED_REVISIT)
+		period = NS_SCHED_REVISIT;
+
+	return now + (time_t)period;
+}
+
+/**
+ * Helper to order the visits: By due time, then by RX and NS, so that the
+ * decisions are the same in a replay
+ */
+static int visit_before(struct ns_sched_visit *a, struct ns_sched_visit *b)
+{
+	if (a->due != b->due)
+		return a->due < b->due;
+	if (a->rx != b->rx)
+		return a->rx < b->rx;
+	return a->ns < b->ns;
+}
+
+/**
+ * Helper to add a visit to the heap. There is room for every NS, and each
+ * is in there at most once.
+ */
+static void heap_push(struct ns_sched *sched, time_t due, size_t rx, size_t ns)
+{
+	struct ns_sched_visit *heap = sched->heap;
+	struct ns_sched_visit visit = { .due = due, .rx = rx, .ns = ns };
+	size_t i, parent;
+
+	for (i = sched->len++; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (!visit_before(&visit, &heap[parent]))
+			break;
+		heap[i] = heap[parent];
+	}
+	heap[i] = visit;
+}
+
+/**
+ * Helper to take the visit due first from the heap, which must not be empty
+ */
+static void heap_pop(struct ns_sched *sched, struct ns_sched_visit *visit)
+{
+	struct ns_sched_visit *heap = sched->heap;
+	struct ns_sched_visit last;
+	size_t i, child;
+
+	*visit = heap[0];
+	last = heap[--sched->len];
+
+	for (i = 0; (child = 2 * i + 1) < sched->len; i = child) {
+		if (child + 1 < sched->len &&
+		    visit_before(&heap[child + 1], &heap[child]))
+			++child;
+		if (!visit_before(&heap[child], &last))
+			break;
+		heap[i] = heap[child];
+	}
+	heap[i] = last;
+}
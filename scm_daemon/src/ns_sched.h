@@ -0,0 +1,56 @@
+#ifndef NS_SCHED_H
+#define NS_SCHED_H
+
+// Leaf header without common.h, as the RX index embeds the scheduler
+#include <stddef.h>
+#include <time.h>
+
+enum { NS_SCHED_ROUND_ROBIN = 0, NS_SCHED_ALTERNATE = 1, NS_SCHED_WEIGHTED = 2 };
+
+struct rx_index;  // Needs forward declaration
+
+// A switching policy: Decides which NS is measured in the next slice
+struct ns_sched_ops {
+	const char *name;
+	void (*init)(struct rx_index *rx_idx);
+	void (*next)(struct rx_index *rx_idx, time_t now, size_t *rx,
+	             size_t *ns);
+	void (*slice_done)(struct rx_index *rx_idx, size_t rx, size_t ns,
+	                   double esno, int valid);  // Optional
+	void (*free)(struct rx_index *rx_idx);  // Optional
+};
+
+// What the weighted policy knows about one NS
+struct ns_sched_stats {
+	double mean;  // Moving average of the slices
+	double var;  // Moving variance of the slices
+	double voids;  // Moving share of the void slices
+	double weight;  // From 1 up to NS_SCHED_WEIGHT_MAX
+	unsigned char seen;  // Whether a slice has been measured yet
+};
+
+// A pending visit of the weighted policy
+struct ns_sched_visit {
+	time_t due;
+	size_t rx;
+	size_t ns;
+};
+
+// The policy and its state
+struct ns_sched {
+	const struct ns_sched_ops *ops;
+	size_t len;
+	struct ns_sched_visit *heap;  // Weighted: Earliest due first
+	double weight_sum;  // Weighted: Of all NS
+	double slice;  // Weighted: Moving average of the slice length
+	time_t last_ts;  // Weighted: Of the last decision
+};
+
+void ns_sched_init(struct rx_index *rx_idx, int policy);
+void ns_sched_next(struct rx_index *rx_idx, time_t now, size_t *rx,
+                   size_t *ns);
+void ns_sched_slice_done(struct rx_index *rx_idx, size_t rx, size_t ns,
+                         double esno, int valid);
+void ns_sched_free(struct rx_index *rx_idx);
+
+#endif // NS_SCHED_H
@@ -0,0 +1,282 @@
+#include "recorder.h"
+#include "device.h"
+
+#define RECORDER_MAGIC 0x53434d464c494748ULL  // "SCMFLIGH"
+#define RECORDER_DATA_OFF 64  // Records start after the (padded) header
+
+static void map_helper(struct flight_recorder *rec, const char *filename,
+                       int prot);
+static size_t entry_size(size_t len);
+static size_t entry_size_at(struct flight_recorder *rec, uint64_t pos,
+                            unsigned char *type);
+static void make_room(struct flight_recorder *rec, size_t size);
+
+/**
+ * Open the recording, or create it if it does not exist yet. The records of
+ * a previous run are kept, and the oldest are overwritten as usual.
+ */
+void recorder_open(struct flight_recorder *rec, const char *filename,
+                   size_t size)
+{
+	struct stat st;
+
+	if ((rec->fd = open(filename, O_RDWR | O_CREAT, 0644)) == -1) {
+		perror("Could not open recording");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fstat(rec->fd, &st) == -1) {
+		perror("Could not stat recording");
+		exit(EXIT_FAILURE);
+	}
+
+	// A recording from a previous run keeps its size
+	if ((size_t)st.st_size > RECORDER_DATA_OFF)
+		size = st.st_size;
+	else if (ftruncate(rec->fd, size) == -1) {
+		perror("Could not resize recording");
+		exit(EXIT_FAILURE);
+	}
+
+	rec->size = size;
+	map_helper(rec, filename, PROT_READ | PROT_WRITE);
+
+	// Start over if the file is new or not a recording
+	if (rec->hdr->magic != RECORDER_MAGIC || rec->hdr->size != size ||
+	    rec->hdr->tail > rec->hdr->head ||
+	    rec->hdr->head - rec->hdr->tail > rec->capacity) {
+		rec->hdr->size = size;
+		rec->hdr->head = 0;
+		rec->hdr->tail = 0;
+		rec->hdr->records = 0;
+		rec->hdr->overwritten = 0;
+		rec->hdr->magic = RECORDER_MAGIC;
+	}
+}
+
+/**
+ * Open an existing recording read-only, e.g. to replay it
+ */
+void recorder_load(struct flight_recorder *rec, const char *filename)
+{
+	struct stat st;
+
+	if ((rec->fd = open(filename, O_RDONLY)) == -1) {
+		perror("Could not open recording");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fstat(rec->fd, &st) == -1) {
+		perror("Could not stat recording");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((size_t)st.st_size <= RECORDER_DATA_OFF) {
+		fprintf(stderr, "Recorder: '%s' is not a recording!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	rec->size = st.st_size;
+	map_helper(rec, filename, PROT_READ);
+
+	if (rec->hdr->magic != RECORDER_MAGIC || rec->hdr->size != rec->size ||
+	    rec->hdr->tail > rec->hdr->head ||
+	    rec->hdr->head - rec->hdr->tail > rec->capacity) {
+		fprintf(stderr, "Recorder: '%s' is not a recording!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Helper for recorder_open and recorder_load
+ */
+static void map_helper(struct flight_recorder *rec, const char *filename,
+                       int prot)
+{
+	rec->map = mmap(NULL, rec->size, prot, MAP_SHARED, rec->fd, 0);
+	if (rec->map == MAP_FAILED) {
+		perror("Could not map recording");
+		exit(EXIT_FAILURE);
+	}
+
+	rec->hdr = (struct recorder_header *)rec->map;
+
+	// Keep the records 8-byte aligned up to the very end
+	rec->capacity = (rec->size - RECORDER_DATA_OFF) & ~7;
+}
+
+/**
+ * Write everything back to the file and unmap it
+ */
+void recorder_close(struct flight_recorder *rec)
+{
+	msync(rec->map, rec->size, MS_SYNC);
+	munmap(rec->map, rec->size);
+	close(rec->fd);
+}
+
+/**
+ * Helper to get the space taken by a record with a payload of 'len' bytes
+ */
+static size_t entry_size(size_t len)
+{
+	return (sizeof(struct recorder_entry) + len + 7) & ~7;
+}
+
+/**
+ * Helper to get the space taken by the record at 'pos', and its type
+ */
+static size_t entry_size_at(struct flight_recorder *rec, uint64_t pos,
+                            unsigned char *type)
+{
+	struct recorder_entry *entry;
+	size_t left;
+
+	// Too small for an entry at the end of the ring: Skipped as a whole
+	left = rec->capacity - pos % rec->capacity;
+	if (left < sizeof(struct recorder_entry)) {
+		*type = REC_PAD;
+		return left;
+	}
+
+	entry = (struct recorder_entry *)
+	        (rec->map + RECORDER_DATA_OFF + pos % rec->capacity);
+	*type = entry->type;
+
+	return entry_size(entry->len);
+}
+
+/**
+ * Helper to drop the oldest records until there are 'size' bytes free
+ */
+static void make_room(struct flight_recorder *rec, size_t size)
+{
+	struct recorder_header *hdr = rec->hdr;
+	unsigned char type;
+
+	while (hdr->head + size - hdr->tail > rec->capacity) {
+		hdr->tail += entry_size_at(rec, hdr->tail, &type);
+		if (type != REC_PAD)
+			++hdr->overwritten;
+	}
+}
+
+/**
+ * Record a datagram of the given type (REC_SDD or REC_MC), received from
+ * 'addr' at 'ts_ns'. The oldest records are overwritten if needed.
+ */
+void recorder_add(struct flight_recorder *rec, unsigned char type,
+                  int64_t ts_ns, const struct in6_addr *addr,
+                  const unsigned char *buf, size_t len)
+{
+	struct recorder_header *hdr = rec->hdr;
+	struct recorder_entry *entry;
+	size_t size, left;
+
+	size = entry_size(len);
+	if (size > rec->capacity)
+		return;
+
+	// Skip the end of the ring if the record does not fit there
+	left = rec->capacity - hdr->head % rec->capacity;
+	if (left < size) {
+		make_room(rec, left);
+		if (left >= sizeof(struct recorder_entry)) {
+			entry = (struct recorder_entry *)
+			        (rec->map + RECORDER_DATA_OFF +
+			         hdr->head % rec->capacity);
+			memset(entry, 0, sizeof(struct recorder_entry));
+			entry->type = REC_PAD;
+			entry->len = left - sizeof(struct recorder_entry);
+		}
+		hdr->head += left;
+	}
+
+	make_room(rec, size);
+
+	entry = (struct recorder_entry *)
+	        (rec->map + RECORDER_DATA_OFF + hdr->head % rec->capacity);
+	entry->ts_ns = ts_ns;
+	entry->addr = *addr;
+	entry->len = len;
+	entry->type = type;
+	memset(entry->reserved, 0, sizeof(entry->reserved));
+	memcpy(entry + 1, buf, len);
+
+	hdr->head += size;
+	++hdr->records;
+}
+
+/**
+ * Record all datagrams of the last received batch. Without a kernel time
+ * stamp, the current time is taken instead.
+ */
+void recorder_add_batch(struct flight_recorder *rec, unsigned char type,
+                        struct udp_batch *batch)
+{
+	struct timespec now;
+	struct in6_addr addr;
+	int64_t ts_ns;
+
+	for (unsigned int i = 0; i < batch->count; ++i) {
+		if (!(ts_ns = udp_batch_ts_ns(batch, i))) {
+			clock_gettime(CLOCK_REALTIME, &now);
+			ts_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+		}
+
+		device_addr_key(&batch->addrs[i], &addr);
+		recorder_add(rec, type, ts_ns, &addr, udp_batch_buf(batch, i),
+		             udp_batch_len(batch, i));
+	}
+}
+
+/**
+ * Get the position of the oldest record
+ */
+uint64_t recorder_read_begin(struct flight_recorder *rec)
+{
+	return rec->hdr->tail;
+}
+
+/**
+ * Read the record at 'pos' and advance 'pos' to the next one, skipping the
+ * padding. The entry and payload point into the recording. A record which
+ * would reach past the end of the ring or the newest record, has no payload
+ * or an unknown type is corrupt, e.g. from a crash while recording, and
+ * ends the reading.
+ *
+ * @return 1 if a record has been read, 0 if there are no more records
+ */
+int recorder_read(struct flight_recorder *rec, uint64_t *pos,
+                  struct recorder_entry **entry, unsigned char **payload)
+{
+	unsigned char type;
+	size_t size, left;
+
+	while (*pos < rec->hdr->head) {
+		left = rec->capacity - *pos % rec->capacity;
+		size = entry_size_at(rec, *pos, &type);
+		if (size > left || size > rec->hdr->head - *pos)
+			break;
+
+		if (type == REC_PAD) {
+			*pos += size;
+			continue;
+		}
+
+		*entry = (struct recorder_entry *)
+		         (rec->map + RECORDER_DATA_OFF + *pos % rec->capacity);
+		if ((*entry)->len == 0 || (type != REC_SDD && type != REC_MC))
+			break;
+
+		*payload = (unsigned char *)(*entry + 1);
+		*pos += size;
+		return 1;
+	}
+
+	if (*pos < rec->hdr->head)
+		fprintf(stderr, "Recorder: Corrupt record at %"PRIu64", "
+		        "stopping there!\n", *pos);
+
+	return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+// Not part of common.h, only the receiving callbacks and scm_replay need it
+#include "common.h"
+
+enum { REC_PAD = 0, REC_SDD = 1, REC_MC = 2 };
+
+// Header at the beginning of the recording. The positions count the bytes
+// ever written and never wrap, the records are at position % capacity.
+struct recorder_header {
+	uint64_t magic;
+	uint64_t size;
+	uint64_t head;  // End of the newest record
+	uint64_t tail;  // Start of the oldest record
+	uint64_t records;  // Recorded ever
+	uint64_t overwritten;  // Of those, overwritten by newer ones
+};
+
+// One recorded datagram: The entry is followed by the payload, padded to
+// 8 bytes. A record never wraps around the end of the ring, the space left
+// there is skipped with a REC_PAD record (or without one, if too small).
+struct recorder_entry {
+	int64_t ts_ns;  // Kernel receive time, ns since the epoch
+	struct in6_addr addr;  // Sender, as in device_addr_key()
+	uint16_t len;  // Of the payload
+	uint8_t type;  // REC_*
+	uint8_t reserved[5];
+};
+
+// Memory-mapped ring of the most recent SDD and MODCOD datagrams. Only one
+// thread may record. As the file is shared, the recording survives a crash
+// of the daemon.
+struct flight_recorder {
+	int fd;
+	size_t size;
+	size_t capacity;  // Bytes available for records
+	unsigned char *map;
+	struct recorder_header *hdr;
+};
+
+void recorder_open(struct flight_recorder *rec, const char *filename,
+                   size_t size);
+void recorder_load(struct flight_recorder *rec, const char *filename);
+void recorder_close(struct flight_recorder *rec);
+void recorder_add(struct flight_recorder *rec, unsigned char type,
+                  int64_t ts_ns, const struct in6_addr *addr,
+                  const unsigned char *buf, size_t len);
+void recorder_add_batch(struct flight_recorder *rec, unsigned char type,
+                        struct udp_batch *batch);
+uint64_t recorder_read_begin(struct flight_recorder *rec);
+int recorder_read(struct flight_recorder *rec, uint64_t *pos,
+                  struct recorder_entry **entry, unsigned char **payload);
+
+#endif // RECORDER_H
@@ -0,0 +1,75 @@
+#include "rollup.h"
+#include "common.h"
+
+// The tiers, as selected in the web interface
+static const struct {
+	const char *name;
+	time_t width;
+} tiers[ROLLUP_TIERS] = {
+	{ "minute", 60 },
+	{ "ten_minutes", 600 },
+	{ "hour", 3600 },
+	{ "half_day", 43200 },
+	{ "day", 86400 },
+};
+
+/**
+ * Add the result of a slice to the buckets of all tiers and write the
+ * updated buckets to the database. The buckets are kept in memory and
+ * written as a whole, so that a replayed write cannot count a slice twice.
+ */
+void rollup_update(struct rollup_bucket *buckets, struct db_target *dbt,
+                   const char *rx_name, const char *ns_name, time_t ts,
+                   double esno)
+{
+	for (int i = 0; i < ROLLUP_TIERS; ++i) {
+		struct rollup_bucket *b = &buckets[i];
+		time_t start = ts - ts % tiers[i].width;
+
+		// Begin a new bucket if the slice is past the current one
+		if (b->ts != start) {
+			b->ts = start;
+			b->sum = 0;
+			b->count = 0;
+			b->min = esno;
+			b->max = esno;
+		}
+
+		b->sum += esno;
+		b->count++;
+		if (esno < b->min)
+			b->min = esno;
+		if (esno > b->max)
+			b->max = esno;
+
+		db_upsert_rollup(dbt, tiers[i].name, rx_name, ns_name, b);
+	}
+}
+
+/**
+ * Load the current buckets of all network segments from the database, so
+ * that a restart does not lose the slices aggregated before
+ */
+void rollup_seed(struct rx_index *rx_idx, mongoc_collection_t *dbc,
+                 time_t now)
+{
+	db_create_rollup_index(dbc);
+
+	for (int rx = 0; rx < 2; ++rx) {
+		struct ns_index *ns_idx = &rx_idx->ns_idx[rx];
+		const char *rx_name = (rx == RX1) ? "RX1" : "RX2";
+
+		for (size_t ns = 0; ns < ns_idx->total; ++ns) {
+			struct net_segment *this_ns = &ns_idx->ns[ns];
+
+			for (int i = 0; i < ROLLUP_TIERS; ++i) {
+				struct rollup_bucket *b = &this_ns->rollup[i];
+
+				b->ts = 0;
+				db_get_rollup(dbc, tiers[i].name, rx_name,
+				              this_ns->name,
+				              now - now % tiers[i].width, b);
+			}
+		}
+	}
+}
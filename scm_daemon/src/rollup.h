@@ -0,0 +1,28 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+// Leaf header without common.h, as the network segments embed the buckets
+#include <time.h>
+#include <mongoc.h>
+
+#define ROLLUP_TIERS 5  // minute, ten_minutes, hour, half_day, day
+
+struct db_target;  // Needs forward declaration
+struct rx_index;
+
+// Running aggregate of the slices of one NS within one time bucket
+struct rollup_bucket {
+	time_t ts;  // Start of the bucket, 0 if unused
+	double sum;
+	int count;
+	double min;
+	double max;
+};
+
+void rollup_update(struct rollup_bucket *buckets, struct db_target *dbt,
+                   const char *rx_name, const char *ns_name, time_t ts,
+                   double esno);
+void rollup_seed(struct rx_index *rx_idx, mongoc_collection_t *dbc,
+                 time_t now);
+
+#endif // ROLLUP_H
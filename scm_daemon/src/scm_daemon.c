@@ -13,16 +13,26 @@
  */
 
 #include "scm_daemon.h"
+#include "fleet.h"
+#include "mon_pool.h"
+#include "alarm_dispatch.h"
+#include "metrics_http.h"
+#include "recorder.h"
 
 /**
  * Hi, dear source code reader!
  * This is the starting point of the application. We initialize
  * LibEvent, the MongoDB connection, the NetSNMP library, parse
- * the config file and then add the events: A SIGINT handler,
+ * the config file(s) and then add the events: A SIGINT handler,
  * the handler for UDP messages (i.e. for the SDD messages as well
  * as the MODCOD statistics), and two periodic events, namely
  * the server watchdog (used in the web interface) and the alert
  * system, which checks for long-term signal quality degradation.
+ * The counters of the daemon are served over HTTP on the same loop, and
+ * the received messages can be recorded for a later replay.
+ * In fleet mode, the devices are spread over worker threads with an
+ * event loop each, and this thread only receives and dispatches the
+ * UDP messages.
  * At last, the connections are closed and allocated resources are freed.
  * Header files are common for all source files: Each file.c includes
  * it's file.h. In the header file, related structs are defined and
@@ -38,27 +48,46 @@ int main(int argc, char **argv)
 	char *portnum_mc = "1238";
 	int sockfd_sdd, sockfd_mc;
 
-	// Init libevent
+	// Init libevent. Thread support is needed to wake up fleet workers.
 	struct event_base *evbase;
+	evthread_use_pthreads();
 	evbase = event_base_new();
 
-	// Init database connection
+	// Time source of the handlers driven by this thread
+	struct vclock clock;
+	vclock_init_real(&clock, evbase);
+
+	// Init database connection, and the writer thread that takes the
+	// inserts off the event loop
 	mongoc_client_t *db_client;
-	mongoc_collection_t *dbc_sdd;
-	mongoc_collection_t *dbc_mc;
 	mongoc_collection_t *dbc_sys;
+	struct db_writer db_writer;
+	struct db_target dbt_sys;
 	db_client = db_init();
-	dbc_sdd = db_connect(db_client, DB_NAME, COLLECTION_NAME_SDD);
-	dbc_mc = db_connect(db_client, DB_NAME, COLLECTION_NAME_MC);
 	dbc_sys = db_connect(db_client, DB_NAME, COLLECTION_NAME_SYSTEM);
-
-	// Init SNMP sessions
-	struct snmp_sessions snmp_sess;
-	snmp_init(&snmp_sess);
-
-	// Configure blades / network segments to use
-	struct rx_index rx_idx;
-	rx_index_init(&rx_idx, &snmp_sess);
+	db_writer_init(&db_writer, SPOOL_FILE);
+	db_writer_target(&db_writer, &dbt_sys, DB_NAME, COLLECTION_NAME_SYSTEM);
+
+	// Worker threads of the EsNo degradation monitors, and the delivery of
+	// their alarms. Alarm scripts are reaped by this thread.
+	struct mon_pool mon_pool;
+	struct alarm_dispatcher alarms;
+	mon_pool_init(&mon_pool, MON_WORKERS);
+	alarm_dispatcher_init(&alarms, evbase, MON_ALARM_SINKS);
+
+	// Configure the device(s): Either the single TC1 given in common.h,
+	// driven by this thread, or all TC1s of the fleet config file, driven
+	// by the fleet workers. A device comes with its SNMP sessions, its
+	// blades / network segments and its EsNo degradation monitor.
+	struct tc1_device dev;
+	struct fleet fleet;
+	if (FLEET_MODE) {
+		fleet_init(&fleet, FLEET_CONFIG_FILE, &mon_pool, &alarms);
+	} else {
+		device_setup(&dev, "TC1", TC1_IP_ADDR, NS_CONFIG_FILE, DB_NAME);
+		device_init(&dev, evbase, &clock, db_client, &db_writer,
+		            &mon_pool, &alarms);
+	}
 
 	// Bind handler for SIGINT (Ctrl-C)
 	struct event *ev_sigint;
@@ -67,43 +96,73 @@ int main(int argc, char **argv)
 	ev_sigint = evsignal_new(evbase, SIGINT, cb_handle_sigint, &c_sigint);
 	event_add(ev_sigint, NULL);
 
+	// Bind handler for SIGUSR1, which prints the latencies
+	struct event *ev_sigusr1;
+	ev_sigusr1 = evsignal_new(evbase, SIGUSR1, cb_handle_sigusr1, NULL);
+	event_add(ev_sigusr1, NULL);
+
 	// Initialize UDP sockets
 	sockfd_sdd = listen_to_udp(portnum_sdd);
 	sockfd_mc = listen_to_udp(portnum_mc);
 
-	// Monitor SDD socket and add to event list
+	// Record the messages as they come in, stamped by the kernel. Only
+	// this thread receives, so the recorder needs no lock.
+	struct flight_recorder recorder;
+	struct flight_recorder *rec = NULL;
+	if (RECORD_PACKETS) {
+		recorder_open(&recorder, RECORDER_FILE, RECORDER_FILE_SIZE);
+		udp_enable_timestamps(sockfd_sdd);
+		udp_enable_timestamps(sockfd_mc);
+		rec = &recorder;
+	}
+
+	// Monitor SDD socket and add to event list. In fleet mode, messages
+	// are demultiplexed by sender and the workers track the timeouts.
 	struct event *ev_sdd;
-	struct ev_carry_sdd c_sdd;
-	struct timeval ev_timeout_sdd = { .tv_sec = 5, .tv_usec = 0 };
-	c_sdd.dbc = dbc_sdd;
-	c_sdd.rx_idx = &rx_idx;
-	reset_sdd_accu(&c_sdd.accu, RX1, 0);
-	ev_sdd = event_new(evbase, sockfd_sdd, EV_READ|EV_PERSIST,
-	                   cb_recv_sdd_packet, &c_sdd);
+	struct udp_batch batch_sdd;
+	struct ev_carry_fleet_rx c_fleet_sdd;
+	struct timeval ev_timeout_sdd = { .tv_sec = SDD_TIMEOUT, .tv_usec = 0 };
+	udp_batch_init(&batch_sdd, SDD_BATCH_SIZE, SDD_BUFSIZ);
+	if (FLEET_MODE) {
+		c_fleet_sdd.fleet = &fleet;
+		c_fleet_sdd.batch = &batch_sdd;
+		c_fleet_sdd.rec = rec;
+		c_fleet_sdd.clock = &clock;
+		c_fleet_sdd.type = FLEET_PKT_SDD;
+		ev_sdd = event_new(evbase, sockfd_sdd, EV_READ|EV_PERSIST,
+		                   cb_fleet_recv, &c_fleet_sdd);
+	} else {
+		dev.c_sdd.batch = &batch_sdd;
+		dev.c_sdd.rec = rec;
+		ev_sdd = event_new(evbase, sockfd_sdd, EV_READ|EV_PERSIST,
+		                   cb_recv_sdd_packet, &dev.c_sdd);
+	}
 	if (HANDLE_SDD_MESSAGES)
-		event_add(ev_sdd, &ev_timeout_sdd);
+		event_add(ev_sdd, FLEET_MODE ? NULL : &ev_timeout_sdd);
 
 	// Monitor MODCOD socket and add to event list
 	struct event *ev_mc;
-	struct ev_carry_mc c_mc;
+	struct udp_batch batch_mc;
+	struct ev_carry_fleet_rx c_fleet_mc;
 	struct timeval ev_timeout_mc = { .tv_sec = 180, .tv_usec = 0 };
-	c_mc.dbc = dbc_mc;
-	init_mc_accu(&c_mc.accu);
-	ev_mc = event_new(evbase, sockfd_mc, EV_READ|EV_PERSIST,
-	                  cb_recv_mc_packet, &c_mc);
+	udp_batch_init(&batch_mc, MC_BATCH_SIZE, MC_BUFSIZ);
+	if (FLEET_MODE) {
+		c_fleet_mc.fleet = &fleet;
+		c_fleet_mc.batch = &batch_mc;
+		c_fleet_mc.rec = rec;
+		c_fleet_mc.clock = &clock;
+		c_fleet_mc.type = FLEET_PKT_MC;
+		ev_mc = event_new(evbase, sockfd_mc, EV_READ|EV_PERSIST,
+		                  cb_fleet_recv, &c_fleet_mc);
+	} else {
+		dev.c_mc.batch = &batch_mc;
+		dev.c_mc.rec = rec;
+		ev_mc = event_new(evbase, sockfd_mc, EV_READ|EV_PERSIST,
+		                  cb_recv_mc_packet, &dev.c_mc);
+	}
 	if (HANDLE_MODCOD_MESSAGES)
 		event_add(ev_mc, &ev_timeout_mc);
 
-	// Monitor EsNo degradation and trigger alarm
-	struct event *ev_mon;
-	struct ev_carry_mon c_mon;
-	struct timeval ev_timer_mon = { 3600, 0 };  // Every hour
-	c_mon.dbc = dbc_sdd;
-	mon_state_init(&c_mon.state, &rx_idx);
-	ev_mon = event_new(evbase, -1, EV_PERSIST,
-	                   cb_esno_degradation_monitor, &c_mon);
-	event_add(ev_mon, &ev_timer_mon);
-
 	// Add a watchdog-like timer, used in the web interface
 	struct event *ev_watchdog;
 	struct ev_carry_watchdog c_watchdog;
@@ -114,27 +173,65 @@ int main(int argc, char **argv)
 	event_add(ev_watchdog, &ev_timer_watchdog);
 	cb_watchdog(0, 0, &c_watchdog); // Fire once immediately
 
+	// Write the latencies of the critical sections to the database
+	struct latency_reporter latency_rep;
+	latency_reporter_init(&latency_rep, evbase, &dbt_sys);
+
+	// Serve the metrics of everything set up above. The devices of the
+	// fleet keep running on their workers while this thread reads them.
+	struct metrics_server metrics;
+	if (METRICS_PORT) {
+		metrics_server_init(&metrics, evbase, METRICS_ADDR, METRICS_PORT);
+		if (FLEET_MODE) {
+			for (size_t i = 0; i < fleet.dev_total; ++i)
+				metrics_server_add_device(&metrics, &fleet.devs[i]);
+			for (size_t i = 0; i < fleet.worker_total; ++i)
+				metrics_server_add_writer(&metrics,
+				                          &fleet.workers[i].db_writer);
+		} else {
+			metrics_server_add_device(&metrics, &dev);
+		}
+		metrics_server_add_writer(&metrics, &db_writer);
+		metrics_server_set_pool(&metrics, &mon_pool);
+	}
+
 	// Start event loop
+	db_writer_start(&db_writer);
+	if (FLEET_MODE)
+		fleet_start(&fleet);
 	event_base_dispatch(evbase);
+	if (FLEET_MODE)
+		fleet_stop(&fleet);
+	mon_pool_stop(&mon_pool);
+	db_writer_stop(&db_writer);
 
 	// Free resources before exit
 	close(sockfd_sdd);
 	close(sockfd_mc);
 	event_free(ev_sigint);
+	event_free(ev_sigusr1);
+	latency_reporter_free(&latency_rep);
 	event_free(ev_sdd);
 	event_free(ev_mc);
-	event_free(ev_mon);
 	event_free(ev_watchdog);
+	if (METRICS_PORT)
+		metrics_server_free(&metrics);
+	if (FLEET_MODE)
+		fleet_free(&fleet);
+	else
+		device_free(&dev);
+	alarm_dispatcher_free(&alarms);
 	event_base_free(evbase);
-	mon_state_destroy(&c_mon.state);
-	rx_index_free(&rx_idx);
-	snmp_free(&snmp_sess);
-	db_disconnect(dbc_sdd);
-	db_disconnect(dbc_mc);
+	udp_batch_free(&batch_sdd);
+	udp_batch_free(&batch_mc);
+	if (RECORD_PACKETS)
+		recorder_close(&recorder);
 	db_disconnect(dbc_sys);
+	db_writer_free(&db_writer);
+	mon_pool_free(&mon_pool);
 	db_free(db_client);
+	latency_free();
 	printf("Bye.\n");
 
 	return EXIT_SUCCESS;
 }
-
@@ -1,239 +1,597 @@
 #include "snmplib.h"
 
-static void init_session_helper(netsnmp_session *s, char *community);
-static void open_session_helper(netsnmp_session *local, netsnmp_session **remote);
-static int snmp_set(netsnmp_session *s, char *oid_str, char type, const char *val);
-static int get_profile_activate_oid(size_t rx, unsigned char profile, char *buf);
-static int get_freq_tuner_oid(size_t rx, char *buf);
+enum {
+	OID_TUNER = 0,  // [rx][profile]
+	OID_MODE = 4,  // [rx][profile]
+	OID_RX_MGMT = 8,
+	OID_STATUS = 9,  // [rx]
+	OID_TOTAL = 11
+};
+
+// An OID of the TC1, as the library takes it
+struct tc1_oid {
+	oid name[MAX_OID_LEN];
+	size_t len;
+};
+
+static void init_library_helper();
+static void init_session_helper(netsnmp_session *s, const char *peername,
+                                char *community);
+static void open_session_helper(struct snmp_link *link, const char *peername,
+                                char *community, struct event_base *evbase);
+static void close_session_helper(struct snmp_link *link);
+static int add_var(netsnmp_pdu *pdu, int id, unsigned char type, long val);
+static void snmp_set(struct snmp_sessions *ss, netsnmp_pdu *pdu,
+                     snmp_done_fn done, void *arg);
+static void snmp_set_failed(struct snmp_sessions *ss, netsnmp_pdu *pdu,
+                            snmp_done_fn done, void *arg);
+static void snmp_send(struct snmp_link *link, netsnmp_pdu *pdu,
+                      snmp_done_fn done, snmp_status_fn status, void *arg);
+static int send_request(struct snmp_request *req);
+static void finish_request(struct snmp_request *req, int ok,
+                           netsnmp_pdu *response);
+static int read_status(netsnmp_pdu *response, unsigned char *locked);
+static void unlink_request(struct snmp_request **list, struct snmp_request *req);
+static void schedule_timer(struct snmp_link *link);
+static int cb_snmp_response(int operation, netsnmp_session *session, int reqid,
+                            netsnmp_pdu *pdu, void *magic);
+static void cb_snmp_read(evutil_socket_t fd, short events, void *carry);
+static void cb_snmp_timer(evutil_socket_t fd, short events, void *carry);
+
+// The OIDs of tc1_proto.h, parsed once for all devices
+static struct tc1_oid oids[OID_TOTAL];
+static pthread_once_t library_once = PTHREAD_ONCE_INIT;
 
 /**
- * Initialize SNMP library
+ * Initialize SNMP library and the sessions to the TC1 at 'peername'. The
+ * library itself and the OID table are only initialized once, no matter how
+ * many devices are set up. The sessions are served by 'evbase'. Without a peer name, no
+ * sessions are opened and every request is confirmed at once, e.g. for
+ * replays.
  */
-void snmp_init(struct snmp_sessions *ss)
+void snmp_init(struct snmp_sessions *ss, const char *peername,
+               struct event_base *evbase)
 {
+	memset(ss, 0, sizeof(struct snmp_sessions));
+	ss->read.ss = ss;
+	ss->write.ss = ss;
+
 	// Initialize SNMP library
-	init_snmp("scm_daemon");
+	pthread_once(&library_once, init_library_helper);
+
+	if (!peername) {
+		ss->offline = 1;
+		return;
+	}
+
+	// Open the sessions for reading and writing
+	open_session_helper(&ss->read, peername, "public", evbase);
+	open_session_helper(&ss->write, peername, "private", evbase);
+}
 
-	// Initialize local sessions for reading and writing
-	init_session_helper(&ss->read_local, "public");
-	init_session_helper(&ss->write_local, "private");
+/**
+ * Helper for snmp_init: Initialize the library and parse the OIDs, so that
+ * the requests only need to copy them
+ */
+static void init_library_helper()
+{
+	const char *strs[OID_TOTAL] = {
+		SNMP_RX1_CFG1_TUNER, SNMP_RX1_CFG2_TUNER,
+		SNMP_RX2_CFG1_TUNER, SNMP_RX2_CFG2_TUNER,
+		SNMP_RX1_CFG1_MODE, SNMP_RX1_CFG2_MODE,
+		SNMP_RX2_CFG1_MODE, SNMP_RX2_CFG2_MODE,
+		SNMP_RX_MGMT,
+		SNMP_RX1_STATUS, SNMP_RX2_STATUS,
+	};
+
+	init_snmp("scm_daemon");
 
-	// Open the sessions to get a remote connection
-	open_session_helper(&ss->read_local, &ss->read);
-	open_session_helper(&ss->write_local, &ss->write);
+	for (int i = 0; i < OID_TOTAL; ++i) {
+		oids[i].len = MAX_OID_LEN;
+		if (!snmp_parse_oid(strs[i], oids[i].name, &oids[i].len)) {
+			snmp_perror(strs[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
 }
 
 /**
  * Helper for snmp_init
  */
-static void init_session_helper(netsnmp_session *s, char *community)
+static void init_session_helper(netsnmp_session *s, const char *peername,
+                                char *community)
 {
 	snmp_sess_init(s);
-	s->peername = strdup(TC1_IP_ADDR);
+	s->peername = strdup(peername);
 	s->version = SNMP_VERSION_2c;
 	s->community = (unsigned char *)strdup(community);
 	s->community_len = strlen(community);
+
+	// Retries are done here, so that they can be counted
+	s->timeout = SNMP_TIMEOUT_MS * 1000;
+	s->retries = 0;
 }
 
 /**
- * Helper for snmp_init
+ * Helper for snmp_init: Open a session and have its socket watched by
+ * the event base
  */
-static void open_session_helper(netsnmp_session *local, netsnmp_session **remote)
+static void open_session_helper(struct snmp_link *link, const char *peername,
+                                char *community, struct event_base *evbase)
 {
-	*remote = snmp_open(local);
+	fd_set fds;
+	struct timeval tv;
+	int numfds, block, fd;
+
+	init_session_helper(&link->local, peername, community);
+	link->sess = snmp_sess_open(&link->local);
+
+	if (!link->sess) {
+		snmp_sess_perror("SNMP ack", &link->local);
+		exit(EXIT_FAILURE);
+	}
 
-	if (!*remote) {
-		snmp_sess_perror("SNMP ack", local);
+	// The session has exactly one socket
+	numfds = 0;
+	block = 1;
+	FD_ZERO(&fds);
+	snmp_sess_select_info(link->sess, &numfds, &fds, &tv, &block);
+	for (fd = 0; fd < numfds && !FD_ISSET(fd, &fds); ++fd)
+		;
+	if (fd == numfds) {
+		fprintf(stderr, "SNMP: Session to %s has no socket!\n", peername);
 		exit(EXIT_FAILURE);
 	}
+
+	link->ev_read = event_new(evbase, fd, EV_READ|EV_PERSIST, cb_snmp_read,
+	                          link);
+	link->ev_timer = evtimer_new(evbase, cb_snmp_timer, link);
+	event_add(link->ev_read, NULL);
+}
+
+/**
+ * Helper for snmp_free: Close the session and drop the requests in flight,
+ * without completing them
+ */
+static void close_session_helper(struct snmp_link *link)
+{
+	struct snmp_request *req;
+
+	link->closing = 1;
+	event_free(link->ev_read);
+	event_free(link->ev_timer);
+	snmp_sess_close(link->sess);
+	free(link->local.peername);
+	free(link->local.community);
+
+	while ((req = link->pending)) {
+		link->pending = req->next;
+		snmp_free_pdu(req->pdu);
+		free(req);
+	}
+	while ((req = link->retry)) {
+		link->retry = req->next;
+		snmp_free_pdu(req->pdu);
+		free(req);
+	}
+}
+
+/**
+ * Helper to add a variable of the OID table to a PDU
+ *
+ * @return 1 on success, 0 if not
+ */
+static int add_var(netsnmp_pdu *pdu, int id, unsigned char type, long val)
+{
+	return snmp_pdu_add_variable(pdu, oids[id].name, oids[id].len, type,
+	                             &val, sizeof(val)) != NULL;
 }
 
 /**
  * The 'raw' SNMP set function. It should not be used directly in external
  * files. Rather, a non-static wrapper function should be created here that
  * makes the appropriate call in order to preserve source code readability.
- *
- * @return 1 if successful, 0 if not
+ * The PDU, which may carry several variables, goes out on the write session
+ * and is counted for the metrics endpoint. 'done' is called once the device
+ * answered, or the request failed for good, which may be before this
+ * returns.
  */
-static int snmp_set(netsnmp_session *s, char *oid_str, char type, const char *val)
+static void snmp_set(struct snmp_sessions *ss, netsnmp_pdu *pdu,
+                     snmp_done_fn done, void *arg)
 {
-	netsnmp_pdu *pdu;
-	oid the_oid[MAX_OID_LEN];
-	size_t oid_len;
+	metrics_inc(&ss->sets);
+	snmp_send(&ss->write, pdu, done, NULL, arg);
+}
 
-	pdu = snmp_pdu_create(SNMP_MSG_SET);
-	oid_len = MAX_OID_LEN;
+/**
+ * Helper to complete a SET whose PDU could not be built, or NULL if not even
+ * created: It is freed and counted as failed, and 'done', if given, is
+ * called at once.
+ */
+static void snmp_set_failed(struct snmp_sessions *ss, netsnmp_pdu *pdu,
+                            snmp_done_fn done, void *arg)
+{
+	fprintf(stderr, "SNMP: Failed to build a SET request!\n");
+	if (pdu)
+		snmp_free_pdu(pdu);
 
-	// Parse the OID
-	if (snmp_parse_oid(oid_str, the_oid, &oid_len) == 0) {
-		snmp_perror(oid_str);
-		return 0;
+	metrics_inc(&ss->sets);
+	metrics_inc(&ss->sets_failed);
+	if (done)
+		done(arg, 0);
+}
+
+/**
+ * Helper to send a request on 'link', which takes over the PDU. Either
+ * 'done' or, for status polls, 'status' is called on completion.
+ */
+static void snmp_send(struct snmp_link *link, netsnmp_pdu *pdu,
+                      snmp_done_fn done, snmp_status_fn status, void *arg)
+{
+	struct snmp_request *req;
+
+	if (!(req = malloc(sizeof(struct snmp_request)))) {
+		fprintf(stderr, "SNMP: Failed to allocate a request!\n");
+		exit(EXIT_FAILURE);
 	}
 
-	// Build the packet to be sent
-	if (snmp_add_var(pdu, the_oid, oid_len, type, val) != 0) {
-		printf("type: %c, val: %s, oid_str: %s\n", type, val, oid_str);
-		snmp_perror("SNMP: Could not add var!");
-		return 0;
+	req->link = link;
+	req->pdu = pdu;
+	req->attempts = 0;
+	req->done = done;
+	req->status = status;
+	req->arg = arg;
+
+	if (link->ss->offline) {
+		finish_request(req, 1, NULL);
+		return;
 	}
 
-	// Send the request
-	if (snmp_send(s, pdu) == 0) {
-		snmp_perror("SNMP: Error while sending!");
-		snmp_free_pdu(pdu);
-		return 0;
+	if (!send_request(req)) {
+		finish_request(req, 0, NULL);
+		return;
 	}
 
-	return 1;
+	schedule_timer(link);
 }
 
 /**
- * Helper function which puts the appropriate OID in 'buf' for the profile to
- * be activated.
+ * Helper to send a copy of the request's PDU, as the library frees what it
+ * sends
  *
- * @return 1 on success, 0 if not
+ * @return 1 if sent, 0 if not
  */
-static int get_profile_activate_oid(size_t rx, unsigned char profile, char *buf)
+static int send_request(struct snmp_request *req)
 {
-	switch (rx) {
-	case RX1:
-		if (profile == 0)
-			strncpy(buf, SNMP_RX1_CFG1_MODE, 40);
-		else if (profile == 1)
-			strncpy(buf, SNMP_RX1_CFG2_MODE, 40);
-		else
-			goto invalidprofile;
-		break;
-	case RX2:
-		if (profile == 0)
-			strncpy(buf, SNMP_RX2_CFG1_MODE, 40);
-		else if (profile == 1)
-			strncpy(buf, SNMP_RX2_CFG2_MODE, 40);
-		else
-			goto invalidprofile;
-		break;
-	invalidprofile:
-		fprintf(stderr, "SNMP: invalid profile given! (a) %u!\n", profile);
+	struct snmp_link *link = req->link;
+	netsnmp_pdu *copy;
+
+	if (!(copy = snmp_clone_pdu(req->pdu)))
 		return 0;
-	default:
-		fprintf(stderr, "SNMP: invalid RX given! (a) %u!\n", profile);
+
+	++req->attempts;
+	if (snmp_sess_async_send(link->sess, copy, cb_snmp_response, req) == 0) {
+		snmp_sess_perror("SNMP: Error while sending!",
+		                 snmp_sess_session(link->sess));
+		snmp_free_pdu(copy);
 		return 0;
 	}
 
+	req->next = link->pending;
+	link->pending = req;
+
 	return 1;
 }
 
 /**
- * Wrapper to set the default active profile
+ * Helper to complete a request which is not in flight anymore, with the
+ * 'response' of the device if there is one
  */
-void snmp_activate_default_profile(struct snmp_sessions *ss, size_t rx)
+static void finish_request(struct snmp_request *req, int ok,
+                           netsnmp_pdu *response)
 {
-	snmp_set_active_profile(ss, rx, TC1_DEFAULT_PROFILE);
+	struct snmp_sessions *ss = req->link->ss;
+	unsigned char locked[2] = { 1, 1 };
+
+	if (!ok && req->pdu->command == SNMP_MSG_SET)
+		metrics_inc(&ss->sets_failed);
+
+	if (req->status) {
+		// Without a device, the tuners are taken as locked
+		if (ok && response)
+			ok = read_status(response, locked);
+		req->status(req->arg, ok, locked);
+	} else if (req->done) {
+		req->done(req->arg, ok);
+	}
+
+	snmp_free_pdu(req->pdu);
+	free(req);
 }
 
 /**
- * Wrapper to set the given profile as active
+ * Helper to read the tuner status of both RXs from the response to a
+ * status poll
+ *
+ * @return 1 if both were in there, 0 if not
  */
-void snmp_set_active_profile(struct snmp_sessions *ss, size_t rx, unsigned char profile)
+static int read_status(netsnmp_pdu *response, unsigned char *locked)
 {
-	char oid[40];
+	netsnmp_variable_list *var;
+	int found = 0;
 
-	if (!get_profile_activate_oid(rx, profile, oid)) {
-		fprintf(stderr, "SNMP: Could not get profile OID\n");
-		return;
+	for (var = response->variables; var; var = var->next_variable) {
+		if (var->type != ASN_INTEGER)
+			continue;
+		for (size_t rx = 0; rx < 2; ++rx) {
+			struct tc1_oid *id = &oids[OID_STATUS + rx];
+
+			if (snmp_oid_compare(var->name, var->name_length,
+			                     id->name, id->len) == 0) {
+				locked[rx] = *var->val.integer == 1;
+				found |= 1 << rx;
+			}
+		}
 	}
 
-	if (!snmp_set(ss->write, oid, 'i', "0")) {
-		fprintf(stderr, "SNMP: Set active profile failed!\n");
+	return found == 3;
+}
+
+/**
+ * Helper to remove a request from a list
+ */
+static void unlink_request(struct snmp_request **list, struct snmp_request *req)
+{
+	for (; *list; list = &(*list)->next) {
+		if (*list == req) {
+			*list = req->next;
+			return;
+		}
 	}
 }
 
 /**
- * Helper to get the appropriate OID string into 'buf' for the frequency tuner
+ * Helper to arm the retransmission timer for the earliest request in
+ * flight, or to stop it if there is none
+ */
+static void schedule_timer(struct snmp_link *link)
+{
+	fd_set fds;
+	struct timeval tv = { 0, 0 };
+	int numfds, block;
+
+	numfds = 0;
+	block = 1;
+	FD_ZERO(&fds);
+	snmp_sess_select_info(link->sess, &numfds, &fds, &tv, &block);
+
+	if (block)
+		event_del(link->ev_timer);
+	else
+		event_add(link->ev_timer, &tv);
+}
+
+/**
+ * Callback for the SNMP library: A response arrived, or a request timed
+ * out. Timed out requests are only queued here, the library must not be
+ * called again from within its timeout handling.
  *
- * @return 1 on success, 0 if not
+ * @return 1, as required by the library
  */
-static int get_freq_tuner_oid(size_t rx, char *buf)
+static int cb_snmp_response(int operation, netsnmp_session *session, int reqid,
+                            netsnmp_pdu *pdu, void *magic)
 {
-	unsigned char profile = TC1_DEFAULT_PROFILE;
+	struct snmp_request *req;
+	struct snmp_link *link;
+
+	// Unpack carry
+	req = (struct snmp_request *)magic;
+	link = req->link;
 
-	switch (rx) {
-	case RX1:
-		if (profile == 0)
-			strncpy(buf, SNMP_RX1_CFG1_TUNER, 40);
-		else if (profile == 1)
-			strncpy(buf, SNMP_RX1_CFG2_TUNER, 40);
-		else
-			goto invalidsettings;
+	if (link->closing)
+		return 1;
+
+	unlink_request(&link->pending, req);
+
+	switch (operation) {
+	case NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE:
+		if (pdu->errstat != SNMP_ERR_NOERROR) {
+			fprintf(stderr, "SNMP: Request refused: %s\n",
+			        snmp_errstring(pdu->errstat));
+			finish_request(req, 0, NULL);
+		} else {
+			finish_request(req, 1, pdu);
+		}
 		break;
-	case RX2:
-		if (profile == 0)
-			strncpy(buf, SNMP_RX2_CFG1_TUNER, 40);
-		else if (profile == 1)
-			strncpy(buf, SNMP_RX2_CFG2_TUNER, 40);
-		else
-			goto invalidsettings;
+	case NETSNMP_CALLBACK_OP_TIMED_OUT:
+		metrics_inc(&link->ss->timeouts);
+		req->next = link->retry;
+		link->retry = req;
 		break;
-	invalidsettings:
-		fprintf(stderr, "SNMP: invalid profile configured! (b) %u!\n", profile);
-		return 0;
 	default:
-		fprintf(stderr, "SNMP: invalid RX given! (b) %u!\n", profile);
-		return 0;
+		finish_request(req, 0, NULL);
+		break;
 	}
 
 	return 1;
 }
 
 /**
- * Wrapper to set the given tuner frequency
+ * Callback for LibEvent when a response arrived on a session
  */
-void snmp_set_freq(struct snmp_sessions *ss, size_t rx, const char *frequency)
+static void cb_snmp_read(evutil_socket_t fd, short events, void *carry)
 {
-	char oid[40];
+	struct snmp_link *link;
+	fd_set fds;
 
-	if (!get_freq_tuner_oid(rx, oid)) {
-		fprintf(stderr, "SNMP: Could not get OID to tune frequency!\n");
+	// Unpack carry
+	link = (struct snmp_link *)carry;
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+	snmp_sess_read(link->sess, &fds);
+
+	schedule_timer(link);
+}
+
+/**
+ * Callback for LibEvent timer: Let the library find the requests which
+ * timed out, then send them again or give up on them after SNMP_RETRIES
+ */
+static void cb_snmp_timer(evutil_socket_t fd, short events, void *carry)
+{
+	struct snmp_link *link;
+	struct snmp_request *req;
+
+	// Unpack carry
+	link = (struct snmp_link *)carry;
+
+	snmp_sess_timeout(link->sess);
+
+	while ((req = link->retry)) {
+		link->retry = req->next;
+
+		if (req->attempts > SNMP_RETRIES) {
+			fprintf(stderr, "SNMP: No response from %s!\n",
+			        link->local.peername);
+			finish_request(req, 0, NULL);
+			continue;
+		}
+
+		metrics_inc(&link->ss->retries);
+		if (!send_request(req))
+			finish_request(req, 0, NULL);
+	}
+
+	schedule_timer(link);
+}
+
+/**
+ * Wrapper to set the default active profile
+ */
+void snmp_activate_default_profile(struct snmp_sessions *ss, size_t rx)
+{
+	snmp_set_active_profile(ss, rx, TC1_DEFAULT_PROFILE);
+}
+
+/**
+ * Wrapper to set the given profile as active. Nobody waits for this, a
+ * failure is only counted.
+ */
+void snmp_set_active_profile(struct snmp_sessions *ss, size_t rx, unsigned char profile)
+{
+	netsnmp_pdu *pdu;
+
+	if (rx > RX2 || profile > 1) {
+		fprintf(stderr, "SNMP: invalid RX %zu or profile %u given!\n",
+		        rx, profile);
 		return;
 	}
 
-	if (!snmp_set(ss->write, oid, 'u', frequency)) {
-		fprintf(stderr, "SNMP: Set frequency failed!\n");
+	pdu = snmp_pdu_create(SNMP_MSG_SET);
+	if (!pdu || !add_var(pdu, OID_MODE + rx * 2 + profile, ASN_INTEGER, 0)) {
+		snmp_set_failed(ss, pdu, NULL, NULL);
+		return;
 	}
+	snmp_set(ss, pdu, NULL, NULL);
 }
 
 /**
- * Wrapper to set the active RX
+ * Wrapper to retune 'rx', as given by 'what' (SNMP_TUNE_*): Set the
+ * frequency of 'profile', make 'profile' the active one and make 'rx' the
+ * active RX. All of it goes out in a single request, so that the device
+ * applies it together. 'done', if given, is called once the device
+ * confirmed it or the request failed.
  */
-void snmp_set_active_rx(struct snmp_sessions *ss, size_t rx)
+void snmp_retune(struct snmp_sessions *ss, size_t rx, unsigned char profile,
+                 unsigned long freq, int what, snmp_done_fn done, void *arg)
 {
-	char oid[40];
-	char rx_str[2];
+	netsnmp_pdu *pdu;
+	int ok;
+
+	if (rx > RX2 || profile > 1) {
+		fprintf(stderr, "SNMP: invalid RX %zu or profile %u given!\n",
+		        rx, profile);
+		if (done)
+			done(arg, 0);
+		return;
+	}
+
+	ok = (pdu = snmp_pdu_create(SNMP_MSG_SET)) != NULL;
+	if (ok && (what & SNMP_TUNE_FREQ))
+		ok = add_var(pdu, OID_TUNER + rx * 2 + profile, ASN_UNSIGNED,
+		             freq);
+	if (ok && (what & SNMP_TUNE_PROFILE))
+		ok = add_var(pdu, OID_MODE + rx * 2 + profile, ASN_INTEGER, 0);
+	if (ok && (what & SNMP_TUNE_RX))
+		ok = add_var(pdu, OID_RX_MGMT, ASN_INTEGER, rx + 1);
 
-	strncpy(oid, SNMP_RX_MGMT, 40);
+	if (!ok) {
+		snmp_set_failed(ss, pdu, done, arg);
+		return;
+	}
+	snmp_set(ss, pdu, done, arg);
+}
 
-	if (rx == RX1) {
-		strncpy(rx_str, "1", 2);
-	} else if (rx == RX2) {
-		strncpy(rx_str, "2", 2);
-	} else {
+/**
+ * Wrapper to set the active RX. 'done', if given, is called once the device
+ * confirmed it or the request failed.
+ */
+void snmp_set_active_rx(struct snmp_sessions *ss, size_t rx,
+                        snmp_done_fn done, void *arg)
+{
+	netsnmp_pdu *pdu;
+
+	if (rx > RX2) {
 		fprintf(stderr, "SNMP: Bad RX given!\n");
+		if (done)
+			done(arg, 0);
 		return;
 	}
 
-	if (!snmp_set(ss->write, oid, 'i', rx_str)) {
-		fprintf(stderr, "SNMP: Set active RX failed!\n");
+	pdu = snmp_pdu_create(SNMP_MSG_SET);
+	if (!pdu || !add_var(pdu, OID_RX_MGMT, ASN_INTEGER, rx + 1)) {
+		snmp_set_failed(ss, pdu, done, arg);
+		return;
 	}
+	snmp_set(ss, pdu, done, arg);
 }
 
 /**
- * Free resources allocated for the SNMP library
+ * Wrapper to poll the tuner status of both RXs, in a single GET on the read
+ * session. 'done' is called with the status once the device answered, or
+ * without it if the request failed.
+ */
+void snmp_poll_status(struct snmp_sessions *ss, snmp_status_fn done,
+                      void *arg)
+{
+	unsigned char locked[2] = { 1, 1 };
+	netsnmp_pdu *pdu;
+
+	pdu = snmp_pdu_create(SNMP_MSG_GET);
+	if (!pdu || !snmp_add_null_var(pdu, oids[OID_STATUS + RX1].name,
+	                               oids[OID_STATUS + RX1].len) ||
+	    !snmp_add_null_var(pdu, oids[OID_STATUS + RX2].name,
+	                       oids[OID_STATUS + RX2].len)) {
+		fprintf(stderr, "SNMP: Failed to build a status poll!\n");
+		if (pdu)
+			snmp_free_pdu(pdu);
+		done(arg, 0, locked);
+		return;
+	}
+
+	snmp_send(&ss->read, pdu, NULL, done, arg);
+}
+
+/**
+ * Free resources allocated for the SNMP library. Requests still in flight
+ * are dropped without completing them.
  */
 void snmp_free(struct snmp_sessions *ss)
 {
-	free(ss->read_local.peername);
-	free(ss->read_local.community);
-	free(ss->write_local.peername);
-	free(ss->write_local.community);
-	snmp_close_sessions();
+	if (ss->offline)
+		return;
+
+	close_session_helper(&ss->read);
+	close_session_helper(&ss->write);
 }
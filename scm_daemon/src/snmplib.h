@@ -3,18 +3,65 @@
 
 #include "common.h"
 
+struct snmp_sessions;  // Needs forward declaration
+struct snmp_request;
+
+// What snmp_retune() sets
+enum { SNMP_TUNE_FREQ = 1 << 0, SNMP_TUNE_PROFILE = 1 << 1, SNMP_TUNE_RX = 1 << 2 };
+
+// Completion of a request: 'ok' is 1 if the device confirmed it, 0 if it
+// refused it or never answered
+typedef void (*snmp_done_fn)(void *arg, int ok);
+
+// Completion of a status poll: 'locked' tells for each RX whether its tuner
+// is locked, and is only valid if 'ok' is 1
+typedef void (*snmp_status_fn)(void *arg, int ok, const unsigned char *locked);
+
+// One session to the device. Its socket and retransmission timer are
+// driven by the event base of the device's thread.
+struct snmp_link {
+	struct snmp_sessions *ss;
+	netsnmp_session local;
+	void *sess;
+	struct event *ev_read;
+	struct event *ev_timer;
+	struct snmp_request *pending;  // Sent, not answered yet
+	struct snmp_request *retry;  // Timed out, handled after the timeout run
+	unsigned char closing;
+};
+
+// Single-session API handles: Each device is driven by exactly one thread
 struct snmp_sessions {
-	netsnmp_session read_local;
-	netsnmp_session write_local;
-	netsnmp_session *read;
-	netsnmp_session *write;
+	struct snmp_link read;
+	struct snmp_link write;
+	unsigned char offline;  // No device: Every request is confirmed at once
+	uint64_t sets;  // SET requests issued
+	uint64_t sets_failed;  // SET requests not sent, refused or timed out
+	uint64_t timeouts;  // Requests which got no response in time
+	uint64_t retries;  // Requests sent again after a timeout
+};
+
+// A request in flight. The PDU is kept to send it again on a timeout.
+struct snmp_request {
+	struct snmp_request *next;
+	struct snmp_link *link;
+	netsnmp_pdu *pdu;
+	int attempts;
+	snmp_done_fn done;
+	snmp_status_fn status;  // Instead of 'done', for status polls
+	void *arg;
 };
 
-void snmp_init(struct snmp_sessions *ss);
+void snmp_init(struct snmp_sessions *ss, const char *peername,
+               struct event_base *evbase);
 void snmp_activate_default_profile(struct snmp_sessions *ss, size_t rx);
 void snmp_set_active_profile(struct snmp_sessions *ss, size_t rx, unsigned char profile);
-void snmp_set_freq(struct snmp_sessions *ss, size_t rx, const char *frequency);
-void snmp_set_active_rx(struct snmp_sessions *ss, size_t rx);
+void snmp_retune(struct snmp_sessions *ss, size_t rx, unsigned char profile,
+                 unsigned long freq, int what, snmp_done_fn done, void *arg);
+void snmp_set_active_rx(struct snmp_sessions *ss, size_t rx,
+                        snmp_done_fn done, void *arg);
+void snmp_poll_status(struct snmp_sessions *ss, snmp_status_fn done,
+                      void *arg);
 void snmp_free(struct snmp_sessions *ss);
 
 #endif // SNMPLIB_H
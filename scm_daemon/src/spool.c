@@ -0,0 +1,275 @@
+#include "spool.h"
+
+#define SPOOL_MAGIC 0x53434d53504f4f4cULL  // "SCMSPOOL"
+
+static int init_static_doc(bson_t *doc, const unsigned char *data,
+                           size_t max_len);
+static int record_is_sane(struct spool_record *rec, uint64_t off,
+                          uint64_t write_off);
+static void truncate_spool(struct spool *sp, uint64_t off);
+#define SPOOL_DATA_OFF 64  // Records start after the (padded) header
+
+/**
+ * Open the spool file, or create it if it does not exist yet. Records left
+ * over from a previous run are kept, so that they can be replayed.
+ */
+void spool_open(struct spool *sp, const char *filename, size_t size)
+{
+	struct stat st;
+
+	if ((sp->fd = open(filename, O_RDWR | O_CREAT, 0644)) == -1) {
+		perror("Could not open spool file");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fstat(sp->fd, &st) == -1) {
+		perror("Could not stat spool file");
+		exit(EXIT_FAILURE);
+	}
+
+	// A spool from a previous run keeps its size
+	if ((size_t)st.st_size >= SPOOL_DATA_OFF)
+		size = st.st_size;
+	else if (ftruncate(sp->fd, size) == -1) {
+		perror("Could not resize spool file");
+		exit(EXIT_FAILURE);
+	}
+
+	sp->size = size;
+	sp->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, sp->fd, 0);
+	if (sp->map == MAP_FAILED) {
+		perror("Could not map spool file");
+		exit(EXIT_FAILURE);
+	}
+
+	sp->hdr = (struct spool_header *)sp->map;
+	sp->dropped = 0;
+	pthread_mutex_init(&sp->lock, NULL);
+
+	// Start over if the file is new or not a spool
+	if (sp->hdr->magic != SPOOL_MAGIC || sp->hdr->size != size ||
+	    sp->hdr->read_off > sp->hdr->write_off ||
+	    sp->hdr->write_off > size) {
+		sp->hdr->size = size;
+		sp->hdr->read_off = SPOOL_DATA_OFF;
+		sp->hdr->write_off = SPOOL_DATA_OFF;
+		sp->hdr->magic = SPOOL_MAGIC;
+	} else if (sp->hdr->write_off > sp->hdr->read_off) {
+		printf("Spool: %"PRIu64" bytes left to replay in '%s'.\n",
+		       sp->hdr->write_off - sp->hdr->read_off, filename);
+	}
+}
+
+/**
+ * Write everything back to the file and unmap it
+ */
+void spool_close(struct spool *sp)
+{
+	if (sp->dropped > 0) {
+		fprintf(stderr, "Spool: Dropped %zu documents, spool is full!\n",
+		        sp->dropped);
+	}
+
+	msync(sp->map, sp->size, MS_SYNC);
+	munmap(sp->map, sp->size);
+	close(sp->fd);
+	pthread_mutex_destroy(&sp->lock);
+}
+
+/**
+ * Append a write to the collection 'ns' ("db.collection"): An insert of
+ * 'doc' if 'selector' is NULL, else an upsert of the matching document
+ *
+ * @return 1 on success, 0 if the spool is full
+ */
+int spool_append(struct spool *sp, const char *ns, const bson_t *selector,
+                 const bson_t *doc)
+{
+	struct spool_record rec;
+	unsigned char *pos;
+	uint64_t off;
+
+	rec.ns_len = strlen(ns) + 1;
+	rec.selector_len = selector ? selector->len : 0;
+	rec.reserved = 0;
+	rec.len = sizeof(struct spool_record) + rec.ns_len + rec.selector_len +
+	          doc->len;
+	rec.len = (rec.len + 7) & ~7;
+
+	pthread_mutex_lock(&sp->lock);
+
+	off = sp->hdr->write_off;
+	if (off + rec.len > sp->size) {
+		++sp->dropped;
+		pthread_mutex_unlock(&sp->lock);
+		return 0;
+	}
+
+	// Write the record first, then make it visible
+	pos = sp->map + off;
+	memcpy(pos, &rec, sizeof(struct spool_record));
+	pos += sizeof(struct spool_record);
+	memcpy(pos, ns, rec.ns_len);
+	pos += rec.ns_len;
+	if (selector) {
+		memcpy(pos, bson_get_data(selector), rec.selector_len);
+		pos += rec.selector_len;
+	}
+	memcpy(pos, bson_get_data(doc), doc->len);
+	__atomic_store_n(&sp->hdr->write_off, off + rec.len, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&sp->lock);
+
+	return 1;
+}
+
+/**
+ * Get the position of the first record to replay
+ */
+uint64_t spool_read_begin(struct spool *sp)
+{
+	return sp->hdr->read_off;
+}
+
+/**
+ * Read the record at 'off' and advance 'off' to the next one. The returned
+ * namespace and documents point into the spool, they stay valid until
+ * spool_read_commit() is called. The selector is only set for upserts. If
+ * a document of the record is corrupt, the returned one is empty.
+ * A torn or corrupt record ends the spool: It is truncated right before it.
+ *
+ * @return 1 if a record has been read, 0 if there are no more records
+ */
+int spool_read(struct spool *sp, uint64_t *off, const char **ns,
+               bson_t *selector, int *upsert, bson_t *doc)
+{
+	struct spool_record *rec;
+	unsigned char *pos, *end;
+	uint64_t write_off;
+
+	write_off = __atomic_load_n(&sp->hdr->write_off, __ATOMIC_ACQUIRE);
+	if (*off >= write_off)
+		return 0;
+
+	rec = (struct spool_record *)(sp->map + *off);
+	if (!record_is_sane(rec, *off, write_off)) {
+		truncate_spool(sp, *off);
+		return 0;
+	}
+
+	end = sp->map + *off + rec->len;
+	pos = (unsigned char *)(rec + 1);
+	*ns = (const char *)pos;
+	pos += rec->ns_len;
+
+	// Without its selector an upsert must not become an insert, so a
+	// corrupt document is returned empty and skipped either way
+	*upsert = (rec->selector_len > 0);
+	if (*upsert && !init_static_doc(selector, pos, rec->selector_len)) {
+		bson_init(doc);
+	} else if (!init_static_doc(doc, pos + rec->selector_len,
+	                            end - pos - rec->selector_len)) {
+		bson_init(doc);
+	}
+
+	*off += rec->len;
+
+	return 1;
+}
+
+/**
+ * Helper to check a record before it is read: Its parts have to fit into
+ * it, it has to end before 'write_off' and its namespace has to be a string
+ *
+ * @return 1 if sane, 0 if not
+ */
+static int record_is_sane(struct spool_record *rec, uint64_t off,
+                          uint64_t write_off)
+{
+	const char *ns;
+
+	if (off + sizeof(struct spool_record) > write_off)
+		return 0;
+
+	// The smallest BSON document has 5 bytes
+	if ((uint64_t)rec->len < sizeof(struct spool_record) +
+	                         (uint64_t)rec->ns_len + rec->selector_len + 5 ||
+	    off + rec->len > write_off || rec->ns_len == 0)
+		return 0;
+
+	ns = (const char *)(rec + 1);
+	return memchr(ns, 0, rec->ns_len) != NULL;
+}
+
+/**
+ * Helper to drop everything from the corrupt record at 'off' on
+ */
+static void truncate_spool(struct spool *sp, uint64_t off)
+{
+	pthread_mutex_lock(&sp->lock);
+
+	fprintf(stderr, "Spool: Corrupt record, dropping the %"PRIu64
+	        " bytes from it on!\n", sp->hdr->write_off - off);
+	__atomic_store_n(&sp->hdr->write_off, off, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&sp->lock);
+}
+
+/**
+ * Mark everything before 'off' as replayed. Once the spool is drained, it
+ * starts over from the beginning of the file.
+ */
+void spool_read_commit(struct spool *sp, uint64_t off)
+{
+	pthread_mutex_lock(&sp->lock);
+
+	if (off == sp->hdr->write_off) {
+		sp->hdr->read_off = SPOOL_DATA_OFF;
+		sp->hdr->write_off = SPOOL_DATA_OFF;
+	} else {
+		sp->hdr->read_off = off;
+	}
+
+	pthread_mutex_unlock(&sp->lock);
+}
+
+/**
+ * Check if there is something to replay
+ *
+ * @return 1 if empty, 0 if not
+ */
+int spool_is_empty(struct spool *sp)
+{
+	return sp->hdr->read_off ==
+	       __atomic_load_n(&sp->hdr->write_off, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Schedule writing the spool back to the file
+ */
+void spool_sync(struct spool *sp)
+{
+	msync(sp->map, sp->size, MS_ASYNC);
+}
+
+/**
+ * Helper to point a BSON document to spooled data. The records are padded,
+ * but the BSON data knows its own length.
+ *
+ * @return 1 on success, 0 if the record is corrupt
+ */
+static int init_static_doc(bson_t *doc, const unsigned char *data,
+                           size_t max_len)
+{
+	uint32_t len;
+
+	len = data[0] | (data[1] << 8) | (data[2] << 16) |
+	      ((uint32_t)data[3] << 24);
+
+	if (len > max_len || !bson_init_static(doc, data, len)) {
+		fprintf(stderr, "Spool: Skipping corrupt record!\n");
+		return 0;
+	}
+
+	return 1;
+}
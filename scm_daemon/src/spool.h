@@ -0,0 +1,56 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+// Leaf header without common.h, as other headers embed the spool
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <bson.h>
+
+// Header at the beginning of the spool file
+struct spool_header {
+	uint64_t magic;
+	uint64_t size;
+	uint64_t read_off;  // First record not yet replayed
+	uint64_t write_off;  // End of the last record
+};
+
+// One spooled write: The header is followed by the namespace
+// ("db.collection"), the selector for upserts and the raw BSON document,
+// padded to 8 bytes
+struct spool_record {
+	uint32_t len;  // Of the whole record
+	uint32_t ns_len;  // Including the terminating zero
+	uint32_t selector_len;  // 0 for inserts
+	uint32_t reserved;
+};
+
+// Memory-mapped, append-only spool file. Documents can be appended by any
+// thread, but only one thread may read.
+struct spool {
+	int fd;
+	size_t size;
+	unsigned char *map;
+	struct spool_header *hdr;
+	pthread_mutex_t lock;
+	size_t dropped;
+};
+
+void spool_open(struct spool *sp, const char *filename, size_t size);
+void spool_close(struct spool *sp);
+int spool_append(struct spool *sp, const char *ns, const bson_t *selector,
+                 const bson_t *doc);
+int spool_read(struct spool *sp, uint64_t *off, const char **ns,
+               bson_t *selector, int *upsert, bson_t *doc);
+uint64_t spool_read_begin(struct spool *sp);
+void spool_read_commit(struct spool *sp, uint64_t off);
+int spool_is_empty(struct spool *sp);
+void spool_sync(struct spool *sp);
+
+#endif // SPOOL_H
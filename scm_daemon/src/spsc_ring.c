@@ -0,0 +1,31 @@
+#include "spsc_ring.h"
+
+/**
+ * Allocate the ring. The size is rounded up to the next power of two, so
+ * that the slot index can be computed with a mask.
+ */
+void spsc_ring_init(struct spsc_ring *ring, size_t size, size_t elsize)
+{
+	size_t pow2;
+
+	for (pow2 = 1; pow2 < size; pow2 <<= 1)
+		;
+
+	ring->size = pow2;
+	ring->elsize = elsize;
+	ring->head = 0;
+	ring->tail = 0;
+
+	if (!(ring->slots = calloc(pow2, elsize))) {
+		fprintf(stderr, "Failed to allocate memory for ring buffer!\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Free memory
+ */
+void spsc_ring_free(struct spsc_ring *ring)
+{
+	free(ring->slots);
+}
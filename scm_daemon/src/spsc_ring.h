@@ -0,0 +1,77 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+// Leaf header without common.h, as other headers embed the ring
+#include <stdio.h>
+#include <stdlib.h>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Elements are fixed-size slots, written and read in place.
+struct spsc_ring {
+	size_t size;  // Number of slots, power of two
+	size_t elsize;  // Bytes per slot
+	unsigned char *slots;
+	size_t head __attribute__((aligned(64)));  // Written by producer only
+	size_t tail __attribute__((aligned(64)));  // Written by consumer only
+};
+
+void spsc_ring_init(struct spsc_ring *ring, size_t size, size_t elsize);
+void spsc_ring_free(struct spsc_ring *ring);
+
+/**
+ * Producer: Get the next free slot, or NULL if the ring is full. The slot
+ * becomes visible to the consumer with spsc_ring_commit().
+ */
+static inline void *spsc_ring_reserve(struct spsc_ring *ring)
+{
+	size_t head, tail;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= ring->size)
+		return NULL;
+
+	return ring->slots + (head & (ring->size - 1)) * ring->elsize;
+}
+
+/**
+ * Producer: Publish the slot obtained by spsc_ring_reserve()
+ */
+static inline void spsc_ring_commit(struct spsc_ring *ring)
+{
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Consumer: Get the oldest published slot, or NULL if the ring is empty
+ */
+static inline void *spsc_ring_peek(struct spsc_ring *ring)
+{
+	size_t head, tail;
+
+	tail = ring->tail;
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return NULL;
+
+	return ring->slots + (tail & (ring->size - 1)) * ring->elsize;
+}
+
+/**
+ * Consumer: Hand the slot obtained by spsc_ring_peek() back to the producer
+ */
+static inline void spsc_ring_release(struct spsc_ring *ring)
+{
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Number of slots in use. Exact only when called by producer or consumer.
+ */
+static inline size_t spsc_ring_count(struct spsc_ring *ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+#endif // SPSC_RING_H
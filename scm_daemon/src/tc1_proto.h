@@ -0,0 +1,27 @@
+#ifndef TC1_PROTO_H
+#define TC1_PROTO_H
+
+// Leaf header without common.h, as the simulator shares it
+
+/* SNMP OIDs of the TC1 */
+#define SNMP_RX1_CFG1_TUNER ".1.3.6.1.4.1.27928.108.1.1.1.1.1.1"  // Frequency
+#define SNMP_RX1_CFG2_TUNER ".1.3.6.1.4.1.27928.108.1.1.1.2.1.1"  // Frequency
+#define SNMP_RX2_CFG1_TUNER ".1.3.6.1.4.1.27928.108.1.1.2.1.1.1"  // Frequency
+#define SNMP_RX2_CFG2_TUNER ".1.3.6.1.4.1.27928.108.1.1.2.2.1.1"  // Frequency
+#define SNMP_RX1_CFG1_MODE ".1.3.6.1.4.1.27928.108.1.1.1.3.1"  // (De-)Activate profile
+#define SNMP_RX1_CFG2_MODE ".1.3.6.1.4.1.27928.108.1.1.1.3.2"  // (De-)Activate profile
+#define SNMP_RX2_CFG1_MODE ".1.3.6.1.4.1.27928.108.1.1.2.3.1"  // (De-)Activate profile
+#define SNMP_RX2_CFG2_MODE ".1.3.6.1.4.1.27928.108.1.1.2.3.2"  // (De-)Activate profile
+#define SNMP_RX_MGMT ".1.3.6.1.4.1.27928.108.1.1.3.1"  // Activate RX1 or RX2 (with 1 or 2)
+#define SNMP_RX1_STATUS ".1.3.6.1.4.1.27928.108.1.1.1.4.1"  // Tuner (un-)locked
+#define SNMP_RX2_STATUS ".1.3.6.1.4.1.27928.108.1.1.2.4.1"  // Tuner (un-)locked
+
+/* Layout of the UDP messages, as parsed by the SDD and MODCOD handlers */
+#define SDD_MIN_LEN 152  // Last byte read from SDD messages is at 151
+#define SDD_LOCK_OFFSET 6  // Bit 4: demod locked, 6: tracked, 7: definitive
+#define SDD_ESNO_OFFSET 150  // EsNo in 0.1 dB, big endian
+#define MC_HEADER_LEN 40
+#define MC_MODCODS 28  // Each with 2 normal and 2 short frame counters
+#define MC_MIN_LEN 936  // 40 byte header + 28 MODCODs * 4 counters * 8 byte
+
+#endif // TC1_PROTO_H
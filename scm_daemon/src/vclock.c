@@ -0,0 +1,78 @@
+#include "vclock.h"
+#include "latency_hist.h"
+#include <sys/time.h>
+
+static int64_t real_now_ns(struct vclock *clk);
+static int64_t real_mono_ns(struct vclock *clk);
+static int64_t sim_now_ns(struct vclock *clk);
+
+/**
+ * Set up a clock following the wall clock. Within the callbacks of
+ * 'evbase', the time is the one cached by LibEvent when the callbacks were
+ * started, so that handling a burst of packets costs no system calls.
+ */
+void vclock_init_real(struct vclock *clk, struct event_base *evbase)
+{
+	clk->now_ns = real_now_ns;
+	clk->mono_ns = real_mono_ns;
+	clk->evbase = evbase;
+	clk->sim_ns = 0;
+}
+
+/**
+ * Set up a simulated clock, standing still at 'start' until vclock_set()
+ */
+void vclock_init_sim(struct vclock *clk, time_t start)
+{
+	clk->now_ns = sim_now_ns;
+	clk->mono_ns = sim_now_ns;
+	clk->evbase = NULL;
+	clk->sim_ns = (int64_t)start * 1000000000;
+}
+
+/**
+ * Move a simulated clock forward to 'ts'. It never goes back.
+ */
+void vclock_set(struct vclock *clk, time_t ts)
+{
+	vclock_set_ns(clk, (int64_t)ts * 1000000000);
+}
+
+/**
+ * Move a simulated clock forward to 'ns', in ns since the epoch
+ */
+void vclock_set_ns(struct vclock *clk, int64_t ns)
+{
+	if (ns > clk->sim_ns)
+		clk->sim_ns = ns;
+}
+
+/**
+ * Helper for the real clock
+ */
+static int64_t real_now_ns(struct vclock *clk)
+{
+	struct timeval tv;
+
+	if (event_base_gettimeofday_cached(clk->evbase, &tv) == -1)
+		gettimeofday(&tv, NULL);
+
+	return (int64_t)tv.tv_sec * 1000000000 + (int64_t)tv.tv_usec * 1000;
+}
+
+/**
+ * Helper for the real clock: CLOCK_MONOTONIC, which is read through the vDSO
+ * without a system call
+ */
+static int64_t real_mono_ns(struct vclock *clk)
+{
+	return latency_now_ns();
+}
+
+/**
+ * Helper for the simulated clock
+ */
+static int64_t sim_now_ns(struct vclock *clk)
+{
+	return clk->sim_ns;
+}
@@ -0,0 +1,60 @@
+#ifndef VCLOCK_H
+#define VCLOCK_H
+
+// Leaf header without common.h, as other headers embed the clock
+#include <stdint.h>
+#include <time.h>
+#include <event2/event.h>
+
+// Time source of the handlers and monitors. The real clock takes the time
+// cached by the event base of the thread using it, the simulated clock only
+// moves when told to, so that a day of slices and monitor checks can be run
+// through in seconds. The wall time is for the time stamps of the documents
+// and the kernel, the monotonic time for the intervals, so that a step of the
+// system clock can't end or stretch a slice.
+struct vclock {
+	int64_t (*now_ns)(struct vclock *clk);
+	int64_t (*mono_ns)(struct vclock *clk);
+	struct event_base *evbase;  // Real clock only
+	int64_t sim_ns;  // Simulated clock only
+};
+
+void vclock_init_real(struct vclock *clk, struct event_base *evbase);
+void vclock_init_sim(struct vclock *clk, time_t start);
+void vclock_set(struct vclock *clk, time_t ts);
+void vclock_set_ns(struct vclock *clk, int64_t ns);
+
+/**
+ * Get the current time of the clock, in ns since the epoch
+ */
+static inline int64_t vclock_now_ns(struct vclock *clk)
+{
+	return clk->now_ns(clk);
+}
+
+/**
+ * Get the current time of the clock
+ */
+static inline time_t vclock_now(struct vclock *clk)
+{
+	return clk->now_ns(clk) / 1000000000;
+}
+
+/**
+ * Get the monotonic time of the clock, in ns since an arbitrary point. Only
+ * the differences are meaningful. The simulated clock has a single time.
+ */
+static inline int64_t vclock_mono_ns(struct vclock *clk)
+{
+	return clk->mono_ns(clk);
+}
+
+/**
+ * Get the monotonic time of the clock, in seconds
+ */
+static inline time_t vclock_mono(struct vclock *clk)
+{
+	return clk->mono_ns(clk) / 1000000000;
+}
+
+#endif // VCLOCK_H
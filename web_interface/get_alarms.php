@@ -0,0 +1,43 @@
+<?php
+
+// Connect
+$m = new MongoClient();
+
+// Select a database. In fleet mode, every device has its own one.
+$db_name = "tc1";
+if (isset($_GET["dev"]) && preg_match('/^[A-Za-z0-9_-]+$/', $_GET["dev"]))
+  $db_name = "tc1_" . $_GET["dev"];
+$db = $m->selectDB($db_name);
+
+// Select a collection (analogous to a relational database's table)
+$collection = $db->alarms;
+
+// Latest state change of each NS. The index on rx, ns and ts covers the
+// sort, so this does not have to look at the older changes.
+$result = $collection->aggregate([
+  ['$sort' => ['rx' => 1, 'ns' => 1, 'ts' => -1]],
+  ['$group' => [
+    '_id' => ['rx' => '$rx', 'ns' => '$ns'],
+    'state' => ['$first' => '$state'],
+    'ts' => ['$first' => '$ts'],
+    'esno' => ['$first' => '$esno'],
+    'flags' => ['$first' => '$flags']
+  ]]
+]);
+
+// Build a JSON objects to be returned, only with the NS not doing fine
+$all = [];
+foreach ($result["result"] as $doc) {
+  if ($doc["state"] != "warn" && $doc["state"] != "alarm")
+    continue;
+  $arr = [];
+  $arr["rx"] = $doc["_id"]["rx"];
+  $arr["ns"] = $doc["_id"]["ns"];
+  $arr["state"] = $doc["state"];
+  $arr["since"] = $doc["ts"]->sec * 1000;
+  $arr["esno"] = $doc["esno"];
+  $arr["flags"] = $doc["flags"];
+  array_push($all, $arr);
+}
+
+echo json_encode($all);
@@ -3,18 +3,25 @@
 // Connect
 $m = new MongoClient();
 
-// Select a database
-$db = $m->tc1;
+// Select a database. In fleet mode, every device has its own one.
+$db_name = "tc1";
+if (isset($_GET["dev"]) && preg_match('/^[A-Za-z0-9_-]+$/', $_GET["dev"]))
+  $db_name = "tc1_" . $_GET["dev"];
+$db = $m->selectDB($db_name);
 
-// Select a collection (analogous to a relational database's table)
-$collection = $db->sdd;
+// Select a collection (analogous to a relational database's table).
+// The daemon keeps an aggregate per interval there, so no grouping is
+// needed at request time. Slices from before the daemon kept these
+// aggregates are only in the raw collection.
+$collection = $db->sdd_rollup;
+$raw_collection = $db->sdd;
 
 // Get URL variables
 $interval_name = "minute";
 if (isset($_GET["interval"]))
   $interval_name = $_GET["interval"];
 
-// Set the appropriate Mongo request buckets for this interval
+// Set the appropriate Mongo request buckets for the raw collection
 $interval_sub = [];
 switch ($interval_name) {
 case "minute":
@@ -48,41 +55,59 @@ default:
   exit(1);
 }
 
-// Build full request for MongoDB
-$selection = [
-  [
-    '$group' => [
-      '_id' => [
-        'interval_sup' => $interval_sup,
-        'interval_sub' => $interval_sub,
-        'rx' => '$rx',
-        'ns' => '$ns',
-      ],
-      'ts' => ['$first' => '$ts'],
-      'esno' => ['$avg' => '$esno'],
-    ],
-  ],
-  [
-    '$sort' => ['ts' => -1],
-  ],
-  [
-    '$limit' => 10000,
-  ],
-];
-
+$limit = 10000;
 
 // Send request to db and retrieve result
-$cursor = $collection->aggregate($selection);
+$cursor = $collection->find(['tier' => $interval_name])
+                     ->sort(['ts' => -1])
+                     ->limit($limit);
 
 // Preprocess the result to separate data for different
 // network segments into different buckets
 $buckets = [];
-foreach ($cursor["result"] as $document) {
-    $ns = $document["_id"]["ns"] . " on " . $document["_id"]["rx"];
+$oldest = NULL;
+$total = 0;
+foreach ($cursor as $document) {
+    $ns = $document["ns"] . " on " . $document["rx"];
     $val = [];
     if(!array_key_exists($ns, $buckets))
       $buckets[$ns] = [];
     array_push($buckets[$ns], $document);
+    $oldest = $document["ts"];
+    $total++;
+}
+
+// Group the raw slices from before the oldest aggregate, as the daemon
+// does not backfill the aggregates of older slices
+if ($total < $limit) {
+  $selection = [];
+  if ($oldest !== NULL)
+    $selection[] = [ '$match' => [ 'ts' => [ '$lt' => $oldest ] ] ];
+  $selection[] = [
+    '$group' => [
+      '_id' => [
+        'interval_sup' => $interval_sup,
+        'interval_sub' => $interval_sub,
+        'rx' => '$rx',
+        'ns' => '$ns',
+      ],
+      'ts' => ['$min' => '$ts'],
+      'esno' => ['$avg' => '$esno'],
+    ],
+  ];
+  $selection[] = [ '$sort' => ['ts' => -1] ];
+  $selection[] = [ '$limit' => $limit - $total ];
+
+  $raw = $raw_collection->aggregate($selection);
+  foreach ($raw["result"] as $document) {
+      $ns = $document["_id"]["ns"] . " on " . $document["_id"]["rx"];
+      if(!array_key_exists($ns, $buckets))
+        $buckets[$ns] = [];
+      array_push($buckets[$ns], [
+        "ts" => $document["ts"],
+        "esno" => $document["esno"],
+      ]);
+  }
 }
 
 ksort($buckets);
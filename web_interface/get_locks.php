@@ -0,0 +1,46 @@
+<?php
+
+// Connect
+$m = new MongoClient();
+
+// Select a database. In fleet mode, every device has its own one.
+$db_name = "tc1";
+if (isset($_GET["dev"]) && preg_match('/^[A-Za-z0-9_-]+$/', $_GET["dev"]))
+  $db_name = "tc1_" . $_GET["dev"];
+$db = $m->selectDB($db_name);
+
+// Select a collection (analogous to a relational database's table)
+$collection = $db->sdd_lock;
+
+// Which lock to show: locked, tracked or definitive
+$kind = "definitive";
+if (isset($_GET["kind"]) && in_array($_GET["kind"], ["locked", "tracked", "definitive"]))
+  $kind = $_GET["kind"];
+
+// Send request to db and retrieve result, one document per NS and report.
+// Only the recent reports are of interest, oldest first for the chart.
+$cursor = $collection->find(['ts' => ['$gte' => new MongoDate(time() - 7 * 86400)]])
+                     ->sort(['ts' => 1])
+                     ->limit(10000);
+
+// Preprocess the result to separate the median and 99th percentile of
+// each NS into different series
+$p50 = [];
+$p99 = [];
+foreach ($cursor as $id => $doc) {
+  if ($doc[$kind]["count"] == 0)
+    continue;
+  $ts = $doc["ts"]->sec * 1000;
+  $ns = $doc["rx"] . " " . $doc["ns"];
+  $p50[$ns][] = [$ts, $doc[$kind]["p50"]];
+  $p99[$ns][] = [$ts, $doc[$kind]["p99"]];
+}
+
+// Build a JSON objects to be returned
+$all = [];
+foreach ($p50 as $ns => $values) {
+  array_push($all, ["key" => $ns . " p50", "values" => $values]);
+  array_push($all, ["key" => $ns . " p99", "values" => $p99[$ns]]);
+}
+
+echo json_encode($all);
@@ -11,8 +11,11 @@ $mc_name = ["QPSK 1/4", "QPSK 1/3", "QPSK 2/5", "QPSK 1/2",
 // Connect
 $m = new MongoClient();
 
-// Select a database
-$db = $m->tc1;
+// Select a database. In fleet mode, every device has its own one.
+$db_name = "tc1";
+if (isset($_GET["dev"]) && preg_match('/^[A-Za-z0-9_-]+$/', $_GET["dev"]))
+  $db_name = "tc1_" . $_GET["dev"];
+$db = $m->selectDB($db_name);
 
 // Select a collection (analogous to a relational database's table)
 $collection = $db->mc;
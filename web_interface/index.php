@@ -52,6 +52,9 @@
             <p class="navbar-text">
               Newest data: <span id="newest-data"></span>
             </p>
+            <p class="navbar-text">
+              Alarms: <span id="alarms"></span>
+            </p>
           </div>
           <div class="navbar-right">
             <div class="btn-group" role="group">
@@ -97,6 +100,23 @@
         setTimeout(checkServerWatchdog, 10000);
       }
       checkServerWatchdog();
+
+      function checkAlarms() {
+        // In fleet mode, select the device with '?dev=<name>'
+        var dev = window.location.search.match(/[?&]dev=([A-Za-z0-9_-]+)/);
+        dev = (dev) ? '?dev=' + dev[1] : '';
+        $.getJSON("get_alarms.php" + dev, function(data) {
+          if (data.length == 0) {
+            $('#alarms').text("none");
+            return;
+          }
+          $('#alarms').text(data.map(function(a) {
+            return a.ns + " on " + a.rx + " (" + a.state + ")";
+          }).join(", "));
+        });
+        setTimeout(checkAlarms, 60000);
+      }
+      checkAlarms();
     </script>
 
     <script>
@@ -121,6 +141,9 @@
       });
 
       interval = 'ten_minutes';
+      // In fleet mode, select the device with '?dev=<name>'
+      device = window.location.search.match(/[?&]dev=([A-Za-z0-9_-]+)/);
+      device = (device) ? '&dev=' + device[1] : '';
       periodicUpdate();
 
       $('#interval_minute')
@@ -167,7 +190,7 @@
 
         var move_focus_window = (isFocusWindowAtCurrent()) ? true : false;
 
-        $.getJSON("get_esno.php?interval=" + interval, function(data) {
+        $.getJSON("get_esno.php?interval=" + interval + device, function(data) {
           d3.select('#main-graph')
             .datum(data)
             .call(chart);